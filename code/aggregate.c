@@ -0,0 +1,285 @@
+// Routines to aggregate weather station samples between uploads
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+// Samples are folded into running totals as they arrive, so no storage is
+// needed for individual samples.  All arithmetic is fixed-point: wind
+// direction is averaged as a vector (weighted by speed) using a table of
+// sine values, and the mean direction is found by searching the same table
+
+
+#include <time.h>
+#include <string.h>
+#include "davis.h"
+#include "aggregate.h"
+
+
+// Internal structure for running totals of a single quantity
+
+typedef struct
+    {
+    long sum;                           // Sum of values
+    unsigned int count;                 // Number of values
+    int min;                            // Lowest value
+    int max;                            // Highest value
+    } AggAcc_t;
+
+
+// Internal structure containing state variables
+
+static struct
+    {
+    unsigned int samples;               // Number of samples in interval
+    AggAcc_t out_temp;                  // Outside temperature
+    AggAcc_t in_temp;                   // Inside temperature
+    AggAcc_t barometer;                 // Barometer
+    unsigned long speed_sum;            // Sum of wind speeds
+    unsigned int wind_count;            // Number of wind speeds
+    unsigned char gust_speed;           // Highest wind speed
+    unsigned int gust_dir;              // Direction at highest wind speed
+    long east_sum;                      // Sum of east components of wind vector
+    long north_sum;                     // Sum of north components of wind vector
+    } agg_state;
+
+
+// Maximum samples in one interval (keeps running totals within a long)
+
+#define AGG_MAX_SAMPLES         30000U
+
+
+// Sine of 0 to 90 degrees in 1 degree steps (scaled by 16384)
+
+#define SIN_ONE                 16384
+
+static const int sin_table[91] =
+    {
+        0,   286,   572,   857,  1143,  1428,  1713,  1997,
+     2280,  2563,  2845,  3126,  3406,  3686,  3964,  4240,
+     4516,  4790,  5063,  5334,  5604,  5872,  6138,  6402,
+     6664,  6924,  7182,  7438,  7692,  7943,  8192,  8438,
+     8682,  8923,  9162,  9397,  9630,  9860, 10087, 10311,
+    10531, 10749, 10963, 11174, 11381, 11585, 11786, 11982,
+    12176, 12365, 12551, 12733, 12911, 13085, 13255, 13421,
+    13583, 13741, 13894, 14044, 14189, 14330, 14466, 14598,
+    14726, 14849, 14968, 15082, 15191, 15296, 15396, 15491,
+    15582, 15668, 15749, 15826, 15897, 15964, 16026, 16083,
+    16135, 16182, 16225, 16262, 16294, 16322, 16344, 16362,
+    16374, 16382, 16384,
+    };
+
+
+// Divisor applied to each wind vector component (speed x sine) before it is
+// added to the running totals (keeps totals within a long for maximum samples)
+
+#define VEC_DIVISOR             64
+
+
+// *** INTERNAL FUNCTIONS ***
+
+// Returns sine of angle in degrees (scaled by SIN_ONE)
+
+static int agg_sin(unsigned int deg)
+    {
+    deg %= 360;
+
+    if (deg <= 90)
+        return sin_table[deg];
+    else if (deg <= 180)
+        return sin_table[180 - deg];
+    else if (deg <= 270)
+        return -sin_table[deg - 180];
+    else
+        return -sin_table[360 - deg];
+    }
+
+
+// Adds value to running totals of a quantity
+
+static void acc_add(AggAcc_t * acc, int value)
+    {
+    if (acc->count == 0 || value < acc->min)
+        acc->min = value;
+
+    if (acc->count == 0 || value > acc->max)
+        acc->max = value;
+
+    acc->sum += value;
+    ++acc->count;
+    }
+
+
+// Divides sum by count, rounding to nearest (count must be non-zero)
+
+static long round_div(long sum, unsigned int count)
+    {
+    if (sum >= 0)
+        return (sum + count / 2) / count;
+    else
+        return (sum - count / 2) / count;
+    }
+
+
+// Fills in result for a quantity from its running totals
+
+static void acc_result(const AggAcc_t * acc, AggStat_t * stat)
+    {
+    stat->count = acc->count;
+
+    if (acc->count == 0)
+        {
+        stat->min = stat->max = stat->mean = 0;
+        return;
+        }
+
+    stat->min = acc->min;
+    stat->max = acc->max;
+    stat->mean = (int) round_div(acc->sum, acc->count);
+    }
+
+
+// Finds compass direction of vector from its east and north components
+// Angle from the nearer of north or south is found by a binary search of
+// the sine table, then placed in the correct quadrant
+// Returns direction in degrees (1 to 360), or 0 if vector is zero (calm)
+
+static unsigned int agg_vector_dir(long east, long north)
+    {
+    long ae;
+    long an;
+    unsigned int lo;
+    unsigned int hi;
+    unsigned int mid;
+
+    if (east == 0 && north == 0)
+        return 0;
+
+    ae = (east < 0) ? -east : east;
+    an = (north < 0) ? -north : north;
+
+    while (ae > 0x7FFFL || an > 0x7FFFL)       // Keep products within a long
+        {
+        ae >>= 1;
+        an >>= 1;
+        }
+
+    // Find lowest angle where tangent (sin / cos) reaches ae / an
+
+    lo = 0;
+    hi = 90;
+
+    while (lo < hi)
+        {
+        mid = (lo + hi) / 2;
+
+        if (an * sin_table[mid] >= ae * sin_table[90 - mid])
+            hi = mid;
+        else
+            lo = mid + 1;
+        }
+
+    // Step back if angle below is a closer match
+
+    if (lo != 0 && (an * sin_table[lo] - ae * sin_table[90 - lo]) >
+                   (ae * sin_table[91 - lo] - an * sin_table[lo - 1]))
+        --lo;
+
+    if (east >= 0)
+        lo = (north >= 0) ? lo : 180 - lo;
+    else
+        lo = (north >= 0) ? 360 - lo : 180 + lo;
+
+    return (lo == 0) ? 360 : lo;
+    }
+
+
+// *** EXTERNAL FUNCTIONS ***
+
+// Discards samples and starts a new interval
+
+void agg_reset(void)
+    {
+    memset(&agg_state, 0, sizeof(agg_state));
+    }
+
+
+// Adds sample to running totals for current interval
+// Fields without a sensor present are left out of their totals
+
+void agg_add_sample(const DavSample_t * sample)
+    {
+    if (agg_state.samples >= AGG_MAX_SAMPLES)
+        return;
+
+    ++agg_state.samples;
+
+    if (sample->valid & DAV_SMP_OUT_TEMP)
+        acc_add(&agg_state.out_temp, sample->out_temp);
+
+    if (sample->valid & DAV_SMP_IN_TEMP)
+        acc_add(&agg_state.in_temp, sample->in_temp);
+
+    if (sample->valid & DAV_SMP_BAROMETER)
+        acc_add(&agg_state.barometer, (int) sample->barometer);
+
+    if (!(sample->valid & DAV_SMP_WIND_SPEED))
+        return;
+
+    agg_state.speed_sum += sample->wind_speed;
+    ++agg_state.wind_count;
+
+    // Gust is kept even if direction vane is missing (direction then 0 as
+    // for dashed direction in LOOP packet)
+
+    if (sample->wind_speed > agg_state.gust_speed)
+        {
+        agg_state.gust_speed = sample->wind_speed;
+        agg_state.gust_dir = (sample->valid & DAV_SMP_WIND_DIR) ? sample->wind_dir : 0;
+        }
+
+    if (!(sample->valid & DAV_SMP_WIND_DIR) || sample->wind_speed == 0)
+        return;
+
+    agg_state.east_sum += ((long) sample->wind_speed * agg_sin(sample->wind_dir))
+                          / VEC_DIVISOR;
+    agg_state.north_sum += ((long) sample->wind_speed * agg_sin(sample->wind_dir + 90))
+                           / VEC_DIVISOR;
+    }
+
+
+// Returns number of samples in current interval
+
+unsigned int agg_get_count(void)
+    {
+    return agg_state.samples;
+    }
+
+
+// Fills in results for current interval, then starts a new interval
+
+void agg_close(AggResult_t * result)
+    {
+    result->samples = agg_state.samples;
+
+    acc_result(&agg_state.out_temp, &result->out_temp);
+    acc_result(&agg_state.in_temp, &result->in_temp);
+    acc_result(&agg_state.barometer, &result->barometer);
+
+    result->wind_count = agg_state.wind_count;
+
+    if (agg_state.wind_count != 0)
+        result->wind_mean = (unsigned int) round_div(agg_state.speed_sum * 10,
+                                                     agg_state.wind_count);
+    else
+        result->wind_mean = 0;
+
+    result->gust_speed = agg_state.gust_speed;
+    result->gust_dir = agg_state.gust_dir;
+    result->wind_dir = agg_vector_dir(agg_state.east_sum, agg_state.north_sum);
+
+    agg_reset();
+    }
@@ -0,0 +1,43 @@
+// Header file for routines to aggregate weather station samples between uploads
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+// Structure definitions
+
+typedef struct
+    {
+    unsigned int count;                 // Number of valid samples (0 if none)
+    int min;                            // Lowest value
+    int max;                            // Highest value
+    int mean;                           // Mean value (rounded)
+    } AggStat_t;
+
+typedef struct
+    {
+    unsigned int samples;               // Number of samples in interval
+    AggStat_t out_temp;                 // Outside temperature (F x 10)
+    AggStat_t in_temp;                  // Inside temperature (F x 10)
+    AggStat_t barometer;                // Barometer (inches Hg x 1000)
+    unsigned int wind_count;            // Number of valid wind speed samples
+    unsigned int wind_mean;             // Mean wind speed (mph x 10)
+    unsigned char gust_speed;           // Highest wind speed (mph)
+    unsigned int gust_dir;              // Wind direction at highest speed (degrees, 0 if unknown)
+    unsigned int wind_dir;              // Vector mean direction (degrees, 0 if calm)
+    } AggResult_t;
+
+// Function prototypes
+
+void agg_reset(void);
+void agg_add_sample(const DavSample_t * sample);
+unsigned int agg_get_count(void);
+void agg_close(AggResult_t * result);
+
+#endif
@@ -31,6 +31,9 @@ unsigned char bb_post_error_flag;                   // Indicates previous POST e
 const char * bb_post_error_str;                     // Description of previous POST error
 int bb_post_error_state_num;                        // Last state for previous POST error
 
+unsigned long bb_last_post_time;                    // RTC time of last successful POST
+unsigned char bb_backfill_flag;                     // Indicates archive backfill needed
+
 unsigned int bb_test_word;                          // Scratch value for test commands
 
 #pragma seg(BSS)
@@ -49,6 +52,9 @@ void bb_init(void)
 
         bb_seq_num = 0UL;
 
+        bb_last_post_time = 0UL;                    // No backfill until next success
+        bb_backfill_flag = 0;
+
         bb_ver_major = 0;                           // Force clear of POST error values
         bb_ver_minor = 0;
         }
@@ -26,6 +26,9 @@ extern unsigned char bb_post_error_flag;
 extern const char * bb_post_error_str;
 extern int bb_post_error_state_num;
 
+extern unsigned long bb_last_post_time;
+extern unsigned char bb_backfill_flag;
+
 extern unsigned int bb_test_word;
 
 #pragma seg(BSS)
@@ -1,18 +1,42 @@
-// Header file for routine to calculate 16-bit CCITT standard CRC for
-// blocks of data sent by Vantage Pro(TM) weather station
-
-// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
-
-// All rights reserved, except for those rights implicitly granted to
-// GitHub Inc by publishing on GitHub and those rights granted by
-// commercial agreement with the author.
-
-
-#ifndef CRC_H
-#define CRC_H
-
-// Function prototypes
-
-unsigned int crc_calculate(const void * blk_start, size_t blk_size);
-
-#endif
+// Header file for routine to calculate 16-bit CCITT standard CRC for
+// blocks of data sent by Vantage Pro(TM) weather station
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+#ifndef CRC_H
+#define CRC_H
+
+// Available CRC calculation methods (all give identical results)
+
+#define CRC_METHOD_NIBBLE       1       // 16-entry table (smallest ROM usage)
+#define CRC_METHOD_BYTE         2       // 256-entry table (original method)
+#define CRC_METHOD_SLICE4       3       // Extra 3 x 256-entry tables, 4 bytes per step
+#define CRC_METHOD_SLICE8       4       // Extra 7 x 256-entry tables, 8 bytes per step
+
+// Method to use in build (may be overridden on compiler command line)
+
+#ifndef CRC_METHOD
+#define CRC_METHOD              CRC_METHOD_BYTE
+#endif
+
+// Structure definitions
+
+typedef struct
+    {
+    unsigned int crc;                   // Running CRC value
+    } CrcCtx_t;
+
+// Function prototypes
+
+unsigned int crc_calculate(const void * blk_start, size_t blk_size);
+
+void crc_init(CrcCtx_t * ctx);
+void crc_update(CrcCtx_t * ctx, const void * blk_start, size_t blk_size);
+unsigned int crc_final(const CrcCtx_t * ctx);
+
+#endif
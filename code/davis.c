@@ -43,25 +43,116 @@ const char * dav_error_str;                     // Points to last error string
 // Positions of various elements in binary data buffer
 
 #define DAV_DATA_LOO             0
-#define DAV_DATA_BAR_L           7
-#define DAV_DATA_BAR_H           8
-#define DAV_DATA_IN_TEMP_L       9
-#define DAV_DATA_IN_TEMP_H      10
-#define DAV_DATA_OUT_TEMP_L     12
-#define DAV_DATA_OUT_TEMP_H     13
-#define DAV_DATA_WIND_SPEED     14
-#define DAV_DATA_WIND_DIR_L     16
-#define DAV_DATA_WIND_DIR_H     17
+#define DAV_DATA_TYPE            4
 #define DAV_DATA_LF             95
 #define DAV_DATA_CR             96
 #define DAV_DATA_CRC_H          97
 #define DAV_DATA_CRC_L          98
 
+#define DAV_TYPE_LOOP            0      // Values of packet type element
+#define DAV_TYPE_LOOP2           1
+
+
+// Descriptions of fields within LOOP and LOOP2 packets
+// Multi-byte values are stored LSB first
+
+typedef struct
+    {
+    unsigned char offset;               // Position in packet (0 if not present)
+    unsigned char flags;                // Width and signedness (see below)
+    unsigned int scale;                 // Divisor to convert value to stated units
+    unsigned int sentinel;              // Raw value sent when sensor is absent
+    } DavField_t;
+
+#define FLD_BYTE        0x00
+#define FLD_WORD        0x01
+#define FLD_SIGNED      0x02
+#define FLD_ZERO_NONE   0x04            // Zero also means no reading (as well as sentinel)
+
+#define NO_SENTINEL     0xFFFF          // For fields without a "dashed" value
+
+// Table entries are in order of DAV_FLD_xxx identifiers (see header file)
+
+static const DavField_t dav_loop_fields[DAV_NUM_FIELDS] =
+    {
+    {  7, FLD_WORD,               1000, 0           },  // Barometer
+    {  9, FLD_WORD | FLD_SIGNED,    10, 0x7FFF      },  // Inside temperature
+    { 11, FLD_BYTE,                  1, 0xFF        },  // Inside humidity
+    { 12, FLD_WORD | FLD_SIGNED,    10, 0x7FFF      },  // Outside temperature
+    { 14, FLD_BYTE,                  1, 0xFF        },  // Wind speed
+    { 15, FLD_BYTE,                  1, 0xFF        },  // 10 minute average wind speed
+    { 16, FLD_WORD | FLD_ZERO_NONE,  1, 0x7FFF      },  // Wind direction
+    { 33, FLD_BYTE,                  1, 0xFF        },  // Outside humidity
+    { 41, FLD_WORD,                  1, NO_SENTINEL },  // Rain rate
+    { 43, FLD_BYTE,                 10, 0xFF        },  // UV index
+    { 44, FLD_WORD,                  1, 0x7FFF      },  // Solar radiation
+    { 50, FLD_WORD,                  1, NO_SENTINEL },  // Day rain
+    { 46, FLD_WORD,                  1, NO_SENTINEL },  // Storm rain
+    {  0, FLD_BYTE,                  1, NO_SENTINEL },  // 10 minute wind gust
+    {  0, FLD_BYTE,                  1, NO_SENTINEL },  // Wind gust direction
+    {  0, FLD_BYTE,                  1, NO_SENTINEL },  // Dew point
+    {  0, FLD_BYTE,                  1, NO_SENTINEL },  // Heat index
+    {  0, FLD_BYTE,                  1, NO_SENTINEL },  // Wind chill
+    {  0, FLD_BYTE,                  1, NO_SENTINEL },  // Absolute barometer
+    };
+
+// (dew point, heat index and wind chill are words, but are sent as 255 when
+// dashed, as stated in the Davis serial protocol)
+
+static const DavField_t dav_loop2_fields[DAV_NUM_FIELDS] =
+    {
+    {  7, FLD_WORD,               1000, 0           },  // Barometer
+    {  9, FLD_WORD | FLD_SIGNED,    10, 0x7FFF      },  // Inside temperature
+    { 11, FLD_BYTE,                  1, 0xFF        },  // Inside humidity
+    { 12, FLD_WORD | FLD_SIGNED,    10, 0x7FFF      },  // Outside temperature
+    { 14, FLD_BYTE,                  1, 0xFF        },  // Wind speed
+    { 18, FLD_WORD,                 10, 0x7FFF      },  // 10 minute average wind speed
+    { 16, FLD_WORD | FLD_ZERO_NONE,  1, 0x7FFF      },  // Wind direction
+    { 33, FLD_BYTE,                  1, 0xFF        },  // Outside humidity
+    { 41, FLD_WORD,                  1, NO_SENTINEL },  // Rain rate
+    { 43, FLD_BYTE,                 10, 0xFF        },  // UV index
+    { 44, FLD_WORD,                  1, 0x7FFF      },  // Solar radiation
+    { 50, FLD_WORD,                  1, NO_SENTINEL },  // Day rain
+    { 46, FLD_WORD,                  1, NO_SENTINEL },  // Storm rain
+    { 22, FLD_WORD,                  1, 0x7FFF      },  // 10 minute wind gust
+    { 24, FLD_WORD | FLD_ZERO_NONE,  1, 0x7FFF      },  // Wind gust direction
+    { 30, FLD_WORD | FLD_SIGNED,     1, 0xFF        },  // Dew point
+    { 35, FLD_WORD | FLD_SIGNED,     1, 0xFF        },  // Heat index
+    { 37, FLD_WORD | FLD_SIGNED,     1, 0xFF        },  // Wind chill
+    { 67, FLD_WORD,               1000, 0           },  // Absolute barometer
+    };
+
+
+// Names and units of fields for display (in order of DAV_FLD_xxx identifiers)
+
+static const char * const dav_field_names[DAV_NUM_FIELDS] =
+    {
+    "Barometer",    "In Temp",      "In Hum",       "Out Temp",
+    "Wind Speed",   "Avg Wind",     "Wind Dir",     "Out Hum",
+    "Rain Rate",    "UV Index",     "Solar Rad",    "Day Rain",
+    "Storm Rain",   "Wind Gust",    "Gust Dir",     "Dew Point",
+    "Heat Index",   "Wind Chill",   "Abs Barometer",
+    };
+
+static const char * const dav_field_units[DAV_NUM_FIELDS] =
+    {
+    "inHg",         "F",            "%",            "F",
+    "mph",          "mph",          "degrees",      "%",
+    "clicks/hr",    "",             "W/m2",         "clicks",
+    "clicks",       "mph",          "degrees",      "F",
+    "F",            "F",            "inHg",
+    };
+
 
 // Special characters and strings used in data exchange
 
 #define DAV_ACK                 0x06
 #define DAV_NAK                 0x21
+#define DAV_CAN                 0x18
+#define DAV_ESC                 0x1B
+
+#define DAV_WAKEUP_STR          "\n\r"
+#define DAV_WAKEUP_LEN          (sizeof(DAV_WAKEUP_STR) - 1)
 
 #define DAV_OK_STR              "\n\rOK\n\r"
 #define DAV_OK_LEN              (sizeof(DAV_OK_STR) - 1)
@@ -73,14 +164,16 @@ enum state_value
     {
     DAV_IDLE = 0,
     DAV_STARTING,
-    DAV_AWAITING_LF,
-    DAV_AWAITING_CR,
+    DAV_AWAITING_WAKEUP,
     DAV_AWAITING_ACK,
     DAV_AWAITING_DATA,
     DAV_CHECKING_DATA,
     DAV_AWAITING_OK,
     DAV_ECHOING_RESP,
     DAV_AWAITING_TIME,
+    DAV_AWAITING_ARCH_HDR,
+    DAV_AWAITING_PAGE,
+    DAV_DELIVERING_PAGE,
     };
 
 
@@ -94,6 +187,9 @@ enum cmd_value
     DAV_CMD_CHK_TIME,
     DAV_CMD_SET_TIME,
     DAV_CMD_EXPECT_ACK,
+    DAV_CMD_STREAM,
+    DAV_CMD_DUMP_AFTER,
+    DAV_CMD_DUMP_STAMP,
     };
 
 
@@ -115,9 +211,45 @@ static struct
     int parm1;                          // Optional command parameter #1
     int parm2;                          // Optional command parameter #2
 
+    unsigned char * rx_buf;             // Buffer for block being received
+    unsigned int rx_len;                // Length of block (including CRC bytes)
+    unsigned int rx_pos;                // Number of bytes received so far
+    CrcCtx_t rx_crc;                    // CRC of bytes received so far
+
+    unsigned int stream_left;           // Packets still to come from "LOOP n" command
+    unsigned char resyncs;              // Consecutive bad packets in streaming mode
+    unsigned char data_retries;         // Re-requests left for single packet
+
+    unsigned int arch_date;             // Date stamp for start of archive download
+    unsigned int arch_time;             // Time stamp for start of archive download
+    unsigned int pages_left;            // Archive pages still to come
+    unsigned char page_rec;             // Index of next record to deliver from page
+    unsigned char page_retries;         // Attempts left to receive current page
+
     } dav_state;
 
 
+// Internal structure containing batch of commands to run in one session
+// (a command started on its own is run as a batch of one)
+
+typedef struct
+    {
+    enum cmd_value cmd_id;              // Command numeric identifier
+    char * cmd_str;                     // Command line string
+    int parm1;                          // Optional command parameter #1
+    int parm2;                          // Optional command parameter #2
+    int status;                         // Completion status (see header file)
+    } DavCmd_t;
+
+static struct
+    {
+    DavCmd_t cmd[DAV_MAX_BATCH];        // Commands in order of execution
+    unsigned char count;                // Number of commands in batch
+    unsigned char current;              // Index of command being processed
+    unsigned char building;             // Flag set while batch is being built
+    } dav_batch;
+
+
 // Number of seconds before overall time-out for state machine
 
 #define TIMEOUT_SECS            20
@@ -139,6 +271,128 @@ static struct
 #define MAX_TIME_MS             2000
 
 
+// Adaptive wakeup: the weather station is assumed to be still awake for a
+// time after it last responded, so the wakeup is skipped (falling back to
+// a full wakeup if the command gets no proper response).  Timeouts for the
+// first wakeup attempt and for a command sent without a wakeup are set from
+// running averages of observed response times (within the limits above).
+// After a fallback, the time assumed awake is cut to half the idle time that
+// proved too long, so a console that sleeps sooner is not caught out each time.
+
+#define AWAKE_MS                20000       // Time assumed awake after response
+#define MIN_AWAKE_MS            1000        // Shortest time assumed awake
+#define AVG_SHIFT               3           // Average weights new value by 1/8
+#define ADAPT_FACTOR            3           // Timeout as multiple of average...
+#define ADAPT_MARGIN_MS         100         // ...plus margin
+#define MIN_ADAPT_MS            150         // Shortest adapted timeout
+
+static struct
+    {
+    unsigned long last_ms;              // Time of last response from weather station
+    unsigned long awake_ms;             // Time assumed awake after response
+    unsigned char awake;                // Flag indicates last_ms is valid
+    unsigned char skipped;              // Flag indicates wakeup skipped for session
+    unsigned int wake_avg;              // Average wakeup response time (ms x 8)
+    unsigned int resp_avg;              // Average command response time (ms x 8)
+    } dav_link;
+
+
+// Timing statistics for phases of each transaction (see header file)
+// Durations are counted in buckets with the upper bounds below (in ms),
+// and the last bucket takes anything longer.  Counts stick at maximum.
+
+static const unsigned int dav_stat_bounds[DAV_STAT_BUCKETS - 1] =
+    {
+    10, 20, 50, 100, 200, 500, 1000, 2000, 5000,
+    };
+
+static const char * const dav_phase_names[DAV_NUM_PHASES] =
+    {
+    "Wakeup", "ACK", "First byte", "Data", "CRC check", "Total",
+    };
+
+#define RETRY_WAKEUP            0
+#define RETRY_PACKET            1
+#define RETRY_RESYNC            2
+#define RETRY_LOST_ACK          3
+#define RETRY_SKIPPED           4
+#define RETRY_FALLBACK          5
+
+static struct
+    {
+    unsigned int hist[DAV_NUM_PHASES][DAV_STAT_BUCKETS];    // Duration histograms
+    unsigned int retries[DAV_NUM_RETRY_TYPES];  // Counts of each type of retry
+    unsigned int failures[DAV_NUM_FAIL_CODES];  // Counts of each failure code
+    unsigned long mark_ms;              // Time at end of previous phase
+    unsigned long start_ms;             // Time at start of transaction
+    } dav_stats;
+
+
+// Staging buffer for bytes drained from serial buffer while matching tokens
+// Bytes after the end of a token (e.g. a packet following ACK) are left here
+// and taken first by the next block receive
+
+#define RX_STAGE_LEN            32
+
+static struct
+    {
+    unsigned char buf[RX_STAGE_LEN];
+    unsigned char pos;                  // Index of next unread byte
+    unsigned char len;                  // Number of bytes in buffer
+    unsigned char match_pos;            // Number of token bytes matched so far
+    unsigned char skipped;              // Flag set if bytes skipped while matching
+    } dav_rx;
+
+
+// Number of packets requested by each "LOOP n" command in streaming mode
+// (command is re-sent at end of each batch, see dav_next_stream_packet)
+// and maximum time between packets (weather station sends one every 2s)
+
+#define STREAM_PACKETS          100
+#define MAX_STREAM_MS           4000
+
+
+// Recovery from bad packets without a new wakeup: maximum consecutive bad
+// packets before streaming gives up, and number of times a single packet
+// is requested again
+
+#define MAX_RESYNCS             3
+#define MAX_DATA_RETRIES        2
+
+
+// Ring buffer of samples decoded from packets received in streaming mode
+// (oldest sample is overwritten if buffer is full)
+
+#define SAMPLE_RING_LEN         8
+
+static struct
+    {
+    DavSample_t buf[SAMPLE_RING_LEN];   // Decoded samples
+    unsigned char head;                 // Index of next sample to write
+    unsigned char count;                // Number of unread samples
+    } dav_ring;
+
+
+// Archive page buffer and definitions
+// (DMPAFT header response is also received into this buffer)
+
+#define DAV_PAGE_LEN            267
+#define DAV_PAGE_RECS           5
+
+static unsigned char dav_page[DAV_PAGE_LEN];
+
+#define DAV_PAGE_FIRST_REC      1       // Position of first record in page
+
+#define DAV_ARCH_HDR_LEN        6       // Length of DMPAFT header response
+#define DAV_ARCH_HDR_PAGES      0       // Positions of elements in header response
+#define DAV_ARCH_HDR_START      2
+
+#define DAV_ARCH_REC_DATE       0       // Positions of elements in archive record
+#define DAV_ARCH_REC_TIME       2
+
+#define MAX_PAGE_ATTEMPTS       3
+
+
 // Time buffer and definitions
 
 #define DAV_TIME_LEN            8
@@ -168,6 +422,95 @@ static char outBuffE[16];
 
 // *** INTERNAL FUNCTIONS ***
 
+// Internal function discards all received bytes (including any staged bytes)
+
+static void dav_rx_flush(void)
+    {
+    SerialRecvFlushE();
+
+    dav_rx.pos = 0;
+    dav_rx.len = 0;
+    dav_rx.match_pos = 0;
+    dav_rx.skipped = 0;
+    }
+
+
+// Internal function drains all bytes waiting in serial buffer into staging buffer
+// (as far as space allows) with a single read
+// Returns number of unread bytes in staging buffer
+
+static unsigned int dav_rx_fill(void)
+    {
+    unsigned int count, space;
+
+    if (dav_rx.pos != 0)
+        {
+        dav_rx.len -= dav_rx.pos;
+        memmove(dav_rx.buf, &dav_rx.buf[dav_rx.pos], dav_rx.len);
+        dav_rx.pos = 0;
+        }
+
+    count = SerialRecvCountE();
+    space = RX_STAGE_LEN - dav_rx.len;
+
+    if (count > space)
+        count = space;
+
+    if (count != 0)
+        dav_rx.len += fread(&dav_rx.buf[dav_rx.len], 1, count, SerialE);
+
+    return dav_rx.len;
+    }
+
+
+// Internal function gets next received byte
+// Returns byte value, or EOF if nothing has been received
+
+static int dav_rx_getc(void)
+    {
+    if (dav_rx.pos >= dav_rx.len && dav_rx_fill() == 0)
+        return EOF;
+
+    return dav_rx.buf[dav_rx.pos++];
+    }
+
+
+// Internal function searches received bytes for a token (e.g. wakeup or OK response)
+// Bytes up to the end of the token are consumed, but any after it are left staged
+// If anchored, the token must be the next thing received; otherwise other bytes
+// before it are skipped
+// Returns 1 if token found, -1 if anchored match failed, or 0 if still waiting
+
+static int dav_match_token(const char * token, unsigned char len, unsigned char anchored)
+    {
+    int ch;
+
+    while ((ch = dav_rx_getc()) != EOF)
+        {
+        if (ch == token[dav_rx.match_pos])
+            {
+            if (++dav_rx.match_pos >= len)
+                {
+                dav_rx.match_pos = 0;
+                return 1;
+                }
+            }
+        else if (anchored)
+            {
+            dav_rx.match_pos = 0;
+            return -1;
+            }
+        else
+            {
+            dav_rx.match_pos = (ch == token[0]) ? 1 : 0;
+            dav_rx.skipped = 1;
+            }
+        }
+
+    return 0;
+    }
+
+
 // Internal function cleans up serial port state
 
 static void dav_cleanup(void)
@@ -175,31 +518,163 @@ static void dav_cleanup(void)
     (void) SerialErrorE();                  // Ignore any serial error
 
     SerialSendFlushE();                     // Flush buffers
-    SerialRecvFlushE();
+    dav_rx_flush();
     }
 
 
-// Starts processing of command state machine
-// Performs clean-up on serial port state
+// Adds command to batch (see dav_begin_batch)
+// If no batch is being built, command is started immediately as a batch of one
 
-static void dav_start(enum cmd_value id, char * str)
+static void dav_start(enum cmd_value id, char * str, int parm1, int parm2)
     {
-    report(DETAIL, "Starting");
+    DavCmd_t * cmd;
 
-    dav_cleanup();
+    if (!dav_batch.building)
+        dav_batch.count = 0;
 
-    wx_set_leds(LED_DAVIS, LED_AMBER);
+    if (dav_batch.count >= DAV_MAX_BATCH)
+        {
+        report(PROBLEM, "Batch is full - '%s' command dropped", str);
+        return;
+        }
 
-    dav_state.state = DAV_STARTING;
-    dav_state.condition = DAV_PENDING;
+    cmd = &dav_batch.cmd[dav_batch.count++];
+
+    cmd->cmd_id = id;
+    cmd->cmd_str = str;
+    cmd->parm1 = parm1;
+    cmd->parm2 = parm2;
+    cmd->status = DAV_NOT_STARTED;
 
-    dav_state.cmd_id = id;
-    dav_state.cmd_str = str;
+    if (!dav_batch.building)
+        dav_run_batch();
+    }
 
-    dav_state.parm1 = 0;
-    dav_state.parm2 = 0;
 
-    RESET_TIMEOUT();
+// Internal function to load current command in batch into state variables
+
+static void dav_load_cmd(void)
+    {
+    DavCmd_t * cmd;
+
+    cmd = &dav_batch.cmd[dav_batch.current];
+
+    dav_state.cmd_id = cmd->cmd_id;
+    dav_state.cmd_str = cmd->cmd_str;
+    dav_state.parm1 = cmd->parm1;
+    dav_state.parm2 = cmd->parm2;
+
+    dav_state.resyncs = 0;
+    dav_state.data_retries = MAX_DATA_RETRIES;
+
+    cmd->status = DAV_PENDING;
+    }
+
+
+// Internal function to add one to a statistics count (sticks at maximum)
+
+static void dav_stat_bump(unsigned int * count)
+    {
+    if (*count != 0xFFFF)
+        ++*count;
+    }
+
+
+// Internal function to note time at start of a phase
+
+static void dav_mark_start(void)
+    {
+    dav_stats.mark_ms = getMilliSeconds();
+    }
+
+
+// Internal function to count duration since given time in phase histogram
+// Returns duration in ms
+
+static unsigned long dav_stat_time(unsigned char phase, unsigned long since_ms)
+    {
+    unsigned long elapsed;
+    unsigned char bucket;
+
+    elapsed = getMilliSeconds() - since_ms;
+
+    for (bucket = 0; bucket < DAV_STAT_BUCKETS - 1; ++bucket)
+        {
+        if (elapsed < dav_stat_bounds[bucket])
+            break;
+        }
+
+    dav_stat_bump(&dav_stats.hist[phase][bucket]);
+
+    return elapsed;
+    }
+
+
+// Internal function to count duration of phase that has just ended
+// (which also marks the start of the next phase)
+// Returns duration in ms
+
+static unsigned long dav_mark(unsigned char phase)
+    {
+    unsigned long elapsed;
+
+    elapsed = dav_stat_time(phase, dav_stats.mark_ms);
+    dav_mark_start();
+
+    return elapsed;
+    }
+
+
+// Internal function to fold response time into running average (ms x 8)
+// First value seeds the average
+
+static void dav_link_avg(unsigned int * avg, unsigned long ms)
+    {
+    if (ms > MAX_RESP_MS)
+        ms = MAX_RESP_MS;
+
+    if (*avg == 0)
+        *avg = (unsigned int) ms << AVG_SHIFT;
+    else
+        *avg = *avg - (*avg >> AVG_SHIFT) + (unsigned int) ms;
+    }
+
+
+// Internal function to get response timeout adapted from running average
+// Returns maximum if there is no average yet
+
+static unsigned int dav_link_tout(unsigned int avg, unsigned int max_ms)
+    {
+    unsigned long ms;
+
+    if (avg == 0)
+        return max_ms;
+
+    ms = (((unsigned long) avg * ADAPT_FACTOR) >> AVG_SHIFT) + ADAPT_MARGIN_MS;
+
+    if (ms < MIN_ADAPT_MS)
+        ms = MIN_ADAPT_MS;
+
+    return (ms < max_ms) ? (unsigned int) ms : max_ms;
+    }
+
+
+// Internal function to note that weather station has responded properly
+
+static void dav_link_ok(void)
+    {
+    dav_link.last_ms = getMilliSeconds();
+    dav_link.awake = 1;
+    dav_link.skipped = 0;
+    }
+
+
+// Internal function to check whether weather station is likely to be awake
+// Returns !0 if it responded recently, or 0 if not
+
+static int dav_link_awake(void)
+    {
+    return (dav_link.awake && getMilliSeconds() - dav_link.last_ms < dav_link.awake_ms);
     }
 
 
@@ -213,27 +688,38 @@ static unsigned char send_wakeup(void)
         return 0;                           // Maximum tries exceeded
 
     --dav_state.attempt_count;
-    dav_state.resp_tout = SET_TIMEOUT_UI_MS(MAX_WAKEUP_MS);
+
+    if (dav_state.attempt_count == MAX_WAKEUP_ATTEMPTS - 1)
+        dav_state.resp_tout = SET_TIMEOUT_UI_MS(dav_link_tout(dav_link.wake_avg,
+                                                              MAX_WAKEUP_MS));
+    else
+        dav_state.resp_tout = SET_TIMEOUT_UI_MS(MAX_WAKEUP_MS);
 
     report(DETAIL, "Sending wakeup char");
 
     SerialSendFlushE();
-    SerialRecvFlushE();
+    dav_rx_flush();
 
     SerialPutcE('\n');
 
+    dav_mark_start();
+
+    if (dav_state.attempt_count != MAX_WAKEUP_ATTEMPTS - 1)
+        dav_stat_bump(&dav_stats.retries[RETRY_WAKEUP]);
+
     return 1;                               // Success
     }
 
 
 // Internal function sends a command to the weather station
+// Output buffer is not flushed, so that any closing character from the
+// previous command in a batch (e.g. ACK after last archive page) still goes out
 
 static void send_command(void)
     {
     dav_state.resp_tout = SET_TIMEOUT_UI_MS(MAX_RESP_MS);
 
-    SerialSendFlushE();
-    SerialRecvFlushE();
+    dav_rx_flush();
 
     switch(dav_state.cmd_id)
         {
@@ -244,6 +730,12 @@ static void send_command(void)
                             dav_state.parm1, dav_state.parm2);
             break;
 
+        case DAV_CMD_STREAM:
+            report(DETAIL, "Sending '%s %d' command", dav_state.cmd_str,
+                            dav_state.parm1);
+            fprintf(SerialE, "%s %d", dav_state.cmd_str, dav_state.parm1);
+            break;
+
         default:
             report(DETAIL, "Sending '%s' command", dav_state.cmd_str);
             fputs(dav_state.cmd_str, SerialE);
@@ -251,109 +743,138 @@ static void send_command(void)
         }
 
     fputc('\n', SerialE);
+
+    dav_mark_start();
     }
 
 
-// Internal function to check received CRC for data against calculated CRC
-// Appears to take 41-51ms to complete
-// Returns boolean result of comparison (i.e. 0 if no match or !0 if match)
+// Internal function to prepare for receipt of a block ending in a CRC
 
-static int dav_check_data_crc(void)
+static void dav_start_rx(unsigned char * buf, unsigned int len)
     {
-    unsigned int crc_calc;
-    unsigned int crc_recv;
-
-    crc_calc = crc_calculate(&dav_data[0], DAV_DATA_LEN - 2);
+    dav_state.rx_buf = buf;
+    dav_state.rx_len = len;
+    dav_state.rx_pos = 0;
+    crc_init(&dav_state.rx_crc);
+    }
 
-    crc_recv = (unsigned int) dav_data[DAV_DATA_CRC_H] << 8;
-    crc_recv |= dav_data[DAV_DATA_CRC_L];
 
-    report(DETAIL, "Calculated CRC is %04X, Received CRC is %04X", \
-            crc_calc, crc_recv);
+// Internal function to prepare for receipt of data packet
 
-    return (crc_calc == crc_recv);
+static void dav_start_data(void)
+    {
+    dav_start_rx(dav_data, DAV_DATA_LEN);
     }
 
 
-// Show example data readings
+// Internal function to get position for next bytes of block being received
+// Flags data buffer as invalid when it is about to be overwritten
 
-static void show_example_data(void)
+static unsigned char * dav_rx_dest(void)
     {
-    unsigned int value;
+    if (dav_state.rx_pos == 0 && dav_state.rx_buf == dav_data)
+        dav_data_valid = 0;
+
+    return &dav_state.rx_buf[dav_state.rx_pos];
+    }
+
 
-    value = (unsigned int) dav_data[DAV_DATA_BAR_H] << 8;
-    value |= dav_data[DAV_DATA_BAR_L];
-    report(RAW_INFO, "Barometer: %u inHg x 1000, ", value);
+// Internal function to account for bytes added to block being received
+// Updates CRC (CRC bytes at end of block are not included in the calculation)
 
-    value = (unsigned int) dav_data[DAV_DATA_IN_TEMP_H] << 8;
-    value |= dav_data[DAV_DATA_IN_TEMP_L];
-    report(RAW_INFO, "In Temp: %u F x 10, ", value);
+static void dav_rx_accept(unsigned int count)
+    {
+    unsigned int crc_count;
 
-    value = (unsigned int) dav_data[DAV_DATA_OUT_TEMP_H] << 8;
-    value |= dav_data[DAV_DATA_OUT_TEMP_L];
-    report(RAW_INFO, "Out Temp: %u F x 10\r\n", value);
+    if (dav_state.rx_pos < dav_state.rx_len - 2)
+        {
+        crc_count = dav_state.rx_len - 2 - dav_state.rx_pos;
+        if (crc_count > count)
+            crc_count = count;
 
-    report(RAW_INFO, "Wind Speed: %u mph, ", dav_data[DAV_DATA_WIND_SPEED]);
+        crc_update(&dav_state.rx_crc, &dav_state.rx_buf[dav_state.rx_pos], crc_count);
+        }
 
-    value = (unsigned int) dav_data[DAV_DATA_WIND_DIR_H] << 8;
-    value |= dav_data[DAV_DATA_WIND_DIR_L];
-    report(RAW_INFO, "Wind Direction: %u degrees\r\n\r\n", value);
+    dav_state.rx_pos += count;
     }
 
 
-// Checks whether serial buffer contains OK response
-// Returns 0 if not, !0 if so
+// Internal function to move bytes to receive buffer
+// Takes any staged bytes first, then all bytes waiting in serial buffer
+// (up to the end of the block), updating CRC as it goes
+// Returns !0 if complete block has been received, or 0 if not
 
-static int dav_check_ok_resp(void)
+static int dav_receive(void)
     {
-    char buf[DAV_OK_LEN + 1];
+    unsigned int count;
+
+    count = dav_rx.len - dav_rx.pos;
+
+    if (count > dav_state.rx_len - dav_state.rx_pos)
+        count = dav_state.rx_len - dav_state.rx_pos;
+
+    if (count != 0)
+        {
+        memcpy(dav_rx_dest(), &dav_rx.buf[dav_rx.pos], count);
+        dav_rx.pos += count;
+        dav_rx_accept(count);
+        }
 
-    fread(buf, 1, DAV_OK_LEN, SerialE);
-    buf[DAV_OK_LEN] = '\0';
+    count = SerialRecvCountE();
 
-    return (strcmp(buf, DAV_OK_STR) == 0);
+    if (count > dav_state.rx_len - dav_state.rx_pos)
+        count = dav_state.rx_len - dav_state.rx_pos;
+
+    if (count != 0)
+        dav_rx_accept(fread(dav_rx_dest(), 1, count, SerialE));
+
+    return (dav_state.rx_pos >= dav_state.rx_len);
     }
 
 
-// Echoes responses until no chars are seen for timeout period
-// Returns 1 if characters echoed during this call (resets timeout)
-// Returns 0 if no characters echoed during this call
-// Returns -1 if timeout has occurred
+// Internal function to move bytes to data packet buffer, timing arrival of
+// first and last bytes (packets after the first in streaming mode are sent
+// at fixed intervals, so their first byte is not timed)
+// Returns !0 if complete packet has been received, or 0 if not
 
-static int dav_echo_resp(void)
+static int dav_receive_data(void)
     {
-    int ch;
+    unsigned int before;
+    int done;
 
-    ch = SerialGetcE();
+    before = dav_state.rx_pos;
 
-    if (ch != EOF)
-        {
-        dav_state.resp_tout = SET_TIMEOUT_UI_MS(MAX_ECHO_MS);
-        putchar(ch);
-        return 1;
-        }
-    else if (CHK_TIMEOUT_UI_MS(dav_state.resp_tout))
+    done = dav_receive();
+
+    if (before == 0 && dav_state.rx_pos != 0)
         {
-        report(RAW_INFO, "[End of output]\r\n");
-        return -1;
+        if (dav_state.cmd_id == DAV_CMD_STREAM &&
+            dav_state.stream_left != (unsigned int) dav_state.parm1)
+            dav_mark_start();
+        else
+            dav_mark(DAV_PHASE_FIRST_BYTE);
         }
 
-    return 0;
+    if (done)
+        dav_mark(DAV_PHASE_DATA);
+
+    return done;
     }
 
 
-// Internal function to check received CRC for time against calculated CRC
+// Internal function to check received CRC for block against calculated CRC
+// CRC is calculated by dav_receive() as block arrives
 // Returns boolean result of comparison (i.e. 0 if no match or !0 if match)
 
-static int dav_check_time_crc(void)
+static int dav_check_rx_crc(void)
     {
     unsigned int crc_calc;
     unsigned int crc_recv;
 
-    crc_calc = crc_calculate(&dav_time[0], DAV_TIME_LEN - 2);
+    crc_calc = crc_final(&dav_state.rx_crc);
 
-    crc_recv = (unsigned int) dav_time[DAV_TIME_CRC_H] << 8;
-    crc_recv |= dav_time[DAV_TIME_CRC_L];
+    crc_recv = (unsigned int) dav_state.rx_buf[dav_state.rx_len - 2] << 8;
+    crc_recv |= dav_state.rx_buf[dav_state.rx_len - 1];
 
     report(DETAIL, "Calculated CRC is %04X, Received CRC is %04X", \
             crc_calc, crc_recv);
@@ -362,13 +883,405 @@ static int dav_check_time_crc(void)
     }
 
 
-// Internal function to calculate CRC for time data and put it in buffer
+// Internal function to look up description of field in packet held in data buffer
+// Returns pointer to description, or NULL if field is not present in this packet type
 
-static void dav_calc_time_crc(void)
+static const DavField_t * dav_field_desc(unsigned char field)
     {
-    unsigned int crc_calc;
+    const DavField_t * desc;
 
-    crc_calc = crc_calculate(&dav_time[0], DAV_TIME_LEN - 2);
+    if (field >= DAV_NUM_FIELDS)
+        return NULL;
+
+    if (dav_data[DAV_DATA_TYPE] == DAV_TYPE_LOOP2)
+        desc = &dav_loop2_fields[field];
+    else
+        desc = &dav_loop_fields[field];
+
+    return (desc->offset != 0) ? desc : NULL;
+    }
+
+
+// Internal function to read raw value of field directly from data buffer
+
+static unsigned int dav_field_raw(const DavField_t * desc)
+    {
+    const unsigned char * ptr;
+
+    ptr = &dav_data[desc->offset];
+
+    if (desc->flags & FLD_WORD)
+        return ((unsigned int) ptr[1] << 8) | ptr[0];
+
+    return ptr[0];
+    }
+
+
+// Internal function to decode data buffer into sample structure
+
+static void dav_decode_sample(DavSample_t * sample)
+    {
+    sample->time_ms = getMilliSeconds();
+
+    sample->barometer = dav_field_uint(DAV_FLD_BAROMETER);
+    sample->in_temp = dav_field_int(DAV_FLD_IN_TEMP);
+    sample->out_temp = dav_field_int(DAV_FLD_OUT_TEMP);
+    sample->out_hum = (unsigned char) dav_field_uint(DAV_FLD_OUT_HUM);
+    sample->wind_speed = (unsigned char) dav_field_uint(DAV_FLD_WIND_SPEED);
+    sample->wind_dir = dav_field_uint(DAV_FLD_WIND_DIR);
+    sample->rain_rate = dav_field_uint(DAV_FLD_RAIN_RATE);
+
+    sample->valid = 0;
+
+    if (dav_field_valid(DAV_FLD_BAROMETER))
+        sample->valid |= DAV_SMP_BAROMETER;
+
+    if (dav_field_valid(DAV_FLD_IN_TEMP))
+        sample->valid |= DAV_SMP_IN_TEMP;
+
+    if (dav_field_valid(DAV_FLD_OUT_TEMP))
+        sample->valid |= DAV_SMP_OUT_TEMP;
+
+    if (dav_field_valid(DAV_FLD_OUT_HUM))
+        sample->valid |= DAV_SMP_OUT_HUM;
+
+    if (dav_field_valid(DAV_FLD_WIND_SPEED))
+        sample->valid |= DAV_SMP_WIND_SPEED;
+
+    if (dav_field_valid(DAV_FLD_WIND_DIR))
+        sample->valid |= DAV_SMP_WIND_DIR;
+    }
+
+
+// Internal function to decode data buffer into next slot of sample ring
+// Oldest unread sample is overwritten if ring is full
+
+static void dav_store_sample(void)
+    {
+    dav_decode_sample(&dav_ring.buf[dav_ring.head]);
+
+    if (++dav_ring.head >= SAMPLE_RING_LEN)
+        dav_ring.head = 0;
+
+    if (dav_ring.count < SAMPLE_RING_LEN)
+        ++dav_ring.count;
+    else
+        report(DETAIL, "Sample ring full - oldest sample overwritten");
+    }
+
+
+// Internal function to move on to next packet in streaming mode
+// Re-sends "LOOP n" command (without wakeup) after last packet of each batch,
+// while the weather station is still awake.  It cannot be re-armed any earlier,
+// as any character sent to the weather station cancels the "LOOP n" command in
+// progress (see dav_cancel_transfer), so the last packets of the batch would
+// be lost and the new command garbled.  The cost is one ACK round-trip (tens
+// of ms) in every STREAM_PACKETS packets (200 seconds at one every 2s).
+
+static void dav_next_stream_packet(void)
+    {
+    if (--dav_state.stream_left != 0)
+        {
+        dav_start_data();
+        dav_state.resp_tout = SET_TIMEOUT_UI_MS(MAX_STREAM_MS);
+        dav_state.state = DAV_AWAITING_DATA;
+        }
+    else
+        {
+        report(DETAIL, "Re-arming stream");
+        send_command();
+        dav_state.state = DAV_AWAITING_ACK;
+        }
+    }
+
+
+// Internal function to resynchronise on packet stream after a bad packet
+// Received block is searched (after its first byte) for the start of a "LOO"
+// header, and bytes from there are kept as the start of the next packet,
+// with the CRC recalculated over them, so reception continues mid-stream
+// Returns 0 if resynchronising, or -1 if too many consecutive bad packets
+
+static int dav_resync_stream(void)
+    {
+    unsigned int pos;
+    unsigned int keep;
+
+    if (++dav_state.resyncs > MAX_RESYNCS)
+        return -1;
+
+    dav_stat_bump(&dav_stats.retries[RETRY_RESYNC]);
+
+    if (--dav_state.stream_left == 0)
+        {
+        report(DETAIL, "Re-arming stream");
+        send_command();
+        dav_state.state = DAV_AWAITING_ACK;
+        return 0;
+        }
+
+    for (pos = 1; pos < DAV_DATA_LEN; ++pos)
+        {
+        keep = DAV_DATA_LEN - pos;
+        if (keep > 3)
+            keep = 3;                   // Partial header may be at end of block
+
+        if (memcmp(&dav_data[pos], "LOO", keep) == 0)
+            break;
+        }
+
+    keep = DAV_DATA_LEN - pos;
+
+    report(DETAIL, "Resynchronising stream (%u bytes kept)", keep);
+
+    memmove(dav_data, &dav_data[pos], keep);
+
+    dav_start_data();
+    dav_rx_accept(keep);
+
+    dav_state.resp_tout = SET_TIMEOUT_UI_MS(MAX_STREAM_MS);
+    dav_state.state = DAV_AWAITING_DATA;
+
+    return 0;
+    }
+
+
+// Internal function to recover from a bad or missing packet without a new wakeup
+// Streaming resynchronises on the next packet, whilst a single packet is
+// requested again (as the weather station is still awake)
+// Returns 0 if recovering, or -1 if not possible
+
+static int dav_recover_data(void)
+    {
+    if (dav_state.cmd_id == DAV_CMD_STREAM)
+        {
+        if (dav_state.condition == DAV_NO_DATA)
+            return -1;
+
+        return dav_resync_stream();
+        }
+
+    if (dav_state.cmd_id != DAV_CMD_COLLECT || dav_state.data_retries == 0)
+        return -1;
+
+    --dav_state.data_retries;
+    dav_stat_bump(&dav_stats.retries[RETRY_PACKET]);
+
+    report(DETAIL, "Requesting packet again");
+    send_command();
+    dav_state.state = DAV_AWAITING_ACK;
+
+    return 0;
+    }
+
+
+// Internal function to stop weather station sending packets in streaming mode
+// (any character sent to the weather station cancels the "LOOP n" command)
+// or sending pages of an archive download (cancelled by ESC character)
+
+static void dav_cancel_transfer(void)
+    {
+    if (dav_state.state == DAV_IDLE)
+        return;
+
+    if (dav_state.cmd_id == DAV_CMD_STREAM)
+        {
+        report(DETAIL, "Cancelling stream");
+        SerialPutcE('\n');
+        }
+    else if (dav_state.cmd_id == DAV_CMD_DUMP_STAMP)
+        {
+        report(DETAIL, "Cancelling archive download");
+        SerialPutcE(DAV_ESC);
+        }
+    }
+
+
+// Internal function to fetch 16-bit value (LSB first) from buffer
+
+static unsigned int dav_get_word(const unsigned char * ptr)
+    {
+    return ((unsigned int) ptr[1] << 8) | ptr[0];
+    }
+
+
+// Internal function to send date and time stamp for archive download
+// followed by its CRC (MSB first)
+
+static void dav_send_arch_stamp(void)
+    {
+    unsigned char stamp[6];
+    unsigned int crc_calc;
+
+    stamp[0] = (dav_state.arch_date & 0xFF);
+    stamp[1] = ((dav_state.arch_date >> 8) & 0xFF);
+    stamp[2] = (dav_state.arch_time & 0xFF);
+    stamp[3] = ((dav_state.arch_time >> 8) & 0xFF);
+
+    crc_calc = crc_calculate(stamp, 4);
+
+    stamp[4] = ((crc_calc >> 8) & 0xFF);
+    stamp[5] = (crc_calc & 0xFF);
+
+    report(DETAIL, "Sending archive stamp (date %04X, time %04X)",
+                    dav_state.arch_date, dav_state.arch_time);
+
+    fwrite(stamp, 1, sizeof(stamp), SerialE);
+    }
+
+
+// Internal function to request next (or repeated) archive page
+// Sends ACK for next page or NAK for repeat of current page
+
+static void dav_request_page(char resp)
+    {
+    SerialPutcE(resp);
+
+    dav_start_rx(dav_page, DAV_PAGE_LEN);
+    dav_state.resp_tout = SET_TIMEOUT_UI_MS(MAX_DATA_MS);
+    dav_state.state = DAV_AWAITING_PAGE;
+    }
+
+
+// Internal function to check whether archive record was written after
+// the date and time stamp given for the download
+// Returns !0 if record is wanted or 0 if not (unused or too old)
+
+static int dav_check_arch_rec(const unsigned char * rec)
+    {
+    unsigned int rec_date;
+    unsigned int rec_time;
+
+    rec_date = dav_get_word(&rec[DAV_ARCH_REC_DATE]);
+    rec_time = dav_get_word(&rec[DAV_ARCH_REC_TIME]);
+
+    if (rec_date == 0xFFFF || rec_date == 0)
+        return 0;                           // Unused record
+
+    if (rec_date != dav_state.arch_date)
+        return (rec_date > dav_state.arch_date);
+
+    return (rec_time > dav_state.arch_time);
+    }
+
+
+// Show value of field converted to stated units
+
+static void show_field_value(unsigned char field)
+    {
+    const DavField_t * desc;
+    long value;
+
+    desc = dav_field_desc(field);
+
+    if (desc->flags & FLD_SIGNED)
+        value = dav_field_int(field);
+    else
+        value = dav_field_uint(field);
+
+    if (value < 0)
+        {
+        report(RAW_INFO, "-");
+        value = -value;
+        }
+
+    report(RAW_INFO, "%lu", value / desc->scale);
+
+    switch (desc->scale)
+        {
+        case 10:
+            report(RAW_INFO, ".%01lu", value % 10);
+            break;
+
+        case 100:
+            report(RAW_INFO, ".%02lu", value % 100);
+            break;
+
+        case 1000:
+            report(RAW_INFO, ".%03lu", value % 1000);
+            break;
+        }
+    }
+
+
+// Show example data readings
+// All fields with valid readings in the current packet type are shown
+
+#define SHOW_COLS   3
+
+static void show_example_data(void)
+    {
+    unsigned char field;
+    unsigned char col;
+
+    report(RAW_INFO, "%s packet:\r\n",
+            (dav_data[DAV_DATA_TYPE] == DAV_TYPE_LOOP2) ? "LOOP2" : "LOOP");
+
+    for (field = 0, col = 0; field < DAV_NUM_FIELDS; ++field)
+        {
+        if (!dav_field_valid(field))
+            continue;
+
+        if (col != 0)
+            report(RAW_INFO, ", ");
+
+        report(RAW_INFO, "%s: ", dav_field_names[field]);
+        show_field_value(field);
+        report(RAW_INFO, " %s", dav_field_units[field]);
+
+        if (++col >= SHOW_COLS)
+            {
+            report(RAW_INFO, "\r\n");
+            col = 0;
+            }
+        }
+
+    if (col != 0)
+        report(RAW_INFO, "\r\n");
+
+    report(RAW_INFO, "\r\n");
+    }
+
+
+// Echoes responses until no chars are seen for timeout period
+// Returns 1 if characters echoed during this call (resets timeout)
+// Returns 0 if no characters echoed during this call
+// Returns -1 if timeout has occurred
+
+static int dav_echo_resp(void)
+    {
+    int ch;
+    int echoed;
+
+    echoed = 0;
+
+    while ((ch = dav_rx_getc()) != EOF)
+        {
+        putchar(ch);
+        echoed = 1;
+        }
+
+    if (echoed)
+        {
+        dav_state.resp_tout = SET_TIMEOUT_UI_MS(MAX_ECHO_MS);
+        return 1;
+        }
+    else if (CHK_TIMEOUT_UI_MS(dav_state.resp_tout))
+        {
+        report(RAW_INFO, "[End of output]\r\n");
+        return -1;
+        }
+
+    return 0;
+    }
+
+
+// Internal function to calculate CRC for time data and put it in buffer
+
+static void dav_calc_time_crc(void)
+    {
+    unsigned int crc_calc;
+
+    crc_calc = crc_calculate(&dav_time[0], DAV_TIME_LEN - 2);
 
     dav_time[DAV_TIME_CRC_H] = ((crc_calc >> 8) & 0xFF);
     dav_time[DAV_TIME_CRC_L] = (crc_calc & 0xFF);
@@ -484,6 +1397,13 @@ int dav_init_all(void)
 
     memset(dav_time, 0, sizeof(dav_time));          // Clear time buffer
 
+    memset(&dav_ring, 0, sizeof(dav_ring));         // Empty sample ring
+
+    dav_clear_stats();
+
+    memset(&dav_link, 0, sizeof(dav_link));         // Wake up fully at first
+    dav_link.awake_ms = AWAKE_MS;
+
     return 0;
     }
 
@@ -492,42 +1412,272 @@ int dav_init_all(void)
 
 void dav_start_collect(void)
     {
-    dav_start(DAV_CMD_COLLECT, "LOOP 1");
+    dav_start(DAV_CMD_COLLECT, "LOOP 1", 0, 0);
+    }
+
+
+// Starts data collection state machine for a single LOOP2 packet
+
+void dav_start_collect_loop2(void)
+    {
+    dav_start(DAV_CMD_COLLECT, "LPS 2 1", 0, 0);
+    }
+
+
+// Starts setting barometer and elevation values
+
+void dav_start_set_bar(int barometer, int elevation)
+    {
+    dav_start(DAV_CMD_SET_BAR, "BAR", barometer, elevation);
+    }
+
+
+// Starts a command which returns text responses
+
+void dav_start_echo_resp(char * cmd)
+    {
+    dav_start(DAV_CMD_ECHO_RESP, cmd, 0, 0);
+    }
+
+
+// Starts a command which checks weather station clock
+
+void dav_start_check_time(void)
+    {
+    dav_start(DAV_CMD_CHK_TIME, "GETTIME", 0, 0);
+    }
+
+
+// Starts a command which checks weather station clock
+
+void dav_start_set_time(void)
+    {
+    dav_start(DAV_CMD_SET_TIME, "SETTIME", 0, 0);
+    }
+
+
+// Starts continuous collection of packets in streaming mode
+// Each packet received is decoded into the sample ring (see dav_read_sample)
+// Remains pending until aborted or an error occurs (so must be last in a batch)
+// N.B. Used by the menu's live readings display only -- tasks.c samples with a
+// single LOOP packet every 10 seconds, so that the serial port stays free for
+// collections, clock checks and archive downloads between samples
+
+void dav_start_stream(void)
+    {
+    dav_start(DAV_CMD_STREAM, "LOOP", STREAM_PACKETS, 0);
+    }
+
+
+// Takes oldest unread sample from sample ring (filled in streaming mode)
+// Returns 1 if sample has been copied to structure, or 0 if ring is empty
+
+int dav_read_sample(DavSample_t * sample)
+    {
+    unsigned char tail;
+
+    if (dav_ring.count == 0)
+        return 0;
+
+    if (dav_ring.head >= dav_ring.count)
+        tail = dav_ring.head - dav_ring.count;
+    else
+        tail = dav_ring.head + SAMPLE_RING_LEN - dav_ring.count;
+
+    *sample = dav_ring.buf[tail];
+    --dav_ring.count;
+
+    return 1;
+    }
+
+
+// Decodes packet held in data buffer (e.g. after LOOP collection) into sample
+// Returns 1 if sample has been filled in, or 0 if no valid packet is held
+
+int dav_get_sample(DavSample_t * sample)
+    {
+    if (!dav_data_valid)
+        return 0;
+
+    dav_decode_sample(sample);
+    return 1;
+    }
+
+
+// Starts download of archive records written after the given time
+// (weather station clock is assumed to be set to UTC, as by dav_start_set_time)
+// Each record is delivered in turn by dav_next_archive_rec()
+
+void dav_start_dump_after(time_t after)
+    {
+    struct tm * after_ptr;
+    unsigned int date_stamp;
+    unsigned int time_stamp;
+
+    after_ptr = gmtime(&after);
+
+    date_stamp = after_ptr->tm_mday + ((after_ptr->tm_mon + 1) * 32) +
+                 ((after_ptr->tm_year - 100) * 512);
+    time_stamp = (after_ptr->tm_hour * 100) + after_ptr->tm_min;
+
+    dav_start(DAV_CMD_DUMP_AFTER, "DMPAFT", (int) date_stamp, (int) time_stamp);
+    }
+
+
+// Gets next record from archive page that has just been received
+// Pointer remains valid until next call to dav_tick()
+// Returns pointer to DAV_ARCH_REC_LEN bytes, or NULL if no record is waiting
+
+const unsigned char * dav_next_archive_rec(void)
+    {
+    const unsigned char * rec;
+
+    if (dav_state.state != DAV_DELIVERING_PAGE)
+        return NULL;
+
+    while (dav_state.page_rec < DAV_PAGE_RECS)
+        {
+        rec = &dav_page[DAV_PAGE_FIRST_REC + (dav_state.page_rec * DAV_ARCH_REC_LEN)];
+        ++dav_state.page_rec;
+
+        if (dav_check_arch_rec(rec))
+            return rec;
+        }
+
+    return NULL;
+    }
+
+
+// Checks whether field is present in packet held in data buffer and
+// its sensor is connected (i.e. its value is not "dashed")
+// Returns !0 if field has a valid reading, or 0 if not
+
+int dav_field_valid(unsigned char field)
+    {
+    const DavField_t * desc;
+    unsigned int value;
+
+    desc = dav_field_desc(field);
+
+    if (desc == NULL)
+        return 0;
+
+    value = dav_field_raw(desc);
+
+    if (value == 0 && (desc->flags & FLD_ZERO_NONE))
+        return 0;
+
+    return (value != desc->sentinel);
+    }
+
+
+// Reads unsigned field directly from packet held in data buffer
+// Returns raw value (or 0 if field is not present in this packet type)
+
+unsigned int dav_field_uint(unsigned char field)
+    {
+    const DavField_t * desc;
+
+    desc = dav_field_desc(field);
+
+    return (desc != NULL) ? dav_field_raw(desc) : 0;
+    }
+
+
+// Reads signed field directly from packet held in data buffer
+// Returns raw value (or 0 if field is not present in this packet type)
+
+int dav_field_int(unsigned char field)
+    {
+    const DavField_t * desc;
+    unsigned int value;
+
+    desc = dav_field_desc(field);
+
+    if (desc == NULL)
+        return 0;
+
+    value = dav_field_raw(desc);
+
+    if (!(desc->flags & FLD_WORD) && (value & 0x80))
+        value |= 0xFF00;                            // Extend sign of byte value
+
+    return (int) value;
+    }
+
+
+// Gets divisor to convert raw value of field to units shown by dav_dump_data()
+// (e.g. 1000 for barometer in inches Hg) for packet held in data buffer
+// Returns divisor, or 1 if field is not present in this packet type
+
+unsigned int dav_field_scale(unsigned char field)
+    {
+    const DavField_t * desc;
+
+    desc = dav_field_desc(field);
+
+    return (desc != NULL) ? desc->scale : 1;
+    }
+
+
+// Starts building a batch of commands to run under a single wakeup
+// Subsequent calls to dav_start_xxx() functions add commands to the batch
+// (up to DAV_MAX_BATCH) until dav_run_batch() is called
+
+void dav_begin_batch(void)
+    {
+    dav_batch.building = 1;
+    dav_batch.count = 0;
     }
 
 
-// Starts setting barometer and elevation values
+// Starts processing of batch of commands by command state machine
+// Commands run in order until one fails, after which the rest are not started
+// Performs clean-up on serial port state
 
-void dav_start_set_bar(int barometer, int elevation)
+void dav_run_batch(void)
     {
-    dav_start(DAV_CMD_SET_BAR, "BAR");
+    dav_batch.building = 0;
 
-    dav_state.parm1 = barometer;
-    dav_state.parm2 = elevation;
-    }
+    if (dav_batch.count == 0)
+        {
+        report(PROBLEM, "No commands in batch");
+        return;
+        }
 
+    report(DETAIL, "Starting");
 
-// Starts a command which returns text responses
+    dav_cleanup();
 
-void dav_start_echo_resp(char * cmd)
-    {
-    dav_start(DAV_CMD_ECHO_RESP, cmd);
+    wx_set_leds(LED_DAVIS, LED_AMBER);
+
+    dav_state.state = DAV_STARTING;
+    dav_state.condition = DAV_PENDING;
+
+    dav_batch.current = 0;
+    dav_load_cmd();
+
+    RESET_TIMEOUT();
     }
 
 
-// Starts a command which checks weather station clock
+// Gets number of commands in current (or last) batch
 
-void dav_start_check_time(void)
+unsigned char dav_get_batch_count(void)
     {
-    dav_start(DAV_CMD_CHK_TIME, "GETTIME");
+    return dav_batch.count;
     }
 
 
-// Starts a command which checks weather station clock
+// Gets completion status of command in current (or last) batch (see header file)
+// DAV_NOT_STARTED is returned for commands not reached (or index out of range)
 
-void dav_start_set_time(void)
+int dav_get_cmd_status(unsigned char index)
     {
-    dav_start(DAV_CMD_SET_TIME, "SETTIME");
+    if (index >= dav_batch.count)
+        return DAV_NOT_STARTED;
+
+    return dav_batch.cmd[index].status;
     }
 
 
@@ -538,7 +1688,11 @@ void dav_abort(void)
     {
     report(DETAIL, "Aborting");
 
+    if (dav_state.state != DAV_IDLE)
+        dav_batch.cmd[dav_batch.current].status = DAV_ABORTED;
+
     dav_cleanup();
+    dav_cancel_transfer();
 
     wx_set_leds(LED_DAVIS, LED_RED);
 
@@ -558,6 +1712,100 @@ int dav_get_status(void)
     }
 
 
+// Show timing statistics on console as a table of histogram bucket counts
+// for each phase, followed by retry and failure counts
+
+void dav_show_stats(void)
+    {
+    unsigned char phase;
+    unsigned char bucket;
+    unsigned char i;
+
+    report(RAW_INFO, "\r\nPhase        ");
+
+    for (bucket = 0; bucket < DAV_STAT_BUCKETS - 1; ++bucket)
+        {
+        if (dav_stat_bounds[bucket] < 1000)
+            report(RAW_INFO, "  <%3u", dav_stat_bounds[bucket]);
+        else
+            report(RAW_INFO, "  <%2us", dav_stat_bounds[bucket] / 1000);
+        }
+
+    report(RAW_INFO, "  more\r\n");
+
+    for (phase = 0; phase < DAV_NUM_PHASES; ++phase)
+        {
+        report(RAW_INFO, "%-12s ", dav_phase_names[phase]);
+
+        for (bucket = 0; bucket < DAV_STAT_BUCKETS; ++bucket)
+            report(RAW_INFO, " %5u", dav_stats.hist[phase][bucket]);
+
+        report(RAW_INFO, "\r\n");
+        }
+
+    report(RAW_INFO, "\r\nRetries: wakeup %u, packet %u, resync %u, lost ACK %u\r\n",
+                      dav_stats.retries[RETRY_WAKEUP], dav_stats.retries[RETRY_PACKET],
+                      dav_stats.retries[RETRY_RESYNC], dav_stats.retries[RETRY_LOST_ACK]);
+
+    report(RAW_INFO, "Wakeups skipped %u (fell back %u), assumed awake %lu ms\r\n",
+                      dav_stats.retries[RETRY_SKIPPED], dav_stats.retries[RETRY_FALLBACK],
+                      dav_link.awake_ms);
+
+    report(RAW_INFO, "Average wakeup %u ms, average response %u ms\r\n",
+                      dav_link.wake_avg >> AVG_SHIFT, dav_link.resp_avg >> AVG_SHIFT);
+
+    report(RAW_INFO, "Failures:");
+
+    for (i = 0; i < DAV_NUM_FAIL_CODES; ++i)
+        {
+        if (dav_stats.failures[i] != 0)
+            report(RAW_INFO, " %d x%u", -(i + 1), dav_stats.failures[i]);
+        }
+
+    report(RAW_INFO, "\r\n\r\n");
+    }
+
+
+// Clears timing statistics
+
+void dav_clear_stats(void)
+    {
+    memset(&dav_stats, 0, sizeof(dav_stats));
+    }
+
+
+// Packs timing statistics into buffer of DAV_STATS_LEN bytes (see header file)
+// Returns number of bytes packed
+
+unsigned int dav_pack_stats(unsigned char * buf)
+    {
+    const unsigned int * count;
+    unsigned int i;
+
+    count = &dav_stats.hist[0][0];
+
+    for (i = 0; i < DAV_NUM_PHASES * DAV_STAT_BUCKETS; ++i, ++count)
+        {
+        *buf++ = (unsigned char) *count;
+        *buf++ = (unsigned char) (*count >> 8);
+        }
+
+    for (i = 0; i < DAV_NUM_RETRY_TYPES; ++i)
+        {
+        *buf++ = (unsigned char) dav_stats.retries[i];
+        *buf++ = (unsigned char) (dav_stats.retries[i] >> 8);
+        }
+
+    for (i = 0; i < DAV_NUM_FAIL_CODES; ++i)
+        {
+        *buf++ = (unsigned char) dav_stats.failures[i];
+        *buf++ = (unsigned char) (dav_stats.failures[i] >> 8);
+        }
+
+    return DAV_STATS_LEN;
+    }
+
+
 // Dump data to console
 
 #define DUMP_COLS   20
@@ -612,6 +1860,33 @@ static void set_post_cmd_state(void)
     }
 
 
+// Internal function to record completion status of current command in batch
+// and send the next command (without wakeup, as weather station is now awake)
+// Returns !0 if next command has been sent, or 0 if batch is complete
+
+static int dav_next_batch_cmd(void)
+    {
+    dav_batch.cmd[dav_batch.current].status = dav_state.condition;
+
+    if (dav_batch.current + 1 >= dav_batch.count)
+        return 0;
+
+    ++dav_batch.current;
+    dav_load_cmd();
+
+    report(DETAIL, "Continuing with command %u of %u in batch",
+                    dav_batch.current + 1, dav_batch.count);
+
+    send_command();
+    set_post_cmd_state();
+
+    dav_state.condition = DAV_PENDING;
+    RESET_TIMEOUT();
+
+    return 1;
+    }
+
+
 // Determines which state to enter after an ACK is received
 // Returns DAV_PENDING if command has completed or DAV_PENDING if not
 
@@ -619,12 +1894,18 @@ static int set_post_ack_state(void)
     {
     switch(dav_state.cmd_id)
         {
+        case DAV_CMD_STREAM:
+            dav_state.stream_left = dav_state.parm1;
+            // Fall through
+
         case DAV_CMD_COLLECT:
+            dav_start_data();
             dav_state.resp_tout = SET_TIMEOUT_UI_MS(MAX_DATA_MS);
             dav_state.state = DAV_AWAITING_DATA;
             break;
 
         case DAV_CMD_CHK_TIME:
+            dav_start_rx(dav_time, DAV_TIME_LEN);
             dav_state.resp_tout = SET_TIMEOUT_UI_MS(MAX_TIME_MS);
             dav_state.state = DAV_AWAITING_TIME;
             break;
@@ -636,6 +1917,21 @@ static int set_post_ack_state(void)
             dav_state.state = DAV_AWAITING_ACK;
             break;
 
+        case DAV_CMD_DUMP_AFTER:
+            dav_state.arch_date = (unsigned int) dav_state.parm1;
+            dav_state.arch_time = (unsigned int) dav_state.parm2;
+            dav_send_arch_stamp();
+            dav_state.cmd_id = DAV_CMD_DUMP_STAMP;
+            dav_state.resp_tout = SET_TIMEOUT_UI_MS(MAX_RESP_MS);
+            dav_state.state = DAV_AWAITING_ACK;
+            break;
+
+        case DAV_CMD_DUMP_STAMP:
+            dav_start_rx(dav_page, DAV_ARCH_HDR_LEN);
+            dav_state.resp_tout = SET_TIMEOUT_UI_MS(MAX_RESP_MS);
+            dav_state.state = DAV_AWAITING_ARCH_HDR;
+            break;
+
         default:
             return DAV_SUCCESS;     // Commands that just return ACK
         }
@@ -665,15 +1961,69 @@ static int set_post_ok_state(void)
     }
 
 
+// Internal function to fall back to a full wakeup when a command sent without
+// one (weather station assumed awake) gets no proper response
+// Returns 1 if wakeup has been started, or 0 if a wakeup was not skipped
+
+static int dav_wakeup_fallback(void)
+    {
+    if (!dav_link.skipped)
+        return 0;
+
+    dav_link.skipped = 0;
+    dav_link.awake = 0;
+    dav_link.resp_avg = 0;                  // Response time may have changed
+
+    dav_link.awake_ms = (dav_stats.start_ms - dav_link.last_ms) / 2;
+    if (dav_link.awake_ms < MIN_AWAKE_MS)
+        dav_link.awake_ms = MIN_AWAKE_MS;
+
+    dav_stat_bump(&dav_stats.retries[RETRY_FALLBACK]);
+
+    report(DETAIL, "No proper response - waking up weather station");
+
+    dav_state.attempt_count = MAX_WAKEUP_ATTEMPTS;
+    (void) send_wakeup();
+    dav_state.state = DAV_AWAITING_WAKEUP;
+
+    return 1;
+    }
+
+
+// Internal function to continue when a data packet starts without an ACK
+// (the ACK character itself having been lost on the serial line)
+// First byte of packet has already been read, so is put back in the block
+// Returns 1 if data reception started, or 0 if no packet was expected
+
+static int dav_lost_ack(void)
+    {
+    if (dav_state.cmd_id != DAV_CMD_COLLECT && dav_state.cmd_id != DAV_CMD_STREAM)
+        return 0;
+
+    set_post_ack_state();
+
+    *dav_rx_dest() = 'L';                       // (marks old data invalid)
+    dav_rx_accept(1);
+
+    dav_stat_bump(&dav_stats.retries[RETRY_LOST_ACK]);
+    dav_mark_start();
+
+    return 1;
+    }
+
+
 // Main "tick" routine which drives data collection state machine
 // Return value indicates current status (see header file)
 // 0 means activity pending, < 0 means failure, > 0 means success
 
 int dav_tick(void)
     {
+    int ch;
+
     if (dav_state.state == DAV_IDLE)            // Not active?
         {
-        dav_cleanup();                          // Clean out serial port
+        (void) SerialErrorE();                  // Clean out serial port
+        dav_rx_flush();                         // (leaving any output to drain)
         return dav_state.condition;             // -- EXIT --
         }
 
@@ -701,21 +2051,51 @@ int dav_tick(void)
         {
         // Attempt to wake up weather station
         case DAV_STARTING:
-            dav_state.attempt_count = MAX_WAKEUP_ATTEMPTS;
-            (void) send_wakeup();
-            dav_state.state = DAV_AWAITING_LF;
+            dav_stats.start_ms = getMilliSeconds();
+            if (dav_link_awake())
+                {
+                report(DETAIL, "Weather station assumed awake - skipping wakeup");
+                dav_stat_bump(&dav_stats.retries[RETRY_SKIPPED]);
+                dav_link.skipped = 1;
+                dav_state.attempt_count = MAX_WAKEUP_ATTEMPTS;
+                send_command();
+                dav_state.resp_tout = SET_TIMEOUT_UI_MS(dav_link_tout(dav_link.resp_avg,
+                                                                      MAX_RESP_MS));
+                set_post_cmd_state();
+                }
+            else
+                {
+                dav_state.attempt_count = MAX_WAKEUP_ATTEMPTS;
+                (void) send_wakeup();
+                dav_state.state = DAV_AWAITING_WAKEUP;
+                }
             RESET_TIMEOUT();
             break;
 
-        // Wait for first character of wakeup response
-        case DAV_AWAITING_LF:
-            if (SerialGetcE() == '\n')
+        // Wait for wakeup response (skipping anything received before it)
+        case DAV_AWAITING_WAKEUP:
+            if (dav_match_token(DAV_WAKEUP_STR, DAV_WAKEUP_LEN, 0) > 0)
                 {
-                dav_state.state = DAV_AWAITING_CR;
-                // No report message or global timeout reset
+                report(DETAIL, "Wakeup response received");
+                dav_link_avg(&dav_link.wake_avg, dav_mark(DAV_PHASE_WAKEUP));
+                dav_link_ok();
+                send_command();
+                set_post_cmd_state();
+                RESET_TIMEOUT();
                 }
             else if (CHK_TIMEOUT_UI_MS(dav_state.resp_tout))
                 {
+                if (dav_rx.skipped && dav_state.attempt_count == 0)
+                    {
+                    dav_error_str ="Bad wakeup response received";
+                    report(PROBLEM, dav_error_str);
+                    dav_state.condition = DAV_BAD_WAKEUP;
+                    goto dav_error;
+                    }
+
+                if (dav_state.attempt_count == MAX_WAKEUP_ATTEMPTS - 1)
+                    dav_link.wake_avg = 0;      // Adapted timeout was too short
+
                 if (!send_wakeup())
                     {
                     dav_error_str = "No wakeup response received";
@@ -723,50 +2103,18 @@ int dav_tick(void)
                     dav_state.condition = DAV_NO_WAKEUP;
                     goto dav_error;
                     }
-                }
-            break;
-
-        // Wait for second character of wakeup response
-        case DAV_AWAITING_CR:
-            switch(SerialGetcE())
-                {
-                case '\r':
-                    report(DETAIL, "Wakeup response received");
-                    send_command();
-                    set_post_cmd_state();
-                    RESET_TIMEOUT();
-                    break;
-
-                case '\n':
-                case EOF:
-                    if (!CHK_TIMEOUT_UI_MS(dav_state.resp_tout))
-                        break;
-
-                    // Fall through to default if timed out
-
-                default:
-                    if (send_wakeup())
-                        {
-                        dav_state.state = DAV_AWAITING_LF;
-                        // No report message or global timeout reset
-                        }
-                    else
-                        {
-                        dav_error_str ="Bad wakeup response received";
-                        report(PROBLEM, dav_error_str);
-                        dav_state.condition = DAV_BAD_WAKEUP;
-                        goto dav_error;
-                        }
-                    break;
+                // No report message or global timeout reset
                 }
             break;
 
         // Wait for acknowledge response
         case DAV_AWAITING_ACK:
-            switch(SerialGetcE())
+            switch(ch = dav_rx_getc())
                 {
                 case DAV_ACK:
                     report(DETAIL, "Acknowledgement received");
+                    dav_link_avg(&dav_link.resp_avg, dav_mark(DAV_PHASE_ACK));
+                    dav_link_ok();
                     if (set_post_ack_state() == DAV_SUCCESS)
                         goto dav_successful;
                     RESET_TIMEOUT();
@@ -775,6 +2123,12 @@ int dav_tick(void)
                 case EOF:
                     if (CHK_TIMEOUT_UI_MS(dav_state.resp_tout))
                         {
+                        if (dav_wakeup_fallback())
+                            {
+                            RESET_TIMEOUT();
+                            break;
+                            }
+
                         dav_error_str = "No acknowledgement received";
                         report(PROBLEM, dav_error_str);
                         dav_state.condition = DAV_NO_ACK;
@@ -783,12 +2137,36 @@ int dav_tick(void)
                     break;
 
                 case DAV_NAK:
+                case DAV_CAN:
+                    if (dav_wakeup_fallback())      // Command may have been garbled
+                        {
+                        RESET_TIMEOUT();
+                        break;
+                        }
+
                     dav_error_str = "Negative acknowledgement received";
                     report(PROBLEM, dav_error_str);
                     dav_state.condition = DAV_NEG_ACK;
                     goto dav_error;
 
                 default:
+                    if ((ch == '\n' || ch == '\r') &&
+                        dav_state.attempt_count < MAX_WAKEUP_ATTEMPTS - 1)
+                        break;                  // Late response to earlier wakeup
+
+                    if (ch == 'L' && dav_lost_ack())
+                        {
+                        report(PROBLEM, "Acknowledgement lost before data");
+                        RESET_TIMEOUT();
+                        break;
+                        }
+
+                    if (dav_wakeup_fallback())
+                        {
+                        RESET_TIMEOUT();
+                        break;
+                        }
+
                     dav_error_str = "Bad acknowledgement received";
                     report(PROBLEM, dav_error_str);
                     dav_state.condition = DAV_BAD_ACK;
@@ -798,11 +2176,8 @@ int dav_tick(void)
 
         // Wait for data packet of required length
         case DAV_AWAITING_DATA:
-            if (SerialRecvCountE() >= DAV_DATA_LEN)
+            if (dav_receive_data())
                 {
-                dav_data_valid = 0;
-                fread(dav_data, 1, DAV_DATA_LEN, SerialE);
-
                 report(DETAIL, "Data received");
                 dav_state.state = DAV_CHECKING_DATA;
                 RESET_TIMEOUT();
@@ -810,9 +2185,8 @@ int dav_tick(void)
             else if (CHK_TIMEOUT_UI_MS(dav_state.resp_tout))
                 {
                 dav_error_str = "No data received";
-                report(PROBLEM, dav_error_str);
                 dav_state.condition = DAV_NO_DATA;
-                goto dav_error;
+                goto dav_bad_data;
                 }
             break;
 
@@ -821,56 +2195,80 @@ int dav_tick(void)
             if (strncmp(&dav_data[DAV_DATA_LOO], "LOO", 3) != 0)
                 {
                 dav_error_str = "Data does not start with 'LOO'";
-                report(PROBLEM, dav_error_str);
                 dav_state.condition = DAV_BAD_DATA;
-                goto dav_error;
+                goto dav_bad_data;
                 }
 
             if (dav_data[DAV_DATA_LF] != '\n' || dav_data[DAV_DATA_CR] != '\r')
                 {
                 dav_error_str = "Data does not contain LF, CR";
-                report(PROBLEM, dav_error_str);
                 dav_state.condition = DAV_BAD_DATA;
-                goto dav_error;
+                goto dav_bad_data;
                 }
 
-            if (!dav_check_data_crc())
+            if (!dav_check_rx_crc())
                 {
                 dav_error_str = "Data failed CRC check";
-                report(PROBLEM, dav_error_str);
                 dav_state.condition = DAV_BAD_CRC;
-                goto dav_error;
+                goto dav_bad_data;
                 }
 
             report(DETAIL, "Data is valid");
             dav_data_valid = 1;
+            dav_mark(DAV_PHASE_CHECK);
+
+            dav_link_ok();
+
+            if (dav_state.cmd_id == DAV_CMD_STREAM)
+                {
+                dav_state.resyncs = 0;
+                dav_store_sample();
+                dav_next_stream_packet();
+                RESET_TIMEOUT();
+                break;
+                }
+
             goto dav_successful;
 
         // Wait for OK response
         case DAV_AWAITING_OK:
-            if (SerialRecvCountE() >= DAV_OK_LEN)
+            switch(dav_match_token(DAV_OK_STR, DAV_OK_LEN, 1))
                 {
-                if (dav_check_ok_resp())
-                    {
+                case 1:
                     report(DETAIL, "OK response received");
+                    dav_link_ok();
                     if (set_post_ok_state() == DAV_SUCCESS)
                         goto dav_successful;
                     RESET_TIMEOUT();
-                    }
-                else
-                    {
+                    break;
+
+                case -1:
+                    if (dav_wakeup_fallback())
+                        {
+                        RESET_TIMEOUT();
+                        break;
+                        }
+
                     dav_error_str = "Bad acknowledgement received";
                     report(PROBLEM, dav_error_str);
                     dav_state.condition = DAV_BAD_ACK;
                     goto dav_error;
-                    }
-                }
-            else if (CHK_TIMEOUT_UI_MS(dav_state.resp_tout))
-                {
-                dav_error_str = "No acknowledgement received";
-                report(PROBLEM, dav_error_str);
-                dav_state.condition = DAV_NO_ACK;
-                goto dav_error;
+
+                default:
+                    if (CHK_TIMEOUT_UI_MS(dav_state.resp_tout))
+                        {
+                        if (dav_wakeup_fallback())
+                            {
+                            RESET_TIMEOUT();
+                            break;
+                            }
+
+                        dav_error_str = "No acknowledgement received";
+                        report(PROBLEM, dav_error_str);
+                        dav_state.condition = DAV_NO_ACK;
+                        goto dav_error;
+                        }
+                    break;
                 }
             break;
 
@@ -882,12 +2280,11 @@ int dav_tick(void)
 
         // Wait for time packet of required length
         case DAV_AWAITING_TIME:
-            if (SerialRecvCountE() >= DAV_TIME_LEN)
+            if (dav_receive())
                 {
-                fread(dav_time, 1, DAV_TIME_LEN, SerialE);
                 report(DETAIL, "Time received");
                 dav_dump_time();
-                if (!dav_check_time_crc())
+                if (!dav_check_rx_crc())
                     {
                     dav_error_str = "Time failed CRC check";
                     report(PROBLEM, dav_error_str);
@@ -913,6 +2310,91 @@ int dav_tick(void)
                 }
             break;
 
+        // Wait for header response giving number of archive pages to come
+        case DAV_AWAITING_ARCH_HDR:
+            if (dav_receive())
+                {
+                if (!dav_check_rx_crc())
+                    {
+                    dav_error_str = "Archive header failed CRC check";
+                    report(PROBLEM, dav_error_str);
+                    dav_state.condition = DAV_BAD_CRC;
+                    goto dav_error;
+                    }
+
+                dav_state.pages_left = dav_get_word(&dav_page[DAV_ARCH_HDR_PAGES]);
+                dav_state.page_rec = dav_get_word(&dav_page[DAV_ARCH_HDR_START]);
+
+                report(DETAIL, "Archive has %u pages to send (first record %u)",
+                                dav_state.pages_left, dav_state.page_rec);
+
+                if (dav_state.pages_left == 0)
+                    {
+                    SerialPutcE(DAV_ESC);           // Nothing to download
+                    goto dav_successful;
+                    }
+
+                dav_state.page_retries = MAX_PAGE_ATTEMPTS;
+                dav_request_page(DAV_ACK);
+                RESET_TIMEOUT();
+                }
+            else if (CHK_TIMEOUT_UI_MS(dav_state.resp_tout))
+                {
+                dav_error_str = "No archive header received";
+                report(PROBLEM, dav_error_str);
+                dav_state.condition = DAV_NO_DATA;
+                goto dav_error;
+                }
+            break;
+
+        // Wait for archive page
+        case DAV_AWAITING_PAGE:
+            if (dav_receive())
+                {
+                if (dav_check_rx_crc())
+                    {
+                    report(DETAIL, "Archive page %u received", dav_page[0]);
+                    --dav_state.pages_left;
+                    dav_state.page_retries = MAX_PAGE_ATTEMPTS;
+                    dav_state.state = DAV_DELIVERING_PAGE;
+                    // Records before page_rec are skipped on first page only
+                    }
+                else if (--dav_state.page_retries != 0)
+                    {
+                    report(DETAIL, "Archive page failed CRC check - requesting again");
+                    dav_request_page(DAV_NAK);
+                    }
+                else
+                    {
+                    dav_error_str = "Archive page failed CRC check";
+                    report(PROBLEM, dav_error_str);
+                    dav_state.condition = DAV_BAD_CRC;
+                    goto dav_error;
+                    }
+                RESET_TIMEOUT();
+                }
+            else if (CHK_TIMEOUT_UI_MS(dav_state.resp_tout))
+                {
+                dav_error_str = "No archive page received";
+                report(PROBLEM, dav_error_str);
+                dav_state.condition = DAV_NO_DATA;
+                goto dav_error;
+                }
+            break;
+
+        // Records in page have been made available through dav_next_archive_rec()
+        case DAV_DELIVERING_PAGE:
+            dav_state.page_rec = 0;
+            if (dav_state.pages_left == 0)
+                {
+                SerialPutcE(DAV_ACK);
+                report(DETAIL, "Archive download complete");
+                goto dav_successful;
+                }
+            dav_request_page(DAV_ACK);
+            RESET_TIMEOUT();
+            break;
+
         // Undefined state value
         default:
             dav_error_str = "Bad state encountered";
@@ -926,24 +2408,48 @@ int dav_tick(void)
     dav_state.condition = DAV_PENDING;
     return dav_state.condition;                     // -- EXIT --
 
+    // Bad or missing data packet handler (attempts recovery without new wakeup)
+    dav_bad_data:
+        report(PROBLEM, dav_error_str);
+        if (dav_recover_data() == 0)
+            {
+            RESET_TIMEOUT();
+            dav_state.condition = DAV_PENDING;
+            return dav_state.condition;             // -- EXIT --
+            }
+        goto dav_error;
+
     // Data collection success handler
     dav_successful:
         dav_error_str = "Success";
+        dav_state.condition = DAV_SUCCESS;
+        dav_link_ok();
+        if (dav_next_batch_cmd())
+            return dav_state.condition;             // -- EXIT --
+        dav_stat_time(DAV_PHASE_TOTAL, dav_stats.start_ms);
         wx_set_leds(LED_DAVIS, LED_GREEN);
         dav_state.state = DAV_IDLE;
-        dav_state.condition = DAV_SUCCESS;
         return dav_state.condition;                 // -- EXIT --
 
     // Data collection time mismatch handler
     dav_time_mismatch:
         // No need for cleanup here
+        dav_link_ok();
+        if (dav_next_batch_cmd())
+            return dav_state.condition;             // -- EXIT --
+        dav_stat_time(DAV_PHASE_TOTAL, dav_stats.start_ms);
         wx_set_leds(LED_DAVIS, LED_GREEN);
         dav_state.state = DAV_IDLE;
         return dav_state.condition;                 // -- EXIT --
 
     // Data collection error handler
     dav_error:
+        dav_batch.cmd[dav_batch.current].status = dav_state.condition;
+        if (dav_state.condition < 0 && dav_state.condition >= -DAV_NUM_FAIL_CODES)
+            dav_stat_bump(&dav_stats.failures[-dav_state.condition - 1]);
+        dav_link.awake = 0;                         // Wake up fully next time
         dav_cleanup();
+        dav_cancel_transfer();
         wx_set_leds(LED_DAVIS, LED_RED);
         dav_state.state = DAV_IDLE;
         return dav_state.condition;                 // -- EXIT --
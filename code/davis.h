@@ -14,6 +14,81 @@
 
 #define DAV_DATA_LEN            99
 
+#define DAV_ARCH_REC_LEN        52          // Length of archive record
+
+// Identifiers of fields in LOOP and LOOP2 packets (see dav_field_xxx functions)
+// Raw units are shown -- use dav_field_scale() for divisor to stated units
+
+#define DAV_FLD_BAROMETER       0           // Barometer (inches Hg x 1000)
+#define DAV_FLD_IN_TEMP         1           // Inside temperature (F x 10)
+#define DAV_FLD_IN_HUM          2           // Inside humidity (%)
+#define DAV_FLD_OUT_TEMP        3           // Outside temperature (F x 10)
+#define DAV_FLD_WIND_SPEED      4           // Wind speed (mph)
+#define DAV_FLD_AVG_WIND_SPEED  5           // 10 min average (LOOP: mph, LOOP2: mph x 10)
+#define DAV_FLD_WIND_DIR        6           // Wind direction (degrees)
+#define DAV_FLD_OUT_HUM         7           // Outside humidity (%)
+#define DAV_FLD_RAIN_RATE       8           // Rain rate (clicks per hour)
+#define DAV_FLD_UV              9           // UV index (x 10)
+#define DAV_FLD_SOLAR_RAD       10          // Solar radiation (W/m2)
+#define DAV_FLD_DAY_RAIN        11          // Rain today (clicks)
+#define DAV_FLD_STORM_RAIN      12          // Rain in current storm (clicks)
+#define DAV_FLD_WIND_GUST       13          // 10 min wind gust (mph) -- LOOP2 only
+#define DAV_FLD_WIND_GUST_DIR   14          // Wind gust direction (degrees) -- LOOP2 only
+#define DAV_FLD_DEW_POINT       15          // Dew point (F) -- LOOP2 only
+#define DAV_FLD_HEAT_INDEX      16          // Heat index (F) -- LOOP2 only
+#define DAV_FLD_WIND_CHILL      17          // Wind chill (F) -- LOOP2 only
+#define DAV_FLD_ABS_BAROMETER   18          // Absolute barometer (inches Hg x 1000) -- LOOP2 only
+
+#define DAV_NUM_FIELDS          19
+
+#define DAV_MAX_BATCH           4           // Maximum commands in one batch
+
+// Phases of a transaction timed into histograms (see dav_show_stats)
+
+#define DAV_PHASE_WAKEUP        0           // Wakeup sent to response received
+#define DAV_PHASE_ACK           1           // Command sent to ACK received
+#define DAV_PHASE_FIRST_BYTE    2           // ACK received to first byte of packet
+#define DAV_PHASE_DATA          3           // First to last byte of packet
+#define DAV_PHASE_CHECK         4           // Last byte of packet to CRC checked
+#define DAV_PHASE_TOTAL         5           // Wakeup to last command of batch done
+
+#define DAV_NUM_PHASES          6
+
+#define DAV_STAT_BUCKETS        10          // < 10, 20, 50, 100, 200, 500 ms, < 1, 2, 5 s, rest
+#define DAV_NUM_RETRY_TYPES     6           // Wakeup, packet request, resync, lost ACK,
+                                            // wakeup skipped, fallback to wakeup
+#define DAV_NUM_FAIL_CODES      15          // DAV_NOT_STARTED (-1) to DAV_BAD_STATE (-15)
+
+// Length of statistics packed by dav_pack_stats() as 16-bit counts (LSB first):
+// buckets of each phase in turn, then retry counts, then failure code counts
+
+#define DAV_STATS_LEN           ((DAV_NUM_PHASES * DAV_STAT_BUCKETS + \
+                                  DAV_NUM_RETRY_TYPES + DAV_NUM_FAIL_CODES) * 2)
+
+// Structure definitions
+
+typedef struct
+    {
+    unsigned long time_ms;              // Millisecond timer value when received
+    unsigned int barometer;             // Barometer (inches Hg x 1000)
+    int in_temp;                        // Inside temperature (F x 10)
+    int out_temp;                       // Outside temperature (F x 10)
+    unsigned char out_hum;              // Outside humidity (%)
+    unsigned char wind_speed;           // Wind speed (mph)
+    unsigned int wind_dir;              // Wind direction (degrees)
+    unsigned int rain_rate;             // Rain rate (clicks per hour)
+    unsigned char valid;                // Fields with sensor present (see below)
+    } DavSample_t;
+
+// Bit masks for valid flags in sample structure
+
+#define DAV_SMP_BAROMETER       0x01
+#define DAV_SMP_IN_TEMP         0x02
+#define DAV_SMP_OUT_TEMP        0x04
+#define DAV_SMP_OUT_HUM         0x08
+#define DAV_SMP_WIND_SPEED      0x10
+#define DAV_SMP_WIND_DIR        0x20
+
 // External variables
 
 extern unsigned char dav_data[DAV_DATA_LEN];
@@ -47,10 +122,31 @@ char dav_init_serial(void);
 int dav_init_all(void);
 
 void dav_start_collect(void);
+void dav_start_collect_loop2(void);
 void dav_start_set_bar(int barometer, int elevation);
 void dav_start_echo_resp(char * cmd);
 void dav_start_check_time(void);
 void dav_start_set_time(void);
+void dav_start_stream(void);
+void dav_start_dump_after(time_t after);
+
+void dav_begin_batch(void);
+void dav_run_batch(void);
+unsigned char dav_get_batch_count(void);
+int dav_get_cmd_status(unsigned char index);
+
+int dav_read_sample(DavSample_t * sample);
+int dav_get_sample(DavSample_t * sample);
+const unsigned char * dav_next_archive_rec(void);
+
+int dav_field_valid(unsigned char field);
+unsigned int dav_field_uint(unsigned char field);
+int dav_field_int(unsigned char field);
+unsigned int dav_field_scale(unsigned char field);
+
+void dav_show_stats(void);
+void dav_clear_stats(void);
+unsigned int dav_pack_stats(unsigned char * buf);
 
 void dav_abort(void);
 int dav_get_status(void);
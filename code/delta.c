@@ -0,0 +1,48 @@
+// Routines to delta-encode blocks of data against a previously sent block
+// (keyframe)
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+// Most bytes of a LOOP packet are unchanged from one reading to the next,
+// so a block is sent as a bit mask of changed bytes plus their new values
+// (see header file for format).  Decoding is left to the server (see
+// tools/delta_dec.c for a reference decoder).
+
+
+#include <stddef.h>
+#include <string.h>
+#include "delta.h"
+
+
+// *** EXTERNAL FUNCTIONS ***
+
+// Encodes block against keyframe of same length into output buffer
+// (which must hold at least DELTA_MAX_LEN(len) bytes)
+// Returns length of encoded block
+
+unsigned int delta_encode(const unsigned char * key, const unsigned char * blk,
+                          unsigned int len, unsigned char * out)
+    {
+    unsigned char * vals;
+    unsigned int i;
+
+    memset(out, 0, DELTA_MASK_LEN(len));
+
+    vals = out + DELTA_MASK_LEN(len);
+
+    for (i = 0; i < len; ++i)
+        {
+        if (blk[i] != key[i])
+            {
+            out[i >> 3] |= (unsigned char) (1 << (i & 7));
+            *vals++ = blk[i];
+            }
+        }
+
+    return (unsigned int) (vals - out);
+    }
@@ -0,0 +1,30 @@
+// Header file for routines to delta-encode blocks of data against a
+// previously sent block (keyframe)
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+#ifndef DELTA_H
+#define DELTA_H
+
+// Encoded block is a mask with one bit per byte of the block (bit 0 of first
+// mask byte for first block byte, etc.) set where the byte differs from the
+// keyframe, followed by the new values of those bytes in order
+
+#define DELTA_MASK_LEN(len)     (((len) + 7) / 8)
+#define DELTA_MAX_LEN(len)      (DELTA_MASK_LEN(len) + (len))
+
+// Maximum number of delta-encoded blocks sent before a new keyframe
+
+#define DELTA_KEYFRAME_POSTS    16
+
+// Function prototypes
+
+unsigned int delta_encode(const unsigned char * key, const unsigned char * blk,
+                          unsigned int len, unsigned char * out);
+
+#endif
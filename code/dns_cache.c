@@ -0,0 +1,400 @@
+// Routines to cache results of DNS lookups
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+// Each name in the cache holds up to DNS_CACHE_ADDRS addresses, with the
+// one to use first at the front.  The resolver returns one address for each
+// lookup, so further addresses are collected from later lookups of names
+// that have several.  Names are looked up again in the background before
+// the cached result is due for refresh, so that a POST need only wait for
+// the resolver the first time that a name is used.  If a lookup fails, the
+// addresses already held are kept and used until a lookup succeeds again.
+// The resolver does not give the lifetime of the DNS records, so a fixed
+// refresh time is used.
+
+
+#include <string.h>
+#include <dcdefs.h>
+#include <stcpip.h>
+#include "timeout.h"
+#include "report.h"
+#include "wx_main.h"
+#include "dns_cache.h"
+
+
+// Short-cut names for types of report output (see "report.h")
+
+#define PROBLEM     (REPORT_LAN | REPORT_PROBLEM)
+#define DETAIL      (REPORT_LAN | REPORT_DETAIL)
+
+
+// Number of names and addresses per name held in cache
+
+#define DNS_CACHE_NAMES     2
+#define DNS_CACHE_ADDRS     4
+
+
+// Time after successful lookup before name is looked up again
+
+#define DNS_REFRESH_SECS    2700
+
+
+// Time after failed lookup before name is looked up again
+
+#define DNS_RETRY_SECS      60
+
+
+// Time for which an address is kept if not returned again by the resolver
+// (the last address for a name is kept regardless)
+
+#define DNS_ADDR_SECS       14400
+
+
+// Internal structure containing names and addresses held in cache
+
+static struct
+    {
+    char * name;                        // Name looked up (NULL if entry unused)
+    longword addr[DNS_CACHE_ADDRS];     // Addresses found (first to be used first)
+    unsigned int addr_timeout[DNS_CACHE_ADDRS];     // Determines time at which address expires
+    unsigned char count;                // Number of addresses held
+    unsigned int refresh_timeout;       // Determines time at which name is looked up again
+    int result;                         // Failure from last lookup (0 if none or reported)
+    } dns_entry[DNS_CACHE_NAMES];
+
+
+// Internal structure containing state variables for resolver
+
+static struct
+    {
+    int dns;                            // Handle for nameserver resolve (0 if none)
+    unsigned char index;                // Entry for which resolve is pending
+    unsigned char next_new;             // Entry to be used next for a new name
+    } dns_state;
+
+
+// *** INTERNAL FUNCTIONS ***
+
+// Internal function finds entry for name
+// Returns index of entry, or -1 if name not held
+
+static int find_entry(char * name)
+    {
+    unsigned char i;
+
+    for (i = 0; i < DNS_CACHE_NAMES; ++i)
+        {
+        if (dns_entry[i].name != NULL && strcmp(dns_entry[i].name, name) == 0)
+            return i;
+        }
+
+    return -1;
+    }
+
+
+// Internal function clears entry (cancelling any resolve pending for it)
+
+static void clear_entry(unsigned char index)
+    {
+    if (dns_state.dns > 0 && dns_state.index == index)
+        {
+        report(DETAIL, "Cancelling resolve request");
+        (void) resolve_cancel(dns_state.dns);
+        dns_state.dns = 0;
+        }
+
+    memset(&dns_entry[index], 0, sizeof(dns_entry[index]));
+    }
+
+
+// Internal function sets up entry for new name, re-using an entry not
+// awaiting a resolve if cache is full
+// Returns index of entry
+
+static unsigned char new_entry(char * name)
+    {
+    unsigned char i;
+
+    for (i = 0; i < DNS_CACHE_NAMES; ++i)
+        {
+        if (dns_entry[i].name == NULL)
+            break;
+        }
+
+    if (i >= DNS_CACHE_NAMES)
+        {
+        i = dns_state.next_new;
+
+        if (dns_state.dns > 0 && dns_state.index == i)
+            i = (i + 1) % DNS_CACHE_NAMES;
+
+        dns_state.next_new = (i + 1) % DNS_CACHE_NAMES;
+        }
+
+    clear_entry(i);
+    dns_entry[i].name = name;
+    return i;
+    }
+
+
+// Internal function adds address to front of entry, or moves it there if
+// already held (discarding last address if entry is full)
+
+static void add_addr(unsigned char index, longword ip)
+    {
+    unsigned char i;
+
+    for (i = 0; i < dns_entry[index].count; ++i)
+        {
+        if (dns_entry[index].addr[i] == ip)
+            break;
+        }
+
+    if (i >= dns_entry[index].count)
+        {
+        if (dns_entry[index].count < DNS_CACHE_ADDRS)
+            ++dns_entry[index].count;
+
+        i = dns_entry[index].count - 1;
+
+        report(DETAIL, "Adding address %s for %s", get_ip_string(ip),
+                        dns_entry[index].name);
+        }
+
+    for ( ; i > 0; --i)
+        {
+        dns_entry[index].addr[i] = dns_entry[index].addr[i - 1];
+        dns_entry[index].addr_timeout[i] = dns_entry[index].addr_timeout[i - 1];
+        }
+
+    dns_entry[index].addr[0] = ip;
+    dns_entry[index].addr_timeout[0] = SET_TIMEOUT_UI_SECS(DNS_ADDR_SECS);
+    }
+
+
+// Internal function discards expired addresses from entry (except the last)
+
+static void prune_addrs(unsigned char index)
+    {
+    unsigned char i;
+    unsigned char j;
+
+    i = 0;
+
+    while (i < dns_entry[index].count && dns_entry[index].count > 1)
+        {
+        if (CHK_TIMEOUT_UI_SECS(dns_entry[index].addr_timeout[i]))
+            {
+            report(DETAIL, "Dropping expired address %s for %s",
+                            get_ip_string(dns_entry[index].addr[i]), dns_entry[index].name);
+
+            --dns_entry[index].count;
+
+            for (j = i; j < dns_entry[index].count; ++j)
+                {
+                dns_entry[index].addr[j] = dns_entry[index].addr[j + 1];
+                dns_entry[index].addr_timeout[j] = dns_entry[index].addr_timeout[j + 1];
+                }
+            }
+        else
+            ++i;
+        }
+    }
+
+
+// Internal function starts resolve for entry
+// Updates result value if resolve cannot be started
+
+static void start_resolve(unsigned char index)
+    {
+    report(DETAIL, "Resolving %s", dns_entry[index].name);
+
+    dns_state.dns = resolve_name_start(dns_entry[index].name);
+
+    if (dns_state.dns <= 0)             // Must be 1 or greater
+        {
+        report(PROBLEM, "Error starting resolve (%d)", dns_state.dns);
+        dns_state.dns = 0;
+        dns_entry[index].result = DNS_CACHE_START_ERR;
+        dns_entry[index].refresh_timeout = SET_TIMEOUT_UI_SECS(DNS_RETRY_SECS);
+        return;
+        }
+
+    dns_state.index = index;
+    }
+
+
+// Internal function checks for result of pending resolve and updates entry
+
+static void check_resolve(void)
+    {
+    int rc;
+    longword ip;
+    unsigned char index;
+
+    if (dns_state.dns <= 0)
+        return;
+
+    rc = resolve_name_check(dns_state.dns, &ip);
+
+    if (rc == RESOLVE_AGAIN)
+        return;
+
+    dns_state.dns = 0;
+    index = dns_state.index;
+
+    if (rc == RESOLVE_SUCCESS)
+        {
+        add_addr(index, ip);
+        dns_entry[index].result = 0;
+        dns_entry[index].refresh_timeout = SET_TIMEOUT_UI_SECS(DNS_REFRESH_SECS);
+        return;
+        }
+
+    if (rc == RESOLVE_FAILED)
+        {
+        report(PROBLEM, "Resolve failed - host name %s does not exist", dns_entry[index].name);
+        dns_entry[index].result = DNS_CACHE_NOT_FOUND;
+        }
+    else
+        {
+        report(PROBLEM, "Error during resolve (%d)", rc);
+        dns_entry[index].result = DNS_CACHE_ERR;
+        }
+
+    if (dns_entry[index].count != 0)
+        report(DETAIL, "Keeping %u last good address(es) for %s",
+                        dns_entry[index].count, dns_entry[index].name);
+
+    dns_entry[index].refresh_timeout = SET_TIMEOUT_UI_SECS(DNS_RETRY_SECS);
+    }
+
+
+// *** EXTERNAL FUNCTIONS ***
+
+// Initialise cache (must only be called once at start-up of application)
+
+void dns_cache_init(void)
+    {
+    memset(dns_entry, 0, sizeof(dns_entry));
+    memset(&dns_state, 0, sizeof(dns_state));
+    }
+
+
+// Discards any addresses held for name (e.g. if server has been changed)
+
+void dns_cache_flush(char * name)
+    {
+    int index;
+
+    index = find_entry(name);
+
+    if (index >= 0)
+        clear_entry(index);
+    }
+
+
+// Looks up name in cache, starting a resolve if no address is held
+// Starts a resolve in the background if the addresses held are due for refresh
+// Call again while DNS_CACHE_PENDING is returned
+// Updates ip and returns DNS_CACHE_FOUND if address is available
+// Returns DNS_CACHE_PENDING if still waiting for resolve, or < 0 on failure
+// (see header file)
+
+int dns_cache_lookup(char * name, longword * ip)
+    {
+    int index;
+    int rc;
+
+    check_resolve();
+
+    index = find_entry(name);
+
+    if (index < 0)
+        index = new_entry(name);
+
+    if (dns_entry[index].count != 0)
+        {
+        *ip = dns_entry[index].addr[0];
+
+        if (dns_state.dns == 0 && CHK_TIMEOUT_UI_SECS(dns_entry[index].refresh_timeout))
+            start_resolve(index);       // Refresh in background
+
+        return DNS_CACHE_FOUND;
+        }
+
+    if (dns_entry[index].result == 0 && dns_state.dns == 0)
+        start_resolve(index);
+
+    if (dns_entry[index].result < 0)    // Report failure once only
+        {
+        rc = dns_entry[index].result;
+        dns_entry[index].result = 0;
+        return rc;
+        }
+
+    return DNS_CACHE_PENDING;           // Resolve pending (perhaps for another name)
+    }
+
+
+// Indicates that a connection could not be made to an address found by
+// dns_cache_lookup, so that the next address for the name (if any) is used
+// next time and the name is looked up again at the next opportunity
+
+void dns_cache_fail(char * name, longword ip)
+    {
+    int index;
+    unsigned char i;
+    unsigned int addr_timeout;
+
+    index = find_entry(name);
+
+    if (index < 0 || dns_entry[index].count == 0 || dns_entry[index].addr[0] != ip)
+        return;
+
+    if (dns_entry[index].count > 1)
+        {
+        addr_timeout = dns_entry[index].addr_timeout[0];
+
+        for (i = 1; i < dns_entry[index].count; ++i)
+            {
+            dns_entry[index].addr[i - 1] = dns_entry[index].addr[i];
+            dns_entry[index].addr_timeout[i - 1] = dns_entry[index].addr_timeout[i];
+            }
+
+        dns_entry[index].addr[i - 1] = ip;
+        dns_entry[index].addr_timeout[i - 1] = addr_timeout;
+
+        report(DETAIL, "Next address for %s will be %s", name,
+                        get_ip_string(dns_entry[index].addr[0]));
+        }
+
+    dns_entry[index].refresh_timeout = SET_TIMEOUT_UI_SECS(0);
+    }
+
+
+// Background "tick" routine which refreshes names held in cache
+// (should be called regularly while the network is otherwise idle)
+
+void dns_cache_tick(void)
+    {
+    unsigned char i;
+
+    check_resolve();
+
+    for (i = 0; i < DNS_CACHE_NAMES; ++i)
+        {
+        if (dns_entry[i].count == 0)
+            continue;
+
+        prune_addrs(i);
+
+        if (dns_state.dns == 0 && CHK_TIMEOUT_UI_SECS(dns_entry[i].refresh_timeout))
+            start_resolve(i);
+        }
+    }
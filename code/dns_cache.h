@@ -0,0 +1,29 @@
+// Header file for routines to cache results of DNS lookups
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+// Status of lookup (values returned by dns_cache_lookup)
+
+#define DNS_CACHE_FOUND         1
+#define DNS_CACHE_PENDING       0
+#define DNS_CACHE_START_ERR     (-1)
+#define DNS_CACHE_NOT_FOUND     (-2)
+#define DNS_CACHE_ERR           (-3)
+
+// Function prototypes
+
+void dns_cache_init(void);
+void dns_cache_flush(char * name);
+int dns_cache_lookup(char * name, longword * ip);
+void dns_cache_fail(char * name, longword ip);
+void dns_cache_tick(void);
+
+#endif
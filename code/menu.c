@@ -155,6 +155,11 @@ static const char * pwd_list[] =
 #define LABEL_DAVIS_SET_TIME    "Set weather station clock"
 #define LABEL_DAVIS_VERSION     "Check weather station version"
 #define LABEL_DAVIS_COLLECT     "Collect test LOOP packet"
+#define LABEL_DAVIS_STREAM      "Stream LOOP packets"
+#define LABEL_DAVIS_COLLECT2    "Collect test LOOP2 packet"
+#define LABEL_DAVIS_STATUS      "Check version, barometer and clock together"
+#define LABEL_DAVIS_STATS       "Show timing statistics"
+#define LABEL_DAVIS_CLEAR_STATS "Clear timing statistics"
 
 #define LABEL_DLOAD_CHECK       "Check for firmware update"
 
@@ -808,12 +813,14 @@ static int get_int_value(char * label, int * ptr, int min_val, int max_val,
 
 
 // Executes Davis command previously set up by call to dav_start_xxx()
+// (or batch of commands set up by dav_begin_batch() and dav_run_batch())
 // Success or failure is reported back to the user
 // Aborts if user presses [ESC] or time-out expires
 
 static void exec_davis_cmd(void)
     {
     int status;
+    unsigned char index;
 
     printf("Press [ESC] to abort command\r\n");
     input_tout_secs = SET_TIMEOUT_UI_SECS(MAX_DAVIS_WAIT_SECS);
@@ -846,6 +853,13 @@ static void exec_davis_cmd(void)
         printf("\r\nCommand failed");
 
     printf(" - result code %d\r\n", status);
+
+    if (dav_get_batch_count() > 1)
+        {
+        for (index = 0; index < dav_get_batch_count(); ++index)
+            printf("  Command %u result code %d\r\n", index + 1,
+                    dav_get_cmd_status(index));
+        }
     }
 
 
@@ -1016,6 +1030,11 @@ static int _nearcall exec_davis_check_time(void);
 static int _nearcall exec_davis_set_time(void);
 static int _nearcall exec_davis_version(void);
 static int _nearcall exec_davis_collect(void);
+static int _nearcall exec_davis_collect2(void);
+static int _nearcall exec_davis_status(void);
+static int _nearcall exec_davis_stream(void);
+static int _nearcall exec_davis_stats(void);
+static int _nearcall exec_davis_clear_stats(void);
 
 static int _nearcall exec_download_check(void);
 
@@ -1081,6 +1100,11 @@ static const MenuItem_t menu_davis[] =
     { 'S', LABEL_DAVIS_SET_TIME,   USER_ALL, exec_davis_set_time },
     { 'V', LABEL_DAVIS_VERSION,    USER_ALL, exec_davis_version },
     { 'L', LABEL_DAVIS_COLLECT,    USER_ALL, exec_davis_collect },
+    { '2', LABEL_DAVIS_COLLECT2,   USER_ALL, exec_davis_collect2 },
+    { 'A', LABEL_DAVIS_STATUS,     USER_ALL, exec_davis_status },
+    { 'P', LABEL_DAVIS_STREAM,     USER_ALL, exec_davis_stream },
+    { 'H', LABEL_DAVIS_STATS,      USER_ALL, exec_davis_stats },
+    { 'Z', LABEL_DAVIS_CLEAR_STATS, USER_HIGH, exec_davis_clear_stats },
     };
 
 static const MenuItem_t menu_dload[] =
@@ -1436,6 +1460,84 @@ static int _nearcall exec_davis_collect(void)
     return await_any_key();
     }
 
+static int _nearcall exec_davis_collect2(void)
+    {
+    dav_start_collect_loop2();
+    exec_davis_cmd();
+
+    return await_any_key();
+    }
+
+static int _nearcall exec_davis_status(void)
+    {
+    dav_begin_batch();
+    dav_start_echo_resp("VER");
+    dav_start_echo_resp("BARDATA");
+    dav_start_check_time();
+    dav_run_batch();
+
+    exec_davis_cmd();
+
+    return await_any_key();
+    }
+
+static int _nearcall exec_davis_stream(void)
+    {
+    DavSample_t sample;
+
+    printf("Press [ESC] to stop streaming\r\n");
+    input_tout_secs = SET_TIMEOUT_UI_SECS(MAX_INPUT_WAIT_SECS);
+
+    dav_start_stream();
+
+    for (;;)
+        {
+        if (dav_tick() != DAV_PENDING)
+            {
+            printf("\r\nStreaming failed - result code %d\r\n", dav_get_status());
+            break;
+            }
+
+        while (dav_read_sample(&sample))
+            {
+            printf("Bar %u, In %d, Out %d, Hum %u, Wind %u mph at %u deg, Rain %u\r\n",
+                    sample.barometer, sample.in_temp, sample.out_temp, sample.out_hum,
+                    sample.wind_speed, sample.wind_dir, sample.rain_rate);
+            }
+
+        if (inchar() == MENU_ESC)
+            {
+            printf(TEXT_ABORTED);
+            dav_abort();
+            break;
+            }
+
+        if (CHK_TIMEOUT_UI_SECS(input_tout_secs))
+            {
+            printf(TEXT_TIMED_OUT);
+            dav_abort();
+            break;
+            }
+        }
+
+    return await_any_key();
+    }
+
+static int _nearcall exec_davis_stats(void)
+    {
+    dav_show_stats();
+
+    return await_any_key();
+    }
+
+static int _nearcall exec_davis_clear_stats(void)
+    {
+    dav_clear_stats();
+    printf("Timing statistics cleared\r\n");
+
+    return await_any_key();
+    }
+
 
 // Firmware download menu functions
 
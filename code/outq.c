@@ -0,0 +1,163 @@
+// Routines to queue collected data for delivery to server
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+// Records that could not be delivered are held in battery-backed RAM, so
+// they survive a reset or power cut.  The queue is a ring with separate
+// head and tail indexes, each of which is changed by a single write only
+// after the record it covers is complete, so an interrupted update leaves
+// the queue consistent.  Each record carries its own CRC in case its
+// contents are damaged while held.
+
+
+#include <stddef.h>
+#include <time.h>
+#include <string.h>
+#include "davis.h"
+#include "crc.h"
+#include "outq.h"
+
+
+// Number of slots in ring (one is always left empty to tell full from empty)
+
+#define OUTQ_SLOTS              (OUTQ_MAX_RECS + 1)
+
+
+// Expected value in battery-backed memory
+
+#define OUTQ_MAGIC_NUMBER       0x51AA0715UL
+
+
+// Length of record covered by CRC
+
+#define OUTQ_CRC_LEN            offsetof(OutqRec_t, crc)
+
+
+// Battery-backed queue storage
+
+#pragma seg(BSS,BB_BSS)
+
+static struct
+    {
+    unsigned long magic;                // Indicates contents okay
+    unsigned int head;                  // Slot of oldest record
+    unsigned int tail;                  // Slot for next record to be added
+    OutqRec_t recs[OUTQ_SLOTS];         // Ring of records
+    } outq_bb;
+
+#pragma seg(BSS)
+
+
+// *** INTERNAL FUNCTIONS ***
+
+// Returns slot following given slot in ring
+
+static unsigned int outq_next(unsigned int slot)
+    {
+    return (slot + 1 < OUTQ_SLOTS) ? slot + 1 : 0;
+    }
+
+
+// *** EXTERNAL FUNCTIONS ***
+
+// Initialise queue on start-up, keeping any records held from before
+// Queue is emptied if battery-backed memory is not valid
+// Returns number of records held
+
+unsigned int outq_init(void)
+    {
+    if (outq_bb.magic != OUTQ_MAGIC_NUMBER ||
+        outq_bb.head >= OUTQ_SLOTS || outq_bb.tail >= OUTQ_SLOTS)
+        {
+        outq_bb.head = 0;
+        outq_bb.tail = 0;
+        outq_bb.magic = OUTQ_MAGIC_NUMBER;
+        }
+
+    return outq_count();
+    }
+
+
+// Adds record to end of queue, discarding oldest record if queue is full
+// Returns 0 if okay, or 1 if oldest record was discarded to make room
+
+int outq_push(unsigned long seq, unsigned long time, const unsigned char * data)
+    {
+    OutqRec_t * rec;
+    int dropped;
+
+    dropped = 0;
+
+    if (outq_count() >= OUTQ_MAX_RECS)
+        {
+        outq_drop(1);
+        dropped = 1;
+        }
+
+    rec = &outq_bb.recs[outq_bb.tail];
+
+    rec->seq = seq;
+    rec->time = time;
+    memcpy(rec->data, data, DAV_DATA_LEN);
+    rec->crc = crc_calculate(rec, OUTQ_CRC_LEN);
+
+    outq_bb.tail = outq_next(outq_bb.tail);        // Record now in queue
+
+    return dropped;
+    }
+
+
+// Returns number of records in queue
+
+unsigned int outq_count(void)
+    {
+    if (outq_bb.tail >= outq_bb.head)
+        return outq_bb.tail - outq_bb.head;
+    else
+        return outq_bb.tail + OUTQ_SLOTS - outq_bb.head;
+    }
+
+
+// Copies record from queue (index 0 is oldest record)
+// Returns 0 if okay, or -1 if index is out of range or record is damaged
+
+int outq_get(unsigned int index, OutqRec_t * rec)
+    {
+    unsigned int slot;
+
+    if (index >= outq_count())
+        return -1;
+
+    slot = outq_bb.head + index;
+    if (slot >= OUTQ_SLOTS)
+        slot -= OUTQ_SLOTS;
+
+    memcpy(rec, &outq_bb.recs[slot], sizeof(OutqRec_t));
+
+    if (crc_calculate(rec, OUTQ_CRC_LEN) != rec->crc)
+        return -1;
+
+    return 0;
+    }
+
+
+// Removes oldest records from queue
+
+void outq_drop(unsigned int count)
+    {
+    unsigned int head;
+
+    if (count > outq_count())
+        count = outq_count();
+
+    head = outq_bb.head + count;
+    if (head >= OUTQ_SLOTS)
+        head -= OUTQ_SLOTS;
+
+    outq_bb.head = head;                            // Records now out of queue
+    }
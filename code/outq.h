@@ -0,0 +1,35 @@
+// Header file for routines to queue collected data for delivery to server
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+#ifndef OUTQ_H
+#define OUTQ_H
+
+// Maximum number of records held in queue
+
+#define OUTQ_MAX_RECS           24
+
+// Structure definitions
+
+typedef struct
+    {
+    unsigned long seq;                  // Sequence number of first POST attempt
+    unsigned long time;                 // RTC time of collection (0 if not known)
+    unsigned char data[DAV_DATA_LEN];   // Data collected from weather station
+    unsigned int crc;                   // CRC of fields above
+    } OutqRec_t;
+
+// Function prototypes
+
+unsigned int outq_init(void);
+int outq_push(unsigned long seq, unsigned long time, const unsigned char * data);
+unsigned int outq_count(void);
+int outq_get(unsigned int index, OutqRec_t * rec);
+void outq_drop(unsigned int count);
+
+#endif
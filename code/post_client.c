@@ -10,7 +10,6 @@
 #include <stdio.h>
 #include <dcdefs.h>
 #include <stcpip.h>
-#include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
@@ -20,6 +19,8 @@
 #include "bb_vars.h"
 #include "rtc_utils.h"
 #include "wx_main.h"
+#include "url_enc.h"
+#include "dns_cache.h"
 #include "post_client.h"
 
 
@@ -35,17 +36,43 @@
 #define RAW_DETAIL  (DETAIL | REPORT_RAW)
 
 
+// Build flag to select persistent connections (may be overridden on compiler
+// command line): 0 closes the connection after each POST, 1 asks the server to
+// keep it open and re-uses it for the next POST (if the server agrees)
+
+#ifndef POST_KEEP_ALIVE
+#define POST_KEEP_ALIVE         1
+#endif
+
+
 // POST command header format
-// (includes variables for path, hostname, port, body length)
+// (includes variables for path, connection type, hostname, port, content type,
+// body length)
+// The header is formatted only when the server or body type is changed, with
+// room for the body length as a fixed-width field at the end (padded with
+// leading spaces, which HTTP allows), so that only the digits need to be
+// written for each POST
 
 static const char post_fmt[] =  "POST %s%s%s HTTP/1.1\r\n" \
-                                "Connection: close\r\n" \
+                                "Connection: %s\r\n" \
                                 "Host: %s:%u\r\n" \
                                 "User-Agent: Rabbit\r\n" \
-                                "Content-Type: application/x-www-form-urlencoded\r\n" \
-                                "Content-Length: %u\r\n" \
+                                "Content-Type: %s\r\n" \
+                                "Content-Length: %5u\r\n" \
                                 "\r\n";
 
+#define HDR_LEN_DIGITS      5       // Width of body length field (as above)
+#define HDR_LEN_END         4       // Characters after body length field
+
+
+// Content types for each body type (see header file)
+
+static const char * const post_content_type[] =
+    {
+    "application/x-www-form-urlencoded",        // POST_BODY_FORM
+    "application/octet-stream",                 // POST_BODY_BINARY
+    };
+
 
 // Maximum length of hostname and path
 
@@ -53,18 +80,35 @@ static const char post_fmt[] =  "POST %s%s%s HTTP/1.1\r\n" \
 #define MAX_PATH_LEN        64
 
 
-// Maximum size of command buffer
+// Maximum size of header (held in xmem for each destination)
 
-#define CMD_BUF_SIZE        350
+#define HDR_BUF_SIZE        350
 
 
-// Check that buffer size is adequate for variable parameters
+// Check that header size is adequate for variable parameters
+// (host tools check with the compiler, as their preprocessors lack sizeof)
 
-#define MAX_CMD_PARM_SIZE   (7 + MAX_HOST_LEN + MAX_PATH_LEN + MAX_HOST_LEN + 5 + 5)
+#define MAX_HDR_PARM_SIZE   (7 + MAX_HOST_LEN + MAX_PATH_LEN + 10 + MAX_HOST_LEN + 5 + 33 + 5)
 
-#if CMD_BUF_SIZE < (sizeof(post_fmt) + MAX_CMD_PARM_SIZE - 12 + 1)
-#error "CMD_BUF_SIZE is too small"
+#ifndef HOST_BUILD
+#if HDR_BUF_SIZE < (sizeof(post_fmt) + MAX_HDR_PARM_SIZE - 17 + 1)
+#error "HDR_BUF_SIZE is too small"
 #endif
+#else
+_Static_assert(HDR_BUF_SIZE >= sizeof(post_fmt) + MAX_HDR_PARM_SIZE - 17 + 1,
+               "HDR_BUF_SIZE is too small");
+#endif
+
+
+// Maximum size of command buffer (now used only for lines of response, which
+// are cut short if longer)
+
+#define CMD_BUF_SIZE        128
+
+
+// Size of buffer for bytes read from socket but not yet parsed
+
+#define RX_BUF_SIZE         64
 
 
 // Default size of body buffer (if not specified on initialisation)
@@ -93,14 +137,23 @@ static const char * post_resp[] =
 #define RESP_LABEL_TIME_T   "Server time ="
 
 
+// Header field labels within response from remote server
+
+#define HDR_CONTENT_LENGTH  "Content-Length:"
+#define HDR_TRANSFER_ENC    "Transfer-Encoding:"
+#define HDR_CONNECTION      "Connection:"
+#define HDR_KEEP_ALIVE      "Keep-Alive:"
+
+
 // Maximum allowed time difference in seconds before real-time clock is updated
 
 #define MAX_DIFF_TIME_T     40UL
 
 
-// Maximum time to use cached IP address before requiring another DNS lookup
+// Maximum time to hold an idle connection open for re-use (reduced to suit
+// the server if it gives a timeout in a "Keep-Alive:" header)
 
-#define DNS_CACHE_SECS      3600
+#define KEEP_ALIVE_SECS     60
 
 
 // Internal states for the POST server
@@ -112,8 +165,7 @@ enum state_value
     POST_RESOLVING,
     POST_OPENING,
     POST_AWAITING_ESTAB,
-    POST_SENDING_COMMAND,
-    POST_SENDING_BODY,
+    POST_SENDING,
     POST_READING_STATUS,
     POST_READING_HEADERS,
     POST_CHECKING_BODY,
@@ -121,18 +173,92 @@ enum state_value
     };
 
 
-// Internal structure containing state variables for POST client
+// Parts of response being parsed (see get_line)
+
+enum rx_part_value
+    {
+    RX_HEAD = 0,                        // Status line and headers
+    RX_BODY,                            // Body of known length or ending on close
+    RX_CHUNK_SIZE,                      // Size line of chunk
+    RX_CHUNK_DATA,                      // Data of chunk
+    RX_CHUNK_END,                       // Line end after data of chunk
+    RX_TRAILER,                         // Trailer lines after last chunk
+    RX_DONE,                            // End of response
+    };
+
+
+// Adaptive timeouts: the time taken to connect and the time from sending the
+// POST to receiving the status line of the response are tracked for each
+// destination as a smoothed time and mean deviation (as for TCP retransmission
+// in RFC6298).  The timeout for each of these phases is the smoothed time plus
+// four times the deviation, within the limits below, so that a server that has
+// stopped responding is given up on sooner.  Until there is a measurement (or
+// after a timeout in the phase, as the server may have slowed down), the full
+// TIMEOUT_SECS is allowed.
+
+#define RTT_CONNECT         0       // Phase from opening socket to connection
+#define RTT_RESPONSE        1       // Phase from sending POST to status line
+#define RTT_NUM_PHASES      2
+#define RTT_NONE            0xFF    // No phase being timed
+
+#define SRTT_SHIFT          3       // Smoothed time weights new value by 1/8
+#define RTTVAR_SHIFT        2       // Deviation weights new value by 1/4
+#define RTTVAR_FACTOR       4       // Timeout allows four times deviation
+
+static const unsigned int rtt_min_ms[RTT_NUM_PHASES] =
+    {
+    1000,                           // RTT_CONNECT (allows for a lost SYN)
+    2000,                           // RTT_RESPONSE (allows for server processing)
+    };
+
+#define MAX_RTT_MS          (TIMEOUT_SECS * 1000UL)
+
+
+// Timing statistics: the duration of each phase (see header file) of every
+// transaction to the main server is kept for the last POST_STATS_WINDOW
+// transactions, so that the following POSTs can report them.  Durations are
+// in ms and stick at NO_TIME - 1; phases that were not timed (e.g. look-up
+// and connection on a re-used socket, or phases after a failure) hold NO_TIME.
+
+#define NO_TIME             0xFFFF
+
+static const char * const post_phase_names[POST_NUM_PHASES] =
+    {
+    "DNS", "Connect", "Header", "Body", "First byte", "Close",
+    };
 
 static struct
     {
+    unsigned int times[POST_STATS_WINDOW][POST_NUM_PHASES];    // Ring of phase times
+    unsigned char head;                 // Index of next entry to be written
+    unsigned char count;                // Number of entries held
+    } post_stats;
+
+
+// Internal structure containing state variables for POST to one destination
+
+typedef struct
+    {
+    unsigned char dest;                 // Destination number (see header file)
     enum state_value state;             // Current state (see definition above)
     int condition;                      // Overall status return code (see header file)
+    const char * error_str;             // Description of last failure (or "Succeeded")
     unsigned char resp_class;           // First digit of status response from server (e.g. 2XX)
     unsigned char resp_result;          // Ennumerated value of response message from server
 
-    int dns;                            // Handle for nameserver resolve
-    unsigned int timeout;               // Timeout timer value
+    unsigned long timeout;              // Timeout timer value
+    unsigned char rtt_phase;            // Phase being timed (or RTT_NONE)
+    unsigned long phase_ms;             // Start time of phase being timed
+    unsigned long srtt[RTT_NUM_PHASES];     // Smoothed time for each phase (ms x 8, 0 if none)
+    unsigned long rttvar[RTT_NUM_PHASES];   // Mean deviation for each phase (ms x 4)
+    unsigned long mark_ms;              // Time at end of previous statistics phase
+    unsigned int times[POST_NUM_PHASES];    // Phase times in transaction (see above)
     unsigned char sock_opened;          // Flag indicating socket opened
+    unsigned char sock_idle;            // Flag indicating socket left open for re-use
+    unsigned char sock_reused;          // Flag indicating POST is on re-used socket
+    unsigned char keep_alive;           // Flag indicating server will keep socket open
+    unsigned int idle_secs;             // Time for which idle socket may be held
+    unsigned int idle_timeout;          // Determines time at which idle socket expires
     unsigned char servers_set;          // Flag indicating servers set okay
 
     char * server_host;                 // Host name sent in "Host:" header line
@@ -146,127 +272,171 @@ static struct
     char * abs_uri_prefix;              // Set to "http://" for proxy access, otherwise ""
     char * abs_uri_host;                // Set to server host for proxy access, otherwise ""
 
-    longword cached_ip;                 // Last resolved IP address (if any)
-    unsigned int cache_timeout;         // Determines time at which cached IP address expires
+    unsigned int hdr_len;               // Length of formatted header (0 if not yet set up)
 
     unsigned int msg_len;               // Length of message in buffer to send
     unsigned int msg_pos;               // Position in buffer of next message byte to send
 
-    char cmd_buf[CMD_BUF_SIZE];         // Buffer for requests and responses
+    enum rx_part_value rx_part;         // Part of response being parsed
+    unsigned char chunked;              // Flag indicating chunked response body
+    unsigned char chunk_ext;            // Flag indicating extension on chunk size line
+    long body_left;                     // Response body bytes still to read (-1 if unknown)
+    long chunk_left;                    // Chunk data bytes still to read
+    unsigned int line_len;              // Length of line received so far
+
+    char rx_buf[RX_BUF_SIZE];           // Buffer for bytes read from socket
+    unsigned int rx_len;                // Number of bytes in rx_buf
+    unsigned int rx_pos;                // Position in rx_buf of next byte to parse
+
+    char cmd_buf[CMD_BUF_SIZE];         // Buffer for responses
+
+    char far * hdr_buf;                 // Pointer to xmem buffer for header
+
+    tcp_Socket socket;                  // TCP socket for outbound HTTP connection
+
+    } PostCtx_t;
+
 
+// State variables for each destination (one TCP socket each)
+
+static PostCtx_t post_ctx[POST_MAX_DESTS];
+
+
+// Internal structure containing body sent to all destinations
+
+static struct
+    {
     char far * body_buf;                // Pointer to xmem buffer for body message to send
     unsigned int body_buf_size;         // Size of xmem buffer (set up on initialisation)
     unsigned int body_pos;              // Position in xmem buffer of next free character
     unsigned char body_overflow;        // Flag to indicate buffer overrun was prevented
+    unsigned char body_type;            // Format of body (see header file)
+    } post_body;
 
-    tcp_Socket socket;                  // TCP socket for outbound HTTP connection
 
-    } post_state;
+// Internal structure for waiting on other destinations once primary has finished
+
+static struct
+    {
+    unsigned char waiting;              // Flag indicating primary finished first
+    unsigned long timeout;              // Time at which others are given up
+    } post_grace;
 
 
-// Number of seconds before timing out POST attempt
+// Number of seconds before timing out POST attempt (in each state)
 
 #define TIMEOUT_SECS        20
 
 
-// Macro to reset timeout timer
+// Number of ms for which other destinations may finish after primary has
+// finished (so that a standby server that is down or slow does not hold up
+// the result of each POST until it times out)
+
+#define GRACE_MS            2000
+
 
-#define RESET_TIMEOUT()     post_state.timeout = SET_TIMEOUT_UI_SECS(TIMEOUT_SECS)
+// Macro to reset timeout timer (ending any timed phase)
+
+#define RESET_TIMEOUT()     (ctx->rtt_phase = RTT_NONE, \
+                             ctx->timeout = SET_TIMEOUT_UL_MS(TIMEOUT_SECS * 1000UL))
 
 
 // *** INTERNAL FUNCTIONS ***
 
-// Internal function attempts to add a character to the body buffer
-// If url_encode is non-zero then non-alphanumeric chars are hex encoded
+// Internal function attempts to add bytes unchanged to the body buffer
 // Returns 0 on success or -1 if not enough room in body buffer
 
-static int add_body_char(char ch, int url_encode)
+static int add_body_bytes(const char * bytes, unsigned int len)
     {
-    char * fmt;
-    unsigned int inc;
+    char far * body_ptr;
 
-    fmt = "%c";                     // Default is just add character
-    inc = 1;
+    if (post_body.body_pos + len >= post_body.body_buf_size)
+        return -1;              // Not enough room in body buffer
 
-    if (url_encode)
-        {
-        if (!isalnum(ch))
-            {
-            if (ch == ' ')
-                ch = '+';
-            else
-                {
-                fmt = "%%%02X";
-                inc = 3;
-                }
-            }
-        }
+    body_ptr = post_body.body_buf + post_body.body_pos;
 
-    if (post_state.body_pos + inc >= post_state.body_buf_size)
-        return -1;
+    post_body.body_pos += len;
 
-    farsprintf((post_state.body_buf + post_state.body_pos), fmt, ch);
-    post_state.body_pos += inc;
+    while (len--)
+        *body_ptr++ = *bytes++;
 
     return 0;
     }
 
 
-// Internal function attempts to add URL-encoded ASCII string to the body buffer
+// Internal function attempts to add tag and length of binary field to body buffer
+// (length is one byte if below 128, otherwise two bytes with top bit set)
 // Returns 0 on success or -1 if not enough room in body buffer
 
-static int add_body_string(const char * str)
+static int add_field_header(unsigned char tag, unsigned int len)
     {
-    while (*str != 0)
-        {
-        if (add_body_char(*str, 1) < 0)
-            return -1;
+    char hdr[3];
+
+    hdr[0] = tag;
 
-        ++str;
+    if (len < 0x80)
+        {
+        hdr[1] = (char) len;
+        return add_body_bytes(hdr, 2);
         }
 
-    return 0;
+    hdr[1] = (char) (0x80 | (len >> 8));
+    hdr[2] = (char) len;
+    return add_body_bytes(hdr, 3);
     }
 
 
-// Internal function converts low nibble of parameter to ASCII hex digit
-// Returns ASCII character corresponding to value in low 4 bits of nibble
+// Internal function formats header for current server and body type
+// Updates hdr_len value (0 if header cannot be formatted)
 
-static char nibb_to_hex(char nibble)
+static void build_header(PostCtx_t * ctx)
     {
-    nibble &= 0x0F;                             // Discard upper bits
+    int len;
 
-    if (nibble <= 9)
-        return (char) (nibble + '0');           // Decimal digit
-    else
-        return (char) (nibble + 'A' - 10);      // Hex A-F digit
-    }
+    ctx->hdr_len = 0;
 
+    if (!ctx->servers_set || !ctx->hdr_buf)
+        return;
 
-// Internal function attempts to add fixed-length hexadecimal string to body buffer
-// Note: len must be in range 0-32767
-// Returns 0 on success or -1 if not enough room in body buffer
+    len = farsprintf(ctx->hdr_buf, post_fmt,
+                     ctx->abs_uri_prefix, ctx->abs_uri_host,
+                     ctx->server_path,
+                     POST_KEEP_ALIVE ? "keep-alive" : "close",
+                     ctx->server_host, ctx->server_port,
+                     post_content_type[post_body.body_type], 0);
 
-static int add_body_hexstring(const char * bytes, unsigned int len)
-    {
-    char far * body_ptr;
+    if (len <= 0 || len >= HDR_BUF_SIZE)
+        {
+        report(PROBLEM, "Failed to format command header (%d)", len);
+        return;
+        }
 
-    if (post_state.body_pos + (len * 2) >= post_state.body_buf_size)
-        return -1;              // Not enough room in body buffer
+    report(DETAIL, "Command header for destination %u (%d bytes):", ctx->dest, len);
+    report(RAW_DETAIL, "%ls", ctx->hdr_buf);
 
-    body_ptr = post_state.body_buf + post_state.body_pos;
+    ctx->hdr_len = len;
+    }
 
-    post_state.body_pos += (len * 2);               // Move pointer on before len is trashed
 
-    while (len--)
-        {
-        *body_ptr++ = nibb_to_hex(*bytes >> 4);     // Add upper nibble
-        *body_ptr++ = nibb_to_hex(*bytes++);        // Add lower nibble
-        }
+// Internal function writes body length into fixed-width field of header
 
-    *body_ptr = '\0';               // Add zero terminator
+static void set_content_length(PostCtx_t * ctx, unsigned int len)
+    {
+    char far * ptr;
+    unsigned char i;
 
-    return 0;
+    ptr = ctx->hdr_buf + ctx->hdr_len - HDR_LEN_END;
+
+    for (i = 0; i < HDR_LEN_DIGITS; ++i)
+        {
+        if (len != 0 || i == 0)
+            {
+            *--ptr = (char) ('0' + (len % 10));
+            len /= 10;
+            }
+        else
+            *--ptr = ' ';
+        }
     }
 
 
@@ -274,7 +444,7 @@ static int add_body_hexstring(const char * bytes, unsigned int len)
 // Returns 0 if no match
 // Updates request_ip and returns 1 if match found
 
-static int check_direct_ip(char * name)
+static int check_direct_ip(PostCtx_t * ctx, char * name)
     {
     longword result;
 
@@ -283,23 +453,215 @@ static int check_direct_ip(char * name)
     if (result == 0L)
         return 0;
 
-    post_state.request_ip = result;
+    ctx->request_ip = result;
     return 1;
     }
 
 
-// Internal function attempts to get a response line from the server
-// Returns 0 if no data pending or 1 if line of data received
+// Internal function starts timing of transaction for statistics (see above)
 
-static int get_response(void)
+static void start_times(PostCtx_t * ctx)
     {
-    if (sock_bytesready(&post_state.socket) == -1)
-        return 0;
+    unsigned char phase;
+
+    for (phase = 0; phase < POST_NUM_PHASES; ++phase)
+        ctx->times[phase] = NO_TIME;
+
+    ctx->mark_ms = getMilliSeconds();
+    }
+
+
+// Internal function records time of statistics phase that has just ended
+// (which also marks the start of the next phase)
+
+static void mark_time(PostCtx_t * ctx, unsigned char phase)
+    {
+    unsigned long now_ms;
+    unsigned long elapsed;
+
+    now_ms = getMilliSeconds();
+    elapsed = now_ms - ctx->mark_ms;
+
+    ctx->times[phase] = (elapsed < NO_TIME) ? (unsigned int) elapsed : NO_TIME - 1;
+    ctx->mark_ms = now_ms;
+    }
+
+
+// Internal function adds phase times of finished transaction to statistics
+// (main server only)
+
+static void save_times(PostCtx_t * ctx)
+    {
+    unsigned char phase;
+
+    if (ctx->dest != POST_PRIMARY)
+        return;
+
+    report(DETAIL, "Phase times (ms):");
+
+    for (phase = 0; phase < POST_NUM_PHASES; ++phase)
+        {
+        post_stats.times[post_stats.head][phase] = ctx->times[phase];
+
+        if (ctx->times[phase] != NO_TIME)
+            report(RAW_DETAIL, " %s %u", post_phase_names[phase], ctx->times[phase]);
+        }
+
+    report(RAW_DETAIL, "\r\n");
+
+    if (++post_stats.head >= POST_STATS_WINDOW)
+        post_stats.head = 0;
+
+    if (post_stats.count < POST_STATS_WINDOW)
+        ++post_stats.count;
+    }
+
+
+// Internal function attempts to get the next byte of the response
+// Bytes are read from the socket in blocks and parsed from rx_buf
+// Returns 0 if no byte pending or 1 if byte received
+
+static int get_byte(PostCtx_t * ctx, char * ch)
+    {
+    int rc;
+
+    if (ctx->rx_pos >= ctx->rx_len)
+        {
+        rc = sock_fastread(&ctx->socket, ctx->rx_buf, sizeof(ctx->rx_buf));
+
+        if (rc <= 0)
+            return 0;
+
+        ctx->rx_len = rc;
+        ctx->rx_pos = 0;
+
+        if (ctx->times[POST_PHASE_FIRST_BYTE] == NO_TIME &&
+            ctx->times[POST_PHASE_BODY] != NO_TIME)
+            mark_time(ctx, POST_PHASE_FIRST_BYTE);
+        }
+
+    *ch = ctx->rx_buf[ctx->rx_pos++];
+    return 1;
+    }
+
+
+// Internal function checks a chunk size line character and updates chunk_left
+// (any extension after the size is ignored)
+
+static void parse_chunk_size(PostCtx_t * ctx, char ch)
+    {
+    unsigned char digit;
+
+    if (ch >= '0' && ch <= '9')
+        digit = ch - '0';
+    else if (ch >= 'A' && ch <= 'F')
+        digit = ch - 'A' + 10;
+    else if (ch >= 'a' && ch <= 'f')
+        digit = ch - 'a' + 10;
+    else
+        {
+        if (ch != '\r')
+            ctx->chunk_ext = 1;                 // End of size (e.g. ';' or space)
+        return;
+        }
+
+    if (!ctx->chunk_ext && ctx->chunk_left < 0x08000000L)
+        ctx->chunk_left = (ctx->chunk_left << 4) | digit;
+    }
+
+
+// Internal function attempts to get the next line of the response from the
+// server, parsing the response byte by byte as it arrives: status line and
+// headers, then body lines (of known length, in chunks or ending on close)
+// with any chunk framing removed
+// Sets rx_part to RX_DONE at end of body (or when connection is closed while
+// reading body)
+// Returns 0 if no line pending or 1 if line of data received
+
+static int get_line(PostCtx_t * ctx)
+    {
+    char ch;
+
+    for (;;)
+        {
+        if (ctx->rx_part == RX_DONE)
+            {
+            if (ctx->line_len == 0)
+                return 0;                       // End of body
+            break;                              // Last line has no terminator
+            }
+
+        if (!get_byte(ctx, &ch))
+            {
+            if (ctx->rx_part == RX_HEAD || tcp_tick(&ctx->socket))
+                return 0;                       // Wait for more data
+
+            if (ctx->rx_part != RX_BODY || ctx->body_left >= 0)
+                report(PROBLEM, "Connection closed before end of body");
+            else
+                report(DETAIL, "Connection closed");
+
+            ctx->sock_opened = 0;
+            ctx->rx_part = RX_DONE;
+            continue;
+            }
 
-    sock_gets(&post_state.socket, post_state.cmd_buf, sizeof(post_state.cmd_buf));
+        switch (ctx->rx_part)
+            {
+            case RX_BODY:
+                if (ctx->body_left > 0 && --ctx->body_left == 0)
+                    ctx->rx_part = RX_DONE;
+                break;
+
+            case RX_CHUNK_SIZE:
+                if (ch != '\n')
+                    parse_chunk_size(ctx, ch);
+                else if (ctx->chunk_left != 0)
+                    ctx->rx_part = RX_CHUNK_DATA;
+                else
+                    ctx->rx_part = RX_TRAILER;          // Last chunk
+                continue;
+
+            case RX_CHUNK_DATA:
+                if (--ctx->chunk_left == 0)
+                    ctx->rx_part = RX_CHUNK_END;
+                break;
+
+            case RX_CHUNK_END:
+                if (ch == '\n')
+                    {
+                    ctx->chunk_ext = 0;
+                    ctx->rx_part = RX_CHUNK_SIZE;
+                    }
+                continue;
+
+            case RX_TRAILER:
+                if (ch == '\n')
+                    {
+                    if (ctx->chunk_left == 0)           // Blank line?
+                        ctx->rx_part = RX_DONE;
+                    ctx->chunk_left = 0;
+                    }
+                else if (ch != '\r')
+                    ctx->chunk_left = 1;                // Trailer line not blank
+                continue;
+
+            default:                                    // RX_HEAD
+                break;
+            }
+
+        if (ch == '\n')
+            break;
+
+        if (ch != '\r' && ctx->line_len < sizeof(ctx->cmd_buf) - 1)
+            ctx->cmd_buf[ctx->line_len++] = ch;
+        }
+
+    ctx->cmd_buf[ctx->line_len] = '\0';
+    ctx->line_len = 0;
 
-    if (post_state.cmd_buf[0])
-        report(DETAIL, "Read: %s", post_state.cmd_buf);
+    if (ctx->cmd_buf[0])
+        report(DETAIL, "Read: %s", ctx->cmd_buf);
     else
         report(DETAIL, "Read: (blank line)");
 
@@ -307,32 +669,81 @@ static int get_response(void)
     }
 
 
-// Internal function attempts to send a message to the server
+// Internal function sets up parsing of response body once headers are complete
+// Chunked encoding takes precedence over length (as RFC2616)
+
+static void start_body(PostCtx_t * ctx)
+    {
+    ctx->line_len = 0;
+
+    if (ctx->chunked)
+        {
+        ctx->chunk_left = 0;
+        ctx->chunk_ext = 0;
+        ctx->rx_part = RX_CHUNK_SIZE;
+        }
+    else if (ctx->body_left == 0)
+        ctx->rx_part = RX_DONE;
+    else
+        {
+        if (ctx->body_left < 0)
+            ctx->keep_alive = 0;            // Must read until closed
+
+        ctx->rx_part = RX_BODY;
+        }
+    }
+
+
+// Internal function attempts to send command header and body to the server
+// The header and body are written in turn from their own buffers in the same
+// call, so that they go out together as though a single message
 // Returns 0 on successful write but with data still pending,
 // or 1 if all data has been written, or < 0 on failure
 
-static int send_message(char far * msg_buf)
+static int send_message(PostCtx_t * ctx)
     {
+    char far * src;
+    unsigned int len;
     int rc;
 
-    rc = sock_xfastwrite(&post_state.socket, (long) (msg_buf + post_state.msg_pos),
-                        (post_state.msg_len - post_state.msg_pos));
-
-    if (rc < 0)
+    for (;;)
         {
-        bb_post_error_str = "sock_xfastwrite() failed";
-        report(PROBLEM, "%s with %d", bb_post_error_str, rc);
-        return -1;                      // Error
-        }
+        if (ctx->msg_pos < ctx->hdr_len)
+            {
+            src = ctx->hdr_buf + ctx->msg_pos;
+            len = ctx->hdr_len - ctx->msg_pos;
+            }
+        else
+            {
+            src = post_body.body_buf + (ctx->msg_pos - ctx->hdr_len);
+            len = ctx->msg_len - ctx->msg_pos;
+            }
+
+        rc = sock_xfastwrite(&ctx->socket, (long) src, len);
+
+        if (rc < 0)
+            {
+            ctx->error_str = "sock_xfastwrite() failed";
+            report(PROBLEM, "%s with %d", ctx->error_str, rc);
+            return -1;                  // Error
+            }
+
+        if (rc > 0)
+            report(DETAIL, "Wrote %d bytes", rc);
 
-    if (rc > 0)
-        report(DETAIL, "Wrote %d bytes", rc);
+        if (ctx->msg_pos < ctx->hdr_len && ctx->msg_pos + rc >= ctx->hdr_len)
+            mark_time(ctx, POST_PHASE_HEADER);
 
-    post_state.msg_pos += rc;
+        ctx->msg_pos += rc;
 
-    if (post_state.msg_pos == post_state.msg_len)
+        if ((unsigned int) rc != len || ctx->msg_pos == ctx->msg_len)
+            break;                      // Socket buffer full or all written
+        }
+
+    if (ctx->msg_pos == ctx->msg_len)
         {
-        report(DETAIL, "Write completed (%d bytes)", post_state.msg_pos);
+        report(DETAIL, "Write completed (%d bytes)", ctx->msg_pos);
+        mark_time(ctx, POST_PHASE_BODY);
         return 1;                       // Completed
         }
 
@@ -344,34 +755,41 @@ static int send_message(char far * msg_buf)
 // Updates resp_class value if valid status line is found
 // Returns 0 on valid response, < 0 if response not in correct HTTP format
 
-static int check_resp_status(void)
+static int check_resp_status(PostCtx_t * ctx)
     {
     char *ptr;
     int count;
     int class;
 
-    ptr = &post_state.cmd_buf[0];
+    ptr = &ctx->cmd_buf[0];
 
     if (strnicmp(ptr, "HTTP/", 5) != 0)
         {
-        bb_post_error_str = "HTTP header not found in status response";
-        report(PROBLEM, bb_post_error_str);
+        ctx->error_str = "HTTP header not found in status response";
+        report(PROBLEM, ctx->error_str);
         return -1;
         }
 
+    // Connection persists by default from HTTP/1.1 (unless headers say otherwise)
+
+    ctx->keep_alive = (POST_KEEP_ALIVE && strnicmp(ptr, "HTTP/1.0", 8) != 0);
+    ctx->idle_secs = KEEP_ALIVE_SECS;
+    ctx->body_left = -1;
+    ctx->chunked = 0;
+
     ptr = strpbrk(ptr, " \t");
     if (!ptr)
         {
-        bb_post_error_str = "Delimiting space not found in status response";
-        report(PROBLEM, bb_post_error_str);
+        ctx->error_str = "Delimiting space not found in status response";
+        report(PROBLEM, ctx->error_str);
         return -2;
         }
 
     count = strspn(ptr, " \t");
     if (count <= 0)
         {
-        bb_post_error_str = "Unable to skip past space in status response";
-        report(PROBLEM, bb_post_error_str);
+        ctx->error_str = "Unable to skip past space in status response";
+        report(PROBLEM, ctx->error_str);
         return -3;
         }
 
@@ -380,31 +798,83 @@ static int check_resp_status(void)
     class = *ptr;
     if (class < '1' || class > '5')
         {
-        bb_post_error_str = "Unexpected class digit";
-        report(PROBLEM, "%s: %c", bb_post_error_str, class);
+        ctx->error_str = "Unexpected class digit";
+        report(PROBLEM, "%s: %c", ctx->error_str, class);
         return -4;
         }
 
-    post_state.resp_class = (class - '0');
+    ctx->resp_class = (class - '0');
     return 0;
     }
 
 
+// Internal function checks response header line for fields about the connection
+// Updates body_left, chunked, keep_alive and idle_secs values if relevant fields are found
+
+static void check_resp_header(PostCtx_t * ctx)
+    {
+    char * ptr;
+    unsigned long secs;
+
+    ptr = ctx->cmd_buf;
+
+    if (strnicmp(ptr, HDR_CONTENT_LENGTH, sizeof(HDR_CONTENT_LENGTH) - 1) == 0)
+        {
+        ctx->body_left = strtol(ptr + sizeof(HDR_CONTENT_LENGTH) - 1, NULL, 10);
+
+        if (ctx->body_left < 0)
+            ctx->body_left = -1;                // Treat as unknown
+        }
+    else if (strnicmp(ptr, HDR_TRANSFER_ENC, sizeof(HDR_TRANSFER_ENC) - 1) == 0)
+        {
+        ptr += sizeof(HDR_TRANSFER_ENC) - 1;
+        ptr += strspn(ptr, " \t");
+
+        if (strnicmp(ptr, "chunked", 7) == 0)
+            ctx->chunked = 1;
+        }
+    else if (strnicmp(ptr, HDR_CONNECTION, sizeof(HDR_CONNECTION) - 1) == 0)
+        {
+        ptr += sizeof(HDR_CONNECTION) - 1;
+        ptr += strspn(ptr, " \t");
+
+        if (strnicmp(ptr, "close", 5) == 0)
+            ctx->keep_alive = 0;
+        else if (strnicmp(ptr, "keep-alive", 10) == 0)
+            ctx->keep_alive = POST_KEEP_ALIVE;
+        }
+    else if (strnicmp(ptr, HDR_KEEP_ALIVE, sizeof(HDR_KEEP_ALIVE) - 1) == 0)
+        {
+        ptr = strstr(ptr, "timeout=");
+
+        if (ptr != NULL)
+            {
+            secs = strtoul(ptr + 8, NULL, 10);
+
+            if (secs <= 1)
+                ctx->keep_alive = 0;            // Too short to be of use
+            else if (secs - 1 < ctx->idle_secs)
+                ctx->idle_secs = (unsigned int) (secs - 1);
+            }
+        }
+    }
+
+
 // Internal function checks response line from server for response message
 // Updates resp_result value if valid response line is found
 // Returns 0 if no response identified, or response value (> 0) if found
 
-static int check_resp_result(void)
+static int check_resp_result(PostCtx_t * ctx)
     {
     unsigned char i;
 
     for (i = 0; i < sizeof(post_resp) / sizeof(post_resp[0]); ++i)
         {
-        if (strnicmp(post_state.cmd_buf, post_resp[i], strlen(post_resp[i])) == 0)
+        if (strnicmp(ctx->cmd_buf, post_resp[i], strlen(post_resp[i])) == 0)
             {
-            post_state.resp_result = i + 1;
-            report(DETAIL, "Found response %u", post_state.resp_result);
-            return post_state.resp_result;
+            ctx->resp_result = i + 1;
+            report(DETAIL, "Found response %u", ctx->resp_result);
+            return ctx->resp_result;
             }
         }
 
@@ -420,15 +890,15 @@ static int check_resp_result(void)
 // Returns  0 if real-time clock is unchanged (was within range of time_t value)
 // Returns  1 if real-time clock has been adjusted to received time_t value
 
-static int check_resp_time_t(void)
+static int check_resp_time_t(PostCtx_t * ctx)
     {
     char * ptr;
     time_t value;
 
-    if (strnicmp(post_state.cmd_buf, RESP_LABEL_TIME_T, sizeof(RESP_LABEL_TIME_T) - 1) != 0)
+    if (strnicmp(ctx->cmd_buf, RESP_LABEL_TIME_T, sizeof(RESP_LABEL_TIME_T) - 1) != 0)
         return -1;
 
-    ptr = post_state.cmd_buf + sizeof(RESP_LABEL_TIME_T) - 1;
+    ptr = ctx->cmd_buf + sizeof(RESP_LABEL_TIME_T) - 1;
 
     value = strtoul(ptr, NULL, 10);
     if (value == 0UL)
@@ -457,334 +927,302 @@ static int check_resp_time_t(void)
     }
 
 
-// Internal function cleans up pending DNS enquiry or open TCP socket
+// Internal function cleans up open TCP socket
+// (any pending DNS enquiry is left to complete and update the cache)
 
-static void post_cleanup(void)
+static void post_cleanup(PostCtx_t * ctx)
     {
-    if (post_state.dns > 0)
-        {
-        report(DETAIL, "Cancelling resolve request");
-        (void) resolve_cancel(post_state.dns);
-        post_state.dns = 0;
-        }
-
-    if (post_state.sock_opened)
+    if (ctx->sock_opened)
         {
         report(DETAIL, "Closing socket");
-        sock_abort(&post_state.socket);
-        post_state.sock_opened = 0;
+        sock_abort(&ctx->socket);
+        ctx->sock_opened = 0;
         }
-    }
 
+    ctx->sock_idle = 0;
+    }
 
-// *** EXTERNAL FUNCTIONS ***
 
-// Initialise POST state machine and allocate body buffer
-// (must only be called once at start-up of application)
-// Returns 0 on success, < 0 if unable to allocate buffer
+// Internal function looks up IP address of request host (see dns_cache.h)
+// Updates request_ip value if address is found
+// Returns DNS_CACHE_PENDING if still waiting for resolve, or as dns_cache_lookup
 
-int post_init(unsigned int body_max_size)
+static int lookup_request_ip(PostCtx_t * ctx)
     {
-    memset(&post_state, 0, sizeof(post_state));     // First, clear all state variables
-
-    post_state.condition = POST_NOT_STARTED;
+    int rc;
 
-    post_state.cmd_buf[0] = '\0';                   // Zero-length string in near buffer
+    rc = dns_cache_lookup(ctx->request_host, &ctx->request_ip);
 
-    rtc_validated = 0;                              // Real-time clock not checked yet
+    switch (rc)
+        {
+        case DNS_CACHE_FOUND:
+        case DNS_CACHE_PENDING:
+            break;
 
-    if (body_max_size != 0)
-        post_state.body_buf_size = body_max_size;
-    else
-        post_state.body_buf_size = DEF_BODY_BUF_SIZE;
+        case DNS_CACHE_START_ERR:
+            ctx->error_str = "Error starting resolve";
+            break;
 
-    post_state.body_buf = (char far *) xalloc(post_state.body_buf_size);
+        case DNS_CACHE_NOT_FOUND:
+            ctx->error_str = "Resolve failed - host name does not exist";
+            break;
 
-    if (!post_state.body_buf)
-        {
-        report(PROBLEM, "Failed to allocate body_buf storage (%u bytes)",
-                         post_state.body_buf_size);
-        return -1;
+        default:
+            ctx->error_str = "Error during resolve";
+            break;
         }
 
-    report(DETAIL, "Allocated body_buf storage (%u bytes at %06lX)",
-                    post_state.body_buf_size, (long) post_state.body_buf);
-
-    post_state.body_buf[0] = '\0';                  // Zero-length string in xmem buffer
+    if (rc < 0)
+        report(PROBLEM, ctx->error_str);
 
-    return 0;
+    return rc;
     }
 
 
-// Sets up server details for POST state machine
-// Invokes proxy if proxy_host/proxy_port are non-zero
-// Invalidates any cached DNS result for IP address
-// Returns 0 if okay, < 0 if a string parameter is invalid
+// Internal function checks whether socket left open by last POST can be re-used
+// Closes socket if it has expired, been closed by the server or has received
+// unexpected data while idle (including any left over from the last response)
+// Returns 1 if socket can be re-used, or 0 if not
 
-int post_set_server(char * host, word port, char * path, char * proxy_host, word proxy_port)
+static int post_check_idle(PostCtx_t * ctx)
     {
-    int len;
+    if (!ctx->sock_idle)
+        return 0;
 
-    post_state.servers_set = 0;         // Assume failure
+    if (CHK_TIMEOUT_UI_SECS(ctx->idle_timeout))
+        report(DETAIL, "Idle connection expired");
+    else if (!tcp_tick(&ctx->socket) || !sock_established(&ctx->socket))
+        report(DETAIL, "Idle connection closed by server");
+    else if (sock_bytesready(&ctx->socket) != -1 ||
+             ctx->rx_pos < ctx->rx_len)
+        report(PROBLEM, "Unexpected data on idle connection");
+    else
+        return 1;
 
-    post_state.cached_ip = 0L;          // Invalidate any cached IP address
+    post_cleanup(ctx);
+    return 0;
+    }
 
-    if ((len = strlen(host)) == 0 || len > MAX_HOST_LEN)
-        return -1;
 
-    if ((len = strlen(path)) == 0 || len > MAX_PATH_LEN)
-        return -2;
+// Internal function starts POST again on a fresh connection if a re-used
+// connection has failed before any response was received from the server
+// (i.e. server closed the connection just as it was re-used)
+// Returns 1 if POST has been restarted, or 0 if not
 
-    post_state.server_host = host;
-    post_state.server_path = path;
-    post_state.server_port = port;
+static int post_reconnect(PostCtx_t * ctx)
+    {
+    if (!ctx->sock_reused || ctx->state > POST_READING_STATUS)
+        return 0;
 
-    if (proxy_host != NULL)
-        {
-        if ((len = strlen(proxy_host)) == 0 || len > MAX_HOST_LEN)
-            return -3;
+    report(DETAIL, "Re-used connection failed - reconnecting");
 
-        post_state.request_host = proxy_host;
+    post_cleanup(ctx);
 
-        post_state.abs_uri_prefix = "http://";
-        post_state.abs_uri_host = host;
-        }
-    else        // No proxy
-        {
-        post_state.request_host = host;
+    ctx->sock_reused = 0;
+    ctx->state = POST_STARTING;
+    ctx->condition = POST_PENDING;
+    start_times(ctx);
+    RESET_TIMEOUT();
+    return 1;
+    }
 
-        post_state.abs_uri_prefix = "";
-        post_state.abs_uri_host = "";
-        }
 
-    if (proxy_port != 0)
-        post_state.request_port = proxy_port;
-    else
-        post_state.request_port = port;
+// Internal function starts timing of phase and sets its timeout (see above)
 
-    post_state.servers_set = 1;
-    return 0;
-    }
+static void start_phase(PostCtx_t * ctx, unsigned char phase)
+    {
+    unsigned long ms;
 
+    if (ctx->srtt[phase] == 0)
+        ms = MAX_RTT_MS;
+    else
+        {
+        ms = (ctx->srtt[phase] >> SRTT_SHIFT) +
+             (ctx->rttvar[phase] >> RTTVAR_SHIFT) * RTTVAR_FACTOR;
 
-// Clears body buffer for addition of new variables
+        if (ms < rtt_min_ms[phase])
+            ms = rtt_min_ms[phase];
+        else if (ms > MAX_RTT_MS)
+            ms = MAX_RTT_MS;
 
-void post_clear_body(void)
-    {
-    post_state.body_pos = 0;
-    post_state.body_overflow = 0;
-    post_state.body_buf[0] = '\0';
+        report(DETAIL, "Timeout for phase %u is %lu ms", phase, ms);
+        }
+
+    ctx->rtt_phase = phase;
+    ctx->phase_ms = getMilliSeconds();
+    ctx->timeout = SET_TIMEOUT_UL_MS(ms);
     }
 
 
-// Adds name/value pair to body buffer with URL-encoding
-// If hexlen = 0, then value is treated as pointer to zero-terminated ASCII string
-// If hexlen > 0, then value is treated as pointer to fixed-length (hexlen) binary
-// string (i.e. may contain zeroes) for output as pairs of hexadecimal digits
-// Returns 0 on success, < 0 on error
+// Internal function ends timing of phase and updates its smoothed time and
+// mean deviation (first measurement seeds smoothed time, with half as deviation)
 
-int post_add_variable(const char * name, const char * value, unsigned int hexlen)
+static void end_phase(PostCtx_t * ctx)
     {
-    unsigned int start_pos;
-
-    if (name[0] == '\0')
-        return -2;                  // Fail if zero-length string
-
-    if (hexlen == 0 && value[0] == '\0')
-        return -3;                  // Fail if zero-length ASCII string
+    unsigned char phase;
+    unsigned long ms;
+    long err;
 
-    start_pos = post_state.body_pos;
+    phase = ctx->rtt_phase;
+    ctx->rtt_phase = RTT_NONE;
 
-    if (post_state.body_pos != 0)
-        {
-        if (add_body_char('&', 0) < 0)
-            goto no_room;
-        }
+    ms = getMilliSeconds() - ctx->phase_ms;
 
-    if (add_body_string(name) < 0 || add_body_char('=', 0) < 0)
-        goto no_room;
+    if (ms == 0)
+        ms = 1;                                 // Zero means no measurement
+    else if (ms > MAX_RTT_MS)
+        ms = MAX_RTT_MS;
 
-    if (hexlen == 0)
+    if (ctx->srtt[phase] == 0)
         {
-        if (add_body_string(value) < 0)
-            goto no_room;
+        ctx->srtt[phase] = ms << SRTT_SHIFT;
+        ctx->rttvar[phase] = (ms / 2) << RTTVAR_SHIFT;
         }
     else
         {
-        if (add_body_hexstring(value, hexlen) < 0)
-            goto no_room;
-        }
+        err = (long) ms - (long) (ctx->srtt[phase] >> SRTT_SHIFT);
 
-    return 0;
-
-    // Exception handler to restore buffer to state on entry
-    no_room:
+        ctx->srtt[phase] += err;                // Adds err / 8 to smoothed time
 
-        post_state.body_pos = start_pos;
-        post_state.body_buf[post_state.body_pos] = '\0';
+        if (err < 0)
+            err = -err;
 
-        post_state.body_overflow = 1;
+        ctx->rttvar[phase] = ctx->rttvar[phase] - (ctx->rttvar[phase] >> RTTVAR_SHIFT) + err;
+        }
 
-        return -1;
+    report(DETAIL, "Phase %u took %lu ms (smoothed %lu ms, deviation %lu ms)", phase, ms,
+                    ctx->srtt[phase] >> SRTT_SHIFT, ctx->rttvar[phase] >> RTTVAR_SHIFT);
     }
 
 
-// Checks state of body buffer overflow flag
-// Returns 0 if no overflow, !0 if overflow
+// Internal function sets POST LED colour (shown for primary destination only)
 
-int post_check_overflow(void)
+static void set_post_led(PostCtx_t * ctx, int colour)
     {
-    return post_state.body_overflow;
+    if (ctx->dest == POST_PRIMARY)
+        wx_set_leds(LED_POST, colour);
     }
 
 
-// Starts processing of POST state machine
-// Returns 0 on success
-// Returns -1 if servers not set up properly via post_set_servers
-// Returns -2 if no body text has been set up to send
+// Internal function records outcome of POST to primary destination for
+// reporting to server with next POST
 
-int post_start(void)
+static void record_error(PostCtx_t * ctx, int state_num)
     {
-    post_cleanup();
-
-    if (!post_state.servers_set)
+    if (ctx->dest == POST_PRIMARY)
         {
-        report(PROBLEM, "Cannot start - servers not set");
-        wx_set_leds(LED_POST, LED_RED);
-
-        post_state.state = POST_IDLE;
-        post_state.condition = POST_CANNOT_START;
-        return -1;
-        }
-
-    if (post_state.body_pos == 0)
-        {
-        report(PROBLEM, "Cannot start - no body text");
-        wx_set_leds(LED_POST, LED_RED);
-
-        post_state.state = POST_IDLE;
-        post_state.condition = POST_CANNOT_START;
-        return -2;
+        bb_post_error_str = ctx->error_str;
+        bb_post_error_state_num = state_num;
         }
-
-    report(DETAIL, "Starting");
-
-    wx_set_leds(LED_POST, LED_AMBER);
-
-    post_state.state = POST_STARTING;
-    post_state.condition = POST_PENDING;
-    post_state.resp_class = 0;
-    post_state.resp_result = 0;
-
-    RESET_TIMEOUT();
-    return 0;
     }
 
 
-// Aborts POST state machine immediately
-// Performs clean-up on pending DNS query or open TCP socket
+// Internal function starts POST state machine for one destination
 
-void post_abort(void)
+static void dest_start(PostCtx_t * ctx)
     {
-    report(DETAIL, "Aborting");
+    if (!post_check_idle(ctx))          // Keep idle connection for re-use
+        post_cleanup(ctx);
 
-    post_cleanup();
+    ctx->sock_reused = 0;
 
-    wx_set_leds(LED_POST, LED_RED);
+    report(DETAIL, "Starting destination %u", ctx->dest);
 
-    bb_post_error_str = "Aborted";
-    bb_post_error_state_num = -1;
+    ctx->state = POST_STARTING;
+    ctx->condition = POST_PENDING;
+    ctx->resp_class = 0;
+    ctx->resp_result = 0;
 
-    post_state.state = POST_IDLE;
-    post_state.condition = POST_ABORTED;
-    }
+    ctx->rx_part = RX_HEAD;
+    ctx->line_len = 0;
 
+    start_times(ctx);
 
-// Get current status of POST state machine (see header file)
-// 0 means activity pending, < 0 means failure, > 0 means success
-
-int post_get_status(void)
-    {
-    return post_state.condition;
-    }
-
-
-// Get class digit (1-5) from server response to last POST transaction
-// Call this routine if POST state machine exited with POST_SERVER_ERR
-// to find out failure code (e.g. 4 for 404 Not Found error)
-// 0 means no code received
-
-int post_get_resp_class(void)
-    {
-    return post_state.resp_class;
+    RESET_TIMEOUT();
     }
 
 
-// Main "tick" routine which drives POST state machine
+// Internal function drives POST state machine for one destination
 // Return value indicates current status (see header file)
 // 0 means activity pending, < 0 means failure, > 0 means success
 
-int post_tick(void)
+static int dest_tick(PostCtx_t * ctx)
     {
     int rc;
 
-    if (post_state.state == POST_IDLE)          // Nothing to do?
-        return post_state.condition;            // -- EXIT --
+    if (ctx->state == POST_IDLE)                // Nothing to do?
+        return ctx->condition;                  // -- EXIT --
 
     // If appropriate, check whether socket has closed prematurely
-    if (post_state.sock_opened && post_state.state != POST_READING_BODY)
+    // (closure while reading body is handled by get_line, and any response
+    // bytes already read from socket are parsed first)
+    if (ctx->sock_opened && ctx->state < POST_CHECKING_BODY && ctx->rx_pos >= ctx->rx_len)
         {
-        if (!tcp_tick(&post_state.socket))
+        if (!tcp_tick(&ctx->socket))
             {
-            bb_post_error_str = "Socket closed unexpectedly";
-            report(PROBLEM, "%s in state %d", bb_post_error_str, post_state.state);
-            post_state.sock_opened = 0;
-            post_state.condition = POST_CONNECTION_LOST;
+            ctx->sock_opened = 0;
+
+            if (post_reconnect(ctx))
+                return ctx->condition;              // -- EXIT --
+
+            ctx->error_str = "Socket closed unexpectedly";
+            report(PROBLEM, "%s in state %d", ctx->error_str, ctx->state);
+            ctx->condition = POST_CONNECTION_LOST;
             goto post_error;
             }
         }
 
     // Check whether timeout has occurred
-    if (CHK_TIMEOUT_UI_SECS(post_state.timeout))
+    if (CHK_TIMEOUT_UL_MS(ctx->timeout))
         {
-        bb_post_error_str = "Timed out";
-        report(PROBLEM, "%s in state %d", bb_post_error_str, post_state.state);
-        post_state.condition = POST_TIMEOUT;
+        if (ctx->rtt_phase != RTT_NONE)             // Adapted timeout?
+            {
+            report(DETAIL, "Discarding timing estimate for phase %u", ctx->rtt_phase);
+            ctx->srtt[ctx->rtt_phase] = 0;
+            ctx->rttvar[ctx->rtt_phase] = 0;
+            }
+
+        ctx->error_str = "Timed out";
+        report(PROBLEM, "%s in state %d", ctx->error_str, ctx->state);
+        ctx->condition = POST_TIMEOUT;
         goto post_error;
         }
 
     // Process current state
 
-    switch(post_state.state)
+    switch(ctx->state)
         {
         // Attempt to open connection to HTTP server
         case POST_STARTING:
 
-            if (post_state.cached_ip != 0L &&       // Use cached IP address?
-                !CHK_TIMEOUT_UI_SECS(post_state.cache_timeout))
+            if (ctx->sock_idle)                     // Re-use open connection?
                 {
-                post_state.request_ip = post_state.cached_ip;
-                post_state.state = POST_OPENING;
+                report(DETAIL, "Re-using connection to %s:%u",
+                                get_ip_string(ctx->request_ip), ctx->request_port);
+                ctx->sock_idle = 0;
+                ctx->sock_reused = 1;
+                ctx->state = POST_AWAITING_ESTAB;
                 RESET_TIMEOUT();
                 }
-            else if (check_direct_ip(post_state.request_host))
+            else if (check_direct_ip(ctx, ctx->request_host))
                 {
-                post_state.state = POST_OPENING;
+                ctx->state = POST_OPENING;
                 RESET_TIMEOUT();
                 }
             else
                 {
-                report(DETAIL, "Resolving %s", post_state.request_host);
-                post_state.dns = resolve_name_start(post_state.request_host);
-                if (post_state.dns <= 0)             // Must be 1 or greater
+                rc = lookup_request_ip(ctx);       // Use cached IP address if held
+
+                if (rc < 0)
                     {
-                    bb_post_error_str = "Error starting resolve";
-                    report(PROBLEM, "%s (%d)", bb_post_error_str, post_state.dns);
-                    post_state.condition = POST_DNS_ERR;
+                    ctx->condition = POST_DNS_ERR;
                     goto post_error;
                     }
 
-                post_state.state = POST_RESOLVING;
+                if (rc == DNS_CACHE_FOUND)
+                    mark_time(ctx, POST_PHASE_DNS);
+
+                ctx->state = (rc == DNS_CACHE_FOUND) ? POST_OPENING : POST_RESOLVING;
                 RESET_TIMEOUT();
                 }
             break;
@@ -793,242 +1231,799 @@ int post_tick(void)
         case POST_RESOLVING:
             tcp_tick(NULL);                 // Needed! (or else returns 0.0.0.0)
 
-            rc = resolve_name_check(post_state.dns, &post_state.request_ip);
+            rc = lookup_request_ip(ctx);
 
-            if (rc == RESOLVE_SUCCESS)
+            if (rc == DNS_CACHE_FOUND)
                 {
-                post_state.dns = 0;
-                post_state.cached_ip = post_state.request_ip;    // Update cache
-                post_state.cache_timeout = SET_TIMEOUT_UI_SECS(DNS_CACHE_SECS);
-                post_state.state = POST_OPENING;
+                mark_time(ctx, POST_PHASE_DNS);
+                ctx->state = POST_OPENING;
                 RESET_TIMEOUT();
                 }
-            else if (rc != RESOLVE_AGAIN)
+            else if (rc < 0)
                 {
-                if (rc == RESOLVE_FAILED)
-                    {
-                    bb_post_error_str = "Resolve failed - host name does not exist";
-                    report(PROBLEM, bb_post_error_str);
-                    }
-                else
-                    {
-                    bb_post_error_str = "Error during resolve";
-                    report(PROBLEM, "%s (%d)", bb_post_error_str, rc);
-                    }
-
-                post_state.dns = 0;
-                post_state.condition = POST_DNS_ERR;
+                ctx->condition = POST_DNS_ERR;
                 goto post_error;
                 }
             break;
 
         // Attempt to open TCP connection to server
         case POST_OPENING:
-            report(DETAIL, "Opening to %s:%u", get_ip_string(post_state.request_ip), post_state.request_port);
+            report(DETAIL, "Opening to %s:%u", get_ip_string(ctx->request_ip), ctx->request_port);
 
-            if (!tcp_open(&post_state.socket, 0, post_state.request_ip, post_state.request_port, NULL))
+            if (!tcp_open(&ctx->socket, 0, ctx->request_ip, ctx->request_port, NULL))
                 {
-                bb_post_error_str = "Error opening socket";
-                report(PROBLEM, bb_post_error_str);
-                post_state.condition = POST_SOCKET_ERR;
+                ctx->error_str = "Error opening socket";
+                report(PROBLEM, ctx->error_str);
+                ctx->condition = POST_SOCKET_ERR;
                 goto post_error;
                 }
 
-            post_state.sock_opened = 1;
-            sock_mode(&post_state.socket, TCP_MODE_ASCII);
-            post_state.state = POST_AWAITING_ESTAB;
-            RESET_TIMEOUT();
+            ctx->sock_opened = 1;
+            ctx->rx_len = 0;
+            ctx->rx_pos = 0;
+            sock_mode(&ctx->socket, TCP_MODE_BINARY);
+            ctx->state = POST_AWAITING_ESTAB;
+            start_phase(ctx, RTT_CONNECT);
             break;
 
         // Wait for connection to be established
         case POST_AWAITING_ESTAB:
-            if (sock_established(&post_state.socket))
+            if (sock_established(&ctx->socket))
                 {
-                report(DETAIL, "Connected");
+                report(DETAIL, "Connected to destination %u", ctx->dest);
 
-                sprintf(post_state.cmd_buf, post_fmt,
-                        post_state.abs_uri_prefix, post_state.abs_uri_host,
-                        post_state.server_path, post_state.server_host,
-                        post_state.server_port, post_state.body_pos);
+                if (ctx->rtt_phase == RTT_CONNECT)
+                    end_phase(ctx);
 
-                report(DETAIL, "Sending command header:");
-                report(RAW_DETAIL, "%s", post_state.cmd_buf);
-
-                post_state.msg_len = strlen(post_state.cmd_buf);
-                post_state.msg_pos = 0;
+                if (ctx->sock_reused)
+                    ctx->mark_ms = getMilliSeconds();   // Connection not timed
+                else
+                    mark_time(ctx, POST_PHASE_CONNECT);
 
-                post_state.state = POST_SENDING_COMMAND;
-                RESET_TIMEOUT();
-                }
-            break;
+                set_content_length(ctx, post_body.body_pos);
 
-        // Send command to server
-        case POST_SENDING_COMMAND:
-            switch(send_message(post_state.cmd_buf))
-                {
-                case 1:
+                if (post_body.body_type == POST_BODY_BINARY)
+                    report(DETAIL, "Sending command header and binary body (%u bytes)",
+                                    post_body.body_pos);
+                else
+                    {
                     report(DETAIL, "Sending body text:");
-                    report(RAW_DETAIL, "%ls\r\n", post_state.body_buf);
-
-                    post_state.msg_len = post_state.body_pos;
-                    post_state.msg_pos = 0;
-                    post_state.state = POST_SENDING_BODY;
-                    RESET_TIMEOUT();
-                    break;
+                    report(RAW_DETAIL, "%ls\r\n", post_body.body_buf);
+                    }
 
-                case 0:
-                    break;
+                ctx->msg_len = ctx->hdr_len + post_body.body_pos;
+                ctx->msg_pos = 0;
 
-                default:
-                    post_state.condition = POST_SEND_ERR;
-                    goto post_error;
+                ctx->state = POST_SENDING;
+                RESET_TIMEOUT();
                 }
             break;
 
-        // Send body text associated with command
-        case POST_SENDING_BODY:
-            switch(send_message(post_state.body_buf))
+        // Send command header and body text to server
+        case POST_SENDING:
+            switch(send_message(ctx))
                 {
                 case 1:
-                    post_state.state = POST_READING_STATUS;
-                    RESET_TIMEOUT();
+                    ctx->state = POST_READING_STATUS;
+                    start_phase(ctx, RTT_RESPONSE);
                     break;
 
                 case 0:
                     break;
 
                 default:
-                    post_state.condition = POST_SEND_ERR;
+                    if (post_reconnect(ctx))
+                        break;
+
+                    ctx->condition = POST_SEND_ERR;
                     goto post_error;
                 }
             break;
 
         // Wait for status message in response
         case POST_READING_STATUS:
-            if (get_response())             // Line received?
+            if (get_line(ctx))              // Line received?
                 {
-                if (check_resp_status() != 0)
+                if (ctx->rtt_phase == RTT_RESPONSE)
+                    end_phase(ctx);
+
+                if (check_resp_status(ctx) != 0)
                     {
-                    post_state.condition = POST_RESP_ERR;
+                    ctx->condition = POST_RESP_ERR;
                     goto post_error;
                     }
-                if (post_state.resp_class != 1 && post_state.resp_class != 2)
+                if (ctx->resp_class != 1 && ctx->resp_class != 2)
                     {
-                    bb_post_error_str = "Remote server returned error class";
-                    report(PROBLEM, "%s %d", bb_post_error_str, post_state.resp_class);
-                    post_state.condition = POST_SERVER_ERR;
+                    ctx->error_str = "Remote server returned error class";
+                    report(PROBLEM, "%s %d", ctx->error_str, ctx->resp_class);
+                    ctx->condition = POST_SERVER_ERR;
                     goto post_error;
                     }
 
-                report(DETAIL, "Remote server returned class %d", post_state.resp_class);
-                post_state.state = POST_READING_HEADERS;
+                report(DETAIL, "Remote server returned class %d", ctx->resp_class);
+                ctx->state = POST_READING_HEADERS;
                 RESET_TIMEOUT();
                 }
             break;
 
         // Read headers of response
         case POST_READING_HEADERS:
-            if (get_response())             // Line received?
+            if (get_line(ctx))              // Line received?
                 {
-                if (!post_state.cmd_buf[0])         // Blank line?
+                if (!ctx->cmd_buf[0])               // Blank line?
                     {
                     report(DETAIL, "End of headers found");
 
-                    if (post_state.resp_class == 1)     // Was 1XX Continue
+                    if (ctx->resp_class == 1)           // Was 1XX Continue
                         {
-                        post_state.state = POST_READING_STATUS;
+                        ctx->state = POST_READING_STATUS;
                         RESET_TIMEOUT();
                         }
                     else                                // Was 2XX OK
                         {
-                        post_state.state = POST_CHECKING_BODY;
+                        start_body(ctx);
+                        ctx->state = POST_CHECKING_BODY;
                         RESET_TIMEOUT();
                         }
                     }
+                else
+                    check_resp_header(ctx);
                 }
             break;
 
         // Check body of response for success response
         case POST_CHECKING_BODY:
-            if (get_response())             // Response line received?
+            if (get_line(ctx))              // Response line received?
                 {
-                (void) check_resp_time_t();
+                (void) check_resp_time_t(ctx);
 
-                if (check_resp_result() > 0)
+                if (check_resp_result(ctx) > 0)
                     {
-                    post_state.state = POST_READING_BODY;
+                    ctx->state = POST_READING_BODY;
                     RESET_TIMEOUT();
                     }
                 }
+            else if (ctx->rx_part == RX_DONE)
+                {
+                ctx->error_str = "Response message not found in body";
+                report(PROBLEM, ctx->error_str);
+                ctx->condition = POST_RESP_ERR;
+                goto post_error;
+                }
             break;
 
-        // Read body of response until socket is closed (content is ignored)
+        // Read rest of response body (content is ignored) until end of body
+        // (if length is known or body is chunked) or until socket is closed
         case POST_READING_BODY:
-            if (!tcp_tick(&post_state.socket))      // Socket closed?
-                {
-                report(DETAIL, "Connection closed");
+            while (get_line(ctx))           // Receive lines
+                ;
 
-                post_state.sock_opened = 0;
+            if (ctx->rx_part != RX_DONE)
+                break;                      // Still pending
 
-                switch(post_state.resp_result)
-                    {
-                    case RESP_SUCCESS:
-                        break;                      // Nothing to do
-
-                    case RESP_BAD_ID:
-                        bb_post_error_str = "Station ID rejected by server";
-                        report(PROBLEM, bb_post_error_str);
-                        post_state.condition = POST_BAD_ID;
-                        goto post_error;
-
-                    case RESP_BAD_DATA:
-                        report(PROBLEM, "Server reported invalid data from sensor suite");
-                        wx_set_leds(LED_DAVIS, LED_OFF);        // SPECIAL CASE!
-                        break;
+            if (ctx->sock_opened)
+                report(DETAIL, "End of body");
 
-                    case RESP_REJECTED:
-                    default:
-                        bb_post_error_str = "Transaction rejected by server";
-                        report(PROBLEM, bb_post_error_str);
-                        post_state.condition = POST_REJECTED;
-                        goto post_error;
-                    }
+            switch(ctx->resp_result)
+                {
+                case RESP_SUCCESS:
+                    break;                      // Nothing to do
+
+                case RESP_BAD_ID:
+                    ctx->error_str = "Station ID rejected by server";
+                    report(PROBLEM, ctx->error_str);
+                    ctx->condition = POST_BAD_ID;
+                    goto post_error;
 
-                wx_set_leds(LED_POST, LED_GREEN);
+                case RESP_BAD_DATA:
+                    report(PROBLEM, "Server reported invalid data from sensor suite");
+                    wx_set_leds(LED_DAVIS, LED_OFF);        // SPECIAL CASE!
+                    break;
 
-                bb_post_error_str = "Succeeded";
-                bb_post_error_state_num = post_state.state;
+                case RESP_REJECTED:
+                default:
+                    ctx->error_str = "Transaction rejected by server";
+                    report(PROBLEM, ctx->error_str);
+                    ctx->condition = POST_REJECTED;
+                    goto post_error;
+                }
 
-                post_state.state = POST_IDLE;
-                post_state.condition = POST_SUCCESS;
-                return post_state.condition;        // -- EXIT --
+            if (ctx->sock_opened && ctx->keep_alive)
+                {
+                report(DETAIL, "Keeping connection open for up to %u secs",
+                                ctx->idle_secs);
+                ctx->sock_idle = 1;
+                ctx->idle_timeout = SET_TIMEOUT_UI_SECS(ctx->idle_secs);
                 }
+            else
+                post_cleanup(ctx);
 
-            (void) get_response();          // Receive line
-            break;
+            mark_time(ctx, POST_PHASE_CLOSE);
+            save_times(ctx);
+
+            set_post_led(ctx, LED_GREEN);
+
+            ctx->error_str = "Succeeded";
+            record_error(ctx, ctx->state);
+
+            ctx->state = POST_IDLE;
+            ctx->condition = POST_SUCCESS;
+            return ctx->condition;                  // -- EXIT --
 
         // Undefined state value
         default:
-            bb_post_error_str = "Bad state encountered";
-            report(PROBLEM, bb_post_error_str);
-            post_state.condition = POST_BAD_STATE;
+            ctx->error_str = "Bad state encountered";
+            report(PROBLEM, ctx->error_str);
+            ctx->condition = POST_BAD_STATE;
             goto post_error;
         }
 
     // Pending states fall out of bottom of switch() block here
 
-    post_state.condition = POST_PENDING;
-    return post_state.condition;                    // -- EXIT --
+    ctx->condition = POST_PENDING;
+    return ctx->condition;                          // -- EXIT --
 
     // POST error handler
     post_error:
-        post_cleanup();
+        post_cleanup(ctx);
+        set_post_led(ctx, LED_RED);
+
+        save_times(ctx);
+        record_error(ctx, ctx->state);
+
+        if (ctx->state == POST_OPENING || ctx->state == POST_AWAITING_ESTAB)
+            dns_cache_fail(ctx->request_host, ctx->request_ip);     // Try next address
+
+        ctx->state = POST_IDLE;
+        return ctx->condition;                      // -- EXIT --
+    }
+
+
+// Internal function gives up POST to destination other than primary that is
+// still pending after the primary has finished
+
+static void dest_give_up(PostCtx_t * ctx)
+    {
+    ctx->error_str = "Given up after primary finished";
+    report(PROBLEM, "%s (destination %u)", ctx->error_str, ctx->dest);
+
+    post_cleanup(ctx);
+
+    if (ctx->state == POST_OPENING || ctx->state == POST_AWAITING_ESTAB)
+        dns_cache_fail(ctx->request_host, ctx->request_ip);     // Try next address
+
+    ctx->state = POST_IDLE;
+    ctx->condition = POST_ABORTED;
+    }
+
+
+// *** EXTERNAL FUNCTIONS ***
+
+// Initialise POST state machines and allocate body and header buffers
+// (must only be called once at start-up of application)
+// Returns 0 on success, < 0 if unable to allocate buffer
+
+int post_init(unsigned int body_max_size)
+    {
+    unsigned char i;
+
+    memset(post_ctx, 0, sizeof(post_ctx));          // First, clear all state variables
+    memset(&post_body, 0, sizeof(post_body));
+    memset(&post_stats, 0, sizeof(post_stats));
+
+    rtc_validated = 0;                              // Real-time clock not checked yet
+
+    if (body_max_size != 0)
+        post_body.body_buf_size = body_max_size;
+    else
+        post_body.body_buf_size = DEF_BODY_BUF_SIZE;
+
+    post_body.body_buf = (char far *) xalloc(post_body.body_buf_size);
+
+    if (!post_body.body_buf)
+        {
+        report(PROBLEM, "Failed to allocate body_buf storage (%u bytes)",
+                         post_body.body_buf_size);
+        return -1;
+        }
+
+    report(DETAIL, "Allocated body_buf storage (%u bytes at %06lX)",
+                    post_body.body_buf_size, (long) post_body.body_buf);
+
+    post_body.body_buf[0] = '\0';                   // Zero-length string in xmem buffer
+
+    for (i = 0; i < POST_MAX_DESTS; ++i)
+        {
+        post_ctx[i].dest = i;
+        post_ctx[i].condition = POST_NOT_STARTED;
+        post_ctx[i].cmd_buf[0] = '\0';              // Zero-length string in near buffer
+        post_ctx[i].rtt_phase = RTT_NONE;           // No phase timing (or estimates) yet
+
+        post_ctx[i].hdr_buf = (char far *) xalloc(HDR_BUF_SIZE);
+
+        if (!post_ctx[i].hdr_buf)
+            {
+            report(PROBLEM, "Failed to allocate hdr_buf storage (%u bytes)", HDR_BUF_SIZE);
+            return -2;
+            }
+        }
+
+    dns_cache_init();
+
+    return 0;
+    }
+
+
+// Sets up server details for a destination and formats its command header
+// (only the primary destination is needed; other destinations are used if set)
+// Invokes proxy if proxy_host/proxy_port are non-zero
+// Invalidates any cached DNS result for IP address and closes any idle connection
+// Returns 0 if okay, < 0 if destination or a string parameter is invalid or
+// header cannot be formatted
+
+int post_set_server(unsigned char dest, char * host, word port, char * path,
+                    char * proxy_host, word proxy_port)
+    {
+    PostCtx_t * ctx;
+    int len;
+
+    if (dest >= POST_MAX_DESTS)
+        return -5;
+
+    ctx = &post_ctx[dest];
+
+    ctx->servers_set = 0;               // Assume failure
+
+    if (ctx->request_host != NULL)
+        dns_cache_flush(ctx->request_host);     // Invalidate any cached IP address
+
+    if (ctx->sock_idle)
+        post_cleanup(ctx);              // Connection may be to old server
+
+    memset(ctx->srtt, 0, sizeof(ctx->srtt));        // Timing estimates were for old server
+    memset(ctx->rttvar, 0, sizeof(ctx->rttvar));
+
+    if ((len = strlen(host)) == 0 || len > MAX_HOST_LEN)
+        return -1;
+
+    if ((len = strlen(path)) == 0 || len > MAX_PATH_LEN)
+        return -2;
+
+    ctx->server_host = host;
+    ctx->server_path = path;
+    ctx->server_port = port;
+
+    if (proxy_host != NULL)
+        {
+        if ((len = strlen(proxy_host)) == 0 || len > MAX_HOST_LEN)
+            return -3;
+
+        ctx->request_host = proxy_host;
+
+        ctx->abs_uri_prefix = "http://";
+        ctx->abs_uri_host = host;
+        }
+    else        // No proxy
+        {
+        ctx->request_host = host;
+
+        ctx->abs_uri_prefix = "";
+        ctx->abs_uri_host = "";
+        }
+
+    dns_cache_flush(ctx->request_host);
+
+    if (proxy_port != 0)
+        ctx->request_port = proxy_port;
+    else
+        ctx->request_port = port;
+
+    ctx->servers_set = 1;
+
+    build_header(ctx);
+
+    if (ctx->hdr_len == 0)
+        {
+        ctx->servers_set = 0;
+        return -4;
+        }
+
+    return 0;
+    }
+
+
+// Selects format of body for subsequent POSTs (see header file)
+// Body buffer is cleared and command headers are formatted again for new type
+
+void post_set_body_type(unsigned char type)
+    {
+    unsigned char i;
+
+    post_body.body_type = (type == POST_BODY_BINARY) ? POST_BODY_BINARY : POST_BODY_FORM;
+
+    post_clear_body();
+
+    for (i = 0; i < POST_MAX_DESTS; ++i)
+        build_header(&post_ctx[i]);
+    }
+
+
+// Clears body buffer for addition of new variables
+
+void post_clear_body(void)
+    {
+    post_body.body_pos = 0;
+    post_body.body_overflow = 0;
+    post_body.body_buf[0] = '\0';
+    }
+
+
+// Adds name/value pair to body buffer with URL-encoding
+// If hexlen = 0, then value is treated as pointer to zero-terminated ASCII string
+// If hexlen > 0, then value is treated as pointer to fixed-length (hexlen) binary
+// string (i.e. may contain zeroes) for output as pairs of hexadecimal digits
+// Note: hexlen must be in range 0-32767
+// Encoded length is found first, so nothing is written if there is not enough room
+// For binary body, pair is added as a POST_TAG_NAMED field (value unencoded)
+// Returns 0 on success, < 0 on error
+
+int post_add_variable(const char * name, const char * value, unsigned int hexlen)
+    {
+    unsigned int start_pos;
+    unsigned int name_len;
+    unsigned int value_len;
+    unsigned long total_len;
+    char far * body_ptr;
+
+    if (name[0] == '\0')
+        return -2;                  // Fail if zero-length string
+
+    if (hexlen == 0 && value[0] == '\0')
+        return -3;                  // Fail if zero-length ASCII string
+
+    start_pos = post_body.body_pos;
+
+    if (post_body.body_type == POST_BODY_BINARY)
+        {
+        name_len = strlen(name) + 1;                    // Including zero
+        value_len = (hexlen != 0) ? hexlen : strlen(value);
+
+        if (value_len > POST_MAX_FIELD_LEN - name_len)
+            return -4;
+
+        if (add_field_header(POST_TAG_NAMED, name_len + value_len) < 0 ||
+            add_body_bytes(name, name_len) < 0 ||
+            add_body_bytes(value, value_len) < 0)
+            goto no_room;
+
+        return 0;
+        }
+
+    name_len = url_enc_len(name);
+    value_len = (hexlen != 0) ? (hexlen * 2) : url_enc_len(value);
+
+    total_len = (unsigned long) name_len + 1 + value_len;   // Including '='
+
+    if (post_body.body_pos != 0)
+        ++total_len;                                        // Add '&' separator
+
+    if (post_body.body_pos + total_len >= post_body.body_buf_size)
+        goto no_room;                       // No room (including zero terminator)
+
+    body_ptr = post_body.body_buf + post_body.body_pos;
+
+    if (post_body.body_pos != 0)
+        *body_ptr++ = '&';
+
+    body_ptr = url_enc_string(body_ptr, name);
+    *body_ptr++ = '=';
+
+    if (hexlen == 0)
+        body_ptr = url_enc_string(body_ptr, value);
+    else
+        body_ptr = url_enc_hex(body_ptr, value, hexlen);
+
+    *body_ptr = '\0';                       // Add zero terminator
+
+    post_body.body_pos += (unsigned int) total_len;
+
+    return 0;
+
+    // Exception handler to restore buffer to state on entry
+    no_room:
+
+        post_body.body_pos = start_pos;
+        post_body.body_buf[post_body.body_pos] = '\0';
+
+        post_body.body_overflow = 1;
+
+        return -1;
+    }
+
+
+// Adds binary field to body buffer (only for binary body type)
+// Value is a pointer to len bytes (may contain zeroes)
+// Returns 0 on success, < 0 on error
+
+int post_add_field(unsigned char tag, const void * value, unsigned int len)
+    {
+    unsigned int start_pos;
+
+    if (post_body.body_type != POST_BODY_BINARY)
+        return -2;                  // Fail if not binary body
+
+    if (len > POST_MAX_FIELD_LEN)
+        return -3;
+
+    start_pos = post_body.body_pos;
+
+    if (add_field_header(tag, len) < 0 ||
+        add_body_bytes((const char *) value, len) < 0)
+        {
+        post_body.body_pos = start_pos;
+        post_body.body_overflow = 1;
+        return -1;
+        }
+
+    return 0;
+    }
+
+
+// Adds number to body buffer as binary field of len bytes (up to 4), LSB-first
+// Returns 0 on success, < 0 on error
+
+int post_add_number(unsigned char tag, unsigned long value, unsigned char len)
+    {
+    unsigned char bytes[4];
+    unsigned char i;
+
+    if (len > sizeof(bytes))
+        return -4;
+
+    for (i = 0; i < len; ++i)
+        {
+        bytes[i] = (unsigned char) value;
+        value >>= 8;
+        }
+
+    return post_add_field(tag, bytes, len);
+    }
+
+
+// Checks state of body buffer overflow flag
+// Returns 0 if no overflow, !0 if overflow
+
+int post_check_overflow(void)
+    {
+    return post_body.body_overflow;
+    }
+
+
+// Starts processing of POST state machines for all destinations that are set up
+// Returns 0 on success
+// Returns -1 if primary server not set up properly via post_set_server
+// Returns -2 if no body text has been set up to send
+
+int post_start(void)
+    {
+    unsigned char i;
+
+    if (!post_ctx[POST_PRIMARY].servers_set || post_body.body_pos == 0)
+        {
+        if (!post_ctx[POST_PRIMARY].servers_set)
+            report(PROBLEM, "Cannot start - servers not set");
+        else
+            report(PROBLEM, "Cannot start - no body text");
+
         wx_set_leds(LED_POST, LED_RED);
 
-        bb_post_error_state_num = post_state.state;
+        for (i = 0; i < POST_MAX_DESTS; ++i)
+            {
+            post_ctx[i].state = POST_IDLE;
+            post_ctx[i].condition = POST_CANNOT_START;
+            }
+
+        return post_ctx[POST_PRIMARY].servers_set ? -2 : -1;
+        }
+
+    report(DETAIL, "Starting");
+
+    wx_set_leds(LED_POST, LED_AMBER);
+
+    post_grace.waiting = 0;
+
+    for (i = 0; i < POST_MAX_DESTS; ++i)
+        {
+        if (post_ctx[i].servers_set)
+            dest_start(&post_ctx[i]);
+        else
+            {
+            post_ctx[i].state = POST_IDLE;
+            post_ctx[i].condition = POST_NOT_STARTED;
+            }
+        }
+
+    return 0;
+    }
+
+
+// Aborts POST state machines immediately
+// Performs clean-up on open TCP sockets
+
+void post_abort(void)
+    {
+    PostCtx_t * ctx;
+    unsigned char i;
+
+    report(DETAIL, "Aborting");
+
+    for (i = 0; i < POST_MAX_DESTS; ++i)
+        {
+        ctx = &post_ctx[i];
+
+        post_cleanup(ctx);
+
+        ctx->error_str = "Aborted";
+        record_error(ctx, -1);
+
+        ctx->state = POST_IDLE;
+        ctx->condition = POST_ABORTED;
+        }
+
+    post_grace.waiting = 0;
+
+    wx_set_leds(LED_POST, LED_RED);
+    }
+
+
+// Closes any connections left open for re-use (e.g. so that their socket
+// buffers are available for other uses)
+
+void post_close_idle(void)
+    {
+    unsigned char i;
+
+    for (i = 0; i < POST_MAX_DESTS; ++i)
+        {
+        if (post_ctx[i].sock_idle)
+            post_cleanup(&post_ctx[i]);
+        }
+    }
+
+
+// Get current status of POST state machine for primary destination (see header file)
+// 0 means activity pending, < 0 means failure, > 0 means success
+
+int post_get_status(void)
+    {
+    return post_ctx[POST_PRIMARY].condition;
+    }
+
+
+// Get current status of POST state machine for given destination (see header file)
+// POST_NOT_STARTED if destination not set up (or not valid)
+
+int post_get_dest_status(unsigned char dest)
+    {
+    if (dest >= POST_MAX_DESTS)
+        return POST_NOT_STARTED;
+
+    return post_ctx[dest].condition;
+    }
+
+
+// Get class digit (1-5) from server response to last POST transaction
+// to primary destination
+// Call this routine if POST state machine exited with POST_SERVER_ERR
+// to find out failure code (e.g. 4 for 404 Not Found error)
+// 0 means no code received
+
+int post_get_resp_class(void)
+    {
+    return post_ctx[POST_PRIMARY].resp_class;
+    }
+
+
+// Packs timing statistics into buffer of POST_STATS_LEN bytes (see header file)
+// Returns number of bytes packed
+
+unsigned int post_pack_stats(unsigned char * buf)
+    {
+    unsigned char phase;
+    unsigned char i;
+    unsigned char n;
+    unsigned int last;
+    unsigned int t;
+    unsigned int vals[4];           // Last, minimum, average, maximum
+    unsigned long sum;
+
+    *buf++ = post_stats.count;
+
+    last = (post_stats.head + POST_STATS_WINDOW - 1) % POST_STATS_WINDOW;
+
+    for (phase = 0; phase < POST_NUM_PHASES; ++phase)
+        {
+        vals[0] = (post_stats.count != 0) ? post_stats.times[last][phase] : NO_TIME;
+        vals[1] = NO_TIME;
+        vals[3] = 0;
+        sum = 0;
+        n = 0;
+
+        for (i = 0; i < post_stats.count; ++i)
+            {
+            t = post_stats.times[i][phase];
+
+            if (t == NO_TIME)
+                continue;
+
+            if (t < vals[1])
+                vals[1] = t;
+            if (t > vals[3])
+                vals[3] = t;
+
+            sum += t;
+            ++n;
+            }
+
+        if (n != 0)
+            vals[2] = (unsigned int) ((sum + n / 2) / n);
+        else
+            vals[2] = vals[3] = NO_TIME;
+
+        for (i = 0; i < 4; ++i)
+            {
+            *buf++ = (unsigned char) vals[i];
+            *buf++ = (unsigned char) (vals[i] >> 8);
+            }
+        }
+
+    return POST_STATS_LEN;
+    }
+
+
+// Main "tick" routine which drives POST state machines for all destinations,
+// so that the body is delivered to each of them at the same time
+// Return value indicates status of primary destination (see header file)
+// once all destinations have finished, or once GRACE_MS has passed since the
+// primary finished (when any others still pending are given up)
+// 0 means activity pending, < 0 means failure, > 0 means success
+
+int post_tick(void)
+    {
+    unsigned char i;
+    int pending;
+
+    pending = 0;
+
+    for (i = 0; i < POST_MAX_DESTS; ++i)
+        {
+        if (dest_tick(&post_ctx[i]) == POST_PENDING)
+            pending = 1;
+        }
+
+    if (pending)
+        {
+        if (post_ctx[POST_PRIMARY].condition == POST_PENDING)
+            return POST_PENDING;
+
+        if (!post_grace.waiting)
+            {
+            post_grace.waiting = 1;
+            post_grace.timeout = SET_TIMEOUT_UL_MS(GRACE_MS);
+            return POST_PENDING;
+            }
+
+        if (!CHK_TIMEOUT_UL_MS(post_grace.timeout))
+            return POST_PENDING;
+
+        for (i = 0; i < POST_MAX_DESTS; ++i)
+            {
+            if (post_ctx[i].condition == POST_PENDING)
+                dest_give_up(&post_ctx[i]);
+            }
+        }
 
-        post_state.cached_ip = 0L;          // Invalidate cached IP address
+    post_grace.waiting = 0;
 
-        post_state.state = POST_IDLE;
-        return post_state.condition;                // -- EXIT --
+    return post_ctx[POST_PRIMARY].condition;
     }
@@ -30,20 +30,81 @@
 #define POST_BAD_STATE          (-13)
 
 
+// Destinations to which each POST is delivered (each uses one TCP socket)
+
+#define POST_MAX_DESTS          2
+#define POST_PRIMARY            0       // Main server (must be set up)
+#define POST_STANDBY            1       // Standby server (optional)
+
+
+// Body types (see post_set_body_type)
+
+#define POST_BODY_FORM          0       // URL-encoded form variables (name=value&...)
+#define POST_BODY_BINARY        1       // Binary fields (tag, length, value...)
+
+
+// Binary body format
+//
+// Each field is a tag byte, a length and then the value bytes.  The length
+// is one byte if below 128, or otherwise two bytes with the top bit of the
+// first byte set (e.g. 0x81 0x2C for 300).  Numbers are sent LSB-first.
+// Variables added by post_add_variable are sent as POST_TAG_NAMED fields
+// with the name, a zero byte and then the value (as raw bytes if hexlen > 0).
+
+#define POST_TAG_NAMED          0x01    // Name, zero, value
+#define POST_TAG_STATION        0x02    // Station ID (2 bytes)
+#define POST_TAG_SEQ            0x03    // Sequence number (4 bytes)
+#define POST_TAG_LOCAL_IP       0x04    // Local IP address (4 bytes, network order)
+#define POST_TAG_VERSION        0x05    // Firmware version (major, minor)
+#define POST_TAG_DATA           0x06    // Data collected from weather station
+#define POST_TAG_RECORD         0x07    // Queued record (sequence number and time,
+                                        // 4 bytes each, then data)
+
+#define POST_MAX_FIELD_LEN      0x7FFF  // Longest value in a binary field
+
+
+// Phases of a transaction timed for statistics (see post_pack_stats)
+
+#define POST_PHASE_DNS          0       // Start to IP address found (if looked up)
+#define POST_PHASE_CONNECT      1       // IP address found to connection established
+#define POST_PHASE_HEADER       2       // Connection established to header written
+#define POST_PHASE_BODY         3       // Header written to body written
+#define POST_PHASE_FIRST_BYTE   4       // Body written to first byte of response
+#define POST_PHASE_CLOSE        5       // First byte to end of response and socket
+                                        // closed (or left open for re-use)
+#define POST_NUM_PHASES         6
+
+#define POST_STATS_WINDOW       8       // Transactions covered by statistics
+
+// Length of statistics packed by post_pack_stats(): number of transactions
+// covered, then for each phase in turn the time in the last transaction and
+// the minimum, average and maximum times over those covered, as 16-bit values
+// in ms (LSB first, 0xFFFF if phase was not timed)
+
+#define POST_STATS_LEN          (1 + POST_NUM_PHASES * 4 * 2)
+
+
 // Function prototypes
 
 int post_init(unsigned int body_max_size);
-int post_set_server(char * host, word port, char * path, char * proxy_host, word proxy_port);
+int post_set_server(unsigned char dest, char * host, word port, char * path,
+                    char * proxy_host, word proxy_port);
 
+void post_set_body_type(unsigned char type);
 void post_clear_body(void);
 int post_add_variable(const char * name, const char * value, unsigned int hexlen);
+int post_add_field(unsigned char tag, const void * value, unsigned int len);
+int post_add_number(unsigned char tag, unsigned long value, unsigned char len);
 int post_check_overflow(void);
 
 int post_start(void);
 void post_abort(void);
+void post_close_idle(void);
 
 int post_get_status(void);
+int post_get_dest_status(unsigned char dest);
 int post_get_resp_class(void);
+unsigned int post_pack_stats(unsigned char * buf);
 
 int post_tick(void);
 
@@ -0,0 +1,149 @@
+// Routines to schedule retries of delivery to server
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+// After a failed delivery, the next attempt is held off for a delay that
+// grows exponentially with the number of consecutive failures, up to a cap,
+// and is chosen at random from the upper half of the current window (so
+// that it is at least half the window).  The random element stops a number
+// of units that lost the server at the same time from all retrying together
+// when it comes back.  The generator is seeded from a value that differs
+// between units (such as the station ID) and is stirred with the time of
+// each failure.
+
+
+#include "timeout.h"
+#include "retry.h"
+
+
+// Multiplier and increment for linear congruential random number generator
+
+#define RAND_MUL                1664525UL
+#define RAND_INC                1013904223UL
+
+
+// Internal structure containing state variables
+
+static struct
+    {
+    RetryState_t state;                 // Backoff state (see "retry.h")
+    unsigned int timer;                 // Time of next attempt
+    unsigned long rand_val;             // Random number generator state
+    } retry;
+
+
+// *** INTERNAL FUNCTIONS ***
+
+// Returns next random number (upper bits of generator, which are the most random)
+
+static unsigned int next_rand(void)
+    {
+    retry.rand_val = retry.rand_val * RAND_MUL + RAND_INC;
+
+    return (unsigned int) (retry.rand_val >> 16);
+    }
+
+
+// *** EXTERNAL FUNCTIONS ***
+
+// Initialise scheduler with no failures recorded
+// Seed should differ between units
+
+void retry_init(unsigned long seed)
+    {
+    retry.state.failures = 0;
+    retry.state.window_secs = 0;
+    retry.state.delay_secs = 0;
+    retry.rand_val = seed;
+    }
+
+
+// Records a failed delivery and schedules next attempt
+// Returns delay until next attempt (in seconds)
+
+unsigned int retry_failed(void)
+    {
+    unsigned int half;
+
+    if (retry.state.failures < 255)
+        ++retry.state.failures;
+
+    if (retry.state.window_secs == 0)
+        retry.state.window_secs = RETRY_BASE_SECS;
+    else if (retry.state.window_secs < RETRY_MAX_SECS / 2)
+        retry.state.window_secs *= 2;
+    else
+        retry.state.window_secs = RETRY_MAX_SECS;
+
+    retry.rand_val ^= getMilliSeconds();        // Stir in time of failure
+
+    half = retry.state.window_secs / 2;
+
+    retry.state.delay_secs = half + (next_rand() % (half + 1));
+
+    retry.timer = SET_TIMEOUT_UI_SECS(retry.state.delay_secs);
+
+    return retry.state.delay_secs;
+    }
+
+
+// Records a successful delivery, ending any backoff
+
+void retry_succeeded(void)
+    {
+    retry.state.failures = 0;
+    retry.state.window_secs = 0;
+    retry.state.delay_secs = 0;
+    }
+
+
+// Makes next attempt due immediately (keeping backoff window for any
+// further failure)
+
+void retry_now(void)
+    {
+    retry.state.delay_secs = 0;
+    }
+
+
+// Returns !0 if next attempt is being held off, or 0 if attempt may be made
+
+int retry_waiting(void)
+    {
+    if (retry.state.delay_secs == 0)
+        return 0;
+
+    if (CHK_TIMEOUT_UI_SECS(retry.timer))
+        {
+        retry.state.delay_secs = 0;             // Delay has now passed
+        return 0;
+        }
+
+    return 1;
+    }
+
+
+// Returns number of seconds until next attempt may be made (0 if now)
+
+unsigned int retry_secs_left(void)
+    {
+    if (!retry_waiting())
+        return 0;
+
+    return retry.timer - (unsigned int) getSeconds();
+    }
+
+
+// Copies backoff state to given structure
+
+void retry_get_state(RetryState_t * state)
+    {
+    (void) retry_waiting();                     // Bring delay up to date
+
+    *state = retry.state;
+    }
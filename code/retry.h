@@ -0,0 +1,37 @@
+// Header file for routines to schedule retries of delivery to server
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+#ifndef RETRY_H
+#define RETRY_H
+
+// Backoff limits (in seconds)
+
+#define RETRY_BASE_SECS         30      // Backoff window after first failure
+#define RETRY_MAX_SECS          960     // Backoff window is capped here
+
+// Structure definitions
+
+typedef struct
+    {
+    unsigned char failures;             // Consecutive failures (0 if not backing off)
+    unsigned int window_secs;           // Current backoff window
+    unsigned int delay_secs;            // Delay chosen in window (0 once attempt is due)
+    } RetryState_t;
+
+// Function prototypes
+
+void retry_init(unsigned long seed);
+unsigned int retry_failed(void);
+void retry_succeeded(void);
+void retry_now(void);
+int retry_waiting(void);
+unsigned int retry_secs_left(void);
+void retry_get_state(RetryState_t * state);
+
+#endif
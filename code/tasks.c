@@ -10,11 +10,17 @@
 #include <stdio.h>
 #include <dcdefs.h>
 #include <string.h>
+#include <time.h>
 #include "timeout.h"
 #include "wx_board.h"
 #include "lan.h"
 #include "post_client.h"
+#include "dns_cache.h"
 #include "davis.h"
+#include "aggregate.h"
+#include "delta.h"
+#include "outq.h"
+#include "retry.h"
 #include "report.h"
 #include "eeprom.h"
 #include "bb_vars.h"
@@ -44,6 +50,8 @@ enum state_value
     TASKS_DELIVERING,
     TASKS_TIME_CHECKING,
     TASKS_TIME_SETTING,
+    TASKS_ARCHIVING,
+    TASKS_SAMPLING,
     };
 
 
@@ -53,13 +61,34 @@ static struct
     {
     enum state_value state;             // Current state (see definition above)
     unsigned int collect_tmr;           // Time between data collection attempts
+    unsigned int sample_tmr;            // Time between samples for aggregation
     unsigned long time_chk_tmr;         // Time between weather station time checks
 
     unsigned char new_data;             // Flag indicates new data was collected
+    unsigned long data_time;            // RTC time of collection (0 if not known)
     unsigned char collect_err_ctr;      // Counts consecutive collection failures
 
     unsigned char post_err_ctr;         // Counts consecutive POST failures
 
+    unsigned char time_chk_batched;     // Flag indicates time check follows collection
+    unsigned char set_time_due;         // Flag indicates clock needs to be reset
+
+    char far * arch_buf;                // Pointer to xmem queue of archive records
+    unsigned int arch_head;             // Index of oldest record in queue
+    unsigned int arch_count;            // Number of records in queue
+    unsigned char arch_sending;         // Number of records in POST being delivered
+
+    unsigned char outq_sending;         // Number of queued records in POST being delivered
+    unsigned char backlog_only;         // Flag indicates POST carries only queued records
+
+    AggResult_t agg_result;             // Samples aggregated up to last collection
+
+    unsigned char key_data[DAV_DATA_LEN];   // Last full packet delivered (keyframe)
+    unsigned long key_seq;              // Sequence number of POST with keyframe
+    unsigned char key_valid;            // Flag indicates keyframe is held
+    unsigned char key_age;              // Delta-encoded packets sent since keyframe
+    unsigned char sending_key;          // Flag indicates POST carries full packet
+
     } tasks_state;
 
 
@@ -69,15 +98,85 @@ static struct
 #define FAST_COLLECT_SECS       60
 #define SLOW_COLLECT_SECS       300
 
+#define SAMPLE_SECS             10          // Between samples for aggregation
+
 #define INIT_TIME_CHK_SECS      120
 #define BACKOFF_TIME_CHK_SECS   300
 #define NEXT_TIME_CHK_SECS      86400L      // 86,400 = 24 * 60 * 60
 
 
 // Maximum consecutive errors before forced reset
+// (POST errors do not force a reset, as the "retry" module paces them and
+// its state would be lost on reset)
 
 #define MAX_COLLECT_ERRS        10
-#define MAX_POST_ERRS           10
+
+
+// Size of xmem queue for archive records downloaded after an outage
+// and maximum number of records sent in each POST
+
+#define ARCH_QUEUE_RECS         288         // 1 day at 5 minute archive interval
+#define ARCH_RECS_PER_POST      8
+
+
+// Maximum number of records from queue of undelivered data sent in each POST
+// (see "outq.h")
+
+#define OUTQ_RECS_PER_POST      6
+
+
+// Size of POST body buffer (room for a full set of queued records, about 240
+// bytes each, on top of the normal contents)
+
+#define POST_BODY_SIZE          3072
+
+
+// Encoding of collected data in POST body (may be overridden on compiler
+// command line): 0 sends the full packet every time, 1 sends packets delta-
+// encoded against the last full packet delivered (needs support at server)
+
+#ifndef DELTA_UPLOAD
+#define DELTA_UPLOAD            0
+#endif
+
+
+// Format of POST body (may be overridden on compiler command line): 0 sends
+// URL-encoded form variables, 1 sends binary fields (see "post_client.h") with
+// numbers and data unencoded (needs support at server)
+
+#ifndef BINARY_UPLOAD
+#define BINARY_UPLOAD           0
+#endif
+
+
+// Standby server to which each POST is also delivered at the same time (may be
+// overridden on compiler command line): "" for none, otherwise host name (with
+// port, path and any proxy as for the main server)
+
+#ifndef STANDBY_HOST
+#define STANDBY_HOST            ""
+#endif
+
+
+// Number of POSTs between each one carrying weather station timing statistics
+// (may be overridden on compiler command line, 0 = never sent)
+
+#ifndef DAV_STATS_POSTS
+#define DAV_STATS_POSTS         0
+#endif
+
+
+// Number of POSTs between each one carrying timing statistics for phases of
+// previous POSTs (may be overridden on compiler command line, 0 = never sent)
+
+#ifndef POST_STATS_POSTS
+#define POST_STATS_POSTS        1
+#endif
+
+
+// Mask for sequence numbers sent in POST body (see add_seq_num)
+
+#define SEQ_NUM_MSK             0x7FFFFFFFUL
 
 
 // *** INTERNAL FUNCTIONS ***
@@ -98,13 +197,16 @@ static int check_str_len(const char * str, unsigned int too_long)
     }
 
 
-// Add station ID to POST body text in decimal format
+// Add station ID to POST body text in decimal format (or binary field)
 // Returns 0 if okay, < 0 if ran out of space
 
 static int add_station_id(void)
     {
     char buffer[6];             // Up to 5 chars plus zero for unsigned values
 
+    if (BINARY_UPLOAD)
+        return post_add_number(POST_TAG_STATION, get_station_id(), 2);
+
     sprintf(buffer, "%u", get_station_id());
 
     return post_add_variable("station", buffer, 0);
@@ -112,14 +214,297 @@ static int add_station_id(void)
 
 
 // Add collected data (or error string if not collected) to POST body text
+// In delta mode, data is sent as "delta" (see "delta.h") along with the
+// sequence number of the keyframe as "kseq", unless a full packet is due
+// (no keyframe held, too many deltas since keyframe, or no saving)
 // Returns 0 if okay, < 0 if ran out of space
 
 static int add_collected_data(void)
     {
-    if (tasks_state.new_data)
-        return post_add_variable("data", dav_data, DAV_DATA_LEN);
-    else
+    static unsigned char delta_buf[DELTA_MAX_LEN(DAV_DATA_LEN)];
+    unsigned int delta_len;
+    char buffer[11];            // Up to 10 chars plus zero for unsigned long values
+    int status;
+
+    if (!tasks_state.new_data)
         return post_add_variable("sererr", dav_error_str, 0);
+
+    if (DELTA_UPLOAD && tasks_state.key_valid &&
+                        tasks_state.key_age < DELTA_KEYFRAME_POSTS)
+        {
+        delta_len = delta_encode(tasks_state.key_data, dav_data, DAV_DATA_LEN,
+                                 delta_buf);
+
+        if (delta_len < DAV_DATA_LEN)
+            {
+            sprintf(buffer, "%lu", (tasks_state.key_seq & SEQ_NUM_MSK));
+
+            status = post_add_variable("kseq", buffer, 0);
+            if (status < 0)
+                return status;
+
+            ++tasks_state.key_age;
+
+            report(DETAIL, "Data delta-encoded as %u bytes", delta_len);
+
+            return post_add_variable("delta", (char *) delta_buf, delta_len);
+            }
+        }
+
+    tasks_state.sending_key = 1;
+
+    if (BINARY_UPLOAD)
+        return post_add_field(POST_TAG_DATA, dav_data, DAV_DATA_LEN);
+
+    return post_add_variable("data", dav_data, DAV_DATA_LEN);
+    }
+
+
+// Add statistic to POST body text as "min,max,mean" in decimal format
+// (nothing is added if there were no valid samples)
+// Returns 0 if okay, < 0 if ran out of space
+
+static int add_agg_stat(const char * name, const AggStat_t * stat)
+    {
+    char buffer[21];            // Up to 3 x 6 chars plus commas and zero
+
+    if (stat->count == 0)
+        return 0;
+
+    sprintf(buffer, "%d,%d,%d", stat->min, stat->max, stat->mean);
+
+    return post_add_variable(name, buffer, 0);
+    }
+
+
+// Add results aggregated from samples since previous collection to POST body
+// text in decimal format (wind is "mean speed x 10,gust,gust dir,vector dir")
+// Returns 0 if okay, < 0 if ran out of space
+
+static int add_aggregate_data(void)
+    {
+    const AggResult_t * result;
+    char buffer[18];            // Up to 4 + 3 + 3 + 3 chars plus commas and zero
+    int status;
+
+    result = &tasks_state.agg_result;
+
+    if (result->samples == 0)
+        return 0;
+
+    sprintf(buffer, "%u", result->samples);
+
+    status = post_add_variable("aggn", buffer, 0);
+    if (status < 0)
+        return status;
+
+    status = add_agg_stat("aggot", &result->out_temp);
+    if (status < 0)
+        return status;
+
+    status = add_agg_stat("aggit", &result->in_temp);
+    if (status < 0)
+        return status;
+
+    status = add_agg_stat("aggbar", &result->barometer);
+    if (status < 0)
+        return status;
+
+    if (result->wind_count == 0)
+        return 0;
+
+    sprintf(buffer, "%u,%u,%u,%u", result->wind_mean, result->gust_speed,
+                                   result->gust_dir, result->wind_dir);
+
+    return post_add_variable("aggwind", buffer, 0);
+    }
+
+
+// Adds sample decoded from data just collected to current aggregation interval
+
+static void add_sample(void)
+    {
+    DavSample_t sample;
+
+    if (dav_get_sample(&sample))
+        agg_add_sample(&sample);
+    }
+
+
+// Adds archive record to end of xmem queue
+// Returns 0 if okay, or -1 if queue is full
+
+static int arch_queue_add(const unsigned char * rec)
+    {
+    char far * ptr;
+    unsigned int slot;
+    unsigned char i;
+
+    if (tasks_state.arch_count >= ARCH_QUEUE_RECS)
+        return -1;
+
+    slot = tasks_state.arch_head + tasks_state.arch_count;
+    if (slot >= ARCH_QUEUE_RECS)
+        slot -= ARCH_QUEUE_RECS;
+
+    ptr = tasks_state.arch_buf + (slot * DAV_ARCH_REC_LEN);
+
+    for (i = 0; i < DAV_ARCH_REC_LEN; ++i)
+        *ptr++ = *rec++;
+
+    ++tasks_state.arch_count;
+    return 0;
+    }
+
+
+// Copies archive record from xmem queue (index 0 is oldest record)
+
+static void arch_queue_get(unsigned int index, unsigned char * rec)
+    {
+    char far * ptr;
+    unsigned int slot;
+    unsigned char i;
+
+    slot = tasks_state.arch_head + index;
+    if (slot >= ARCH_QUEUE_RECS)
+        slot -= ARCH_QUEUE_RECS;
+
+    ptr = tasks_state.arch_buf + (slot * DAV_ARCH_REC_LEN);
+
+    for (i = 0; i < DAV_ARCH_REC_LEN; ++i)
+        *rec++ = *ptr++;
+    }
+
+
+// Removes oldest records from xmem queue
+
+static void arch_queue_drop(unsigned int count)
+    {
+    if (count > tasks_state.arch_count)
+        count = tasks_state.arch_count;
+
+    tasks_state.arch_head += count;
+    if (tasks_state.arch_head >= ARCH_QUEUE_RECS)
+        tasks_state.arch_head -= ARCH_QUEUE_RECS;
+
+    tasks_state.arch_count -= count;
+    }
+
+
+// Add archive records being backfilled to POST body text
+// Records are sent as hex strings named "arch1", "arch2", etc.
+// Returns 0 if okay, < 0 if ran out of space
+
+static int add_archive_data(void)
+    {
+    unsigned char rec[DAV_ARCH_REC_LEN];
+    char name[8];
+    unsigned char i;
+    int status;
+
+    for (i = 0; i < tasks_state.arch_sending; ++i)
+        {
+        arch_queue_get(i, rec);
+
+        sprintf(name, "arch%u", i + 1);
+
+        status = post_add_variable(name, (char *) rec, DAV_ARCH_REC_LEN);
+        if (status < 0)
+            return status;
+        }
+
+    return 0;
+    }
+
+
+// Add queued records of data not delivered earlier to POST body text
+// Records are sent as hex strings named "data1", "data2", etc. with the
+// sequence number of the POST in which each was first sent as "dseq1",
+// "dseq2", etc. and (if known) its collection time as "dtime1", "dtime2", etc.
+// For binary body, each record is sent as a single field instead
+// Damaged records are left out (but are still removed after delivery)
+// Returns 0 if okay, < 0 if ran out of space
+
+static int add_queued_data(void)
+    {
+    OutqRec_t rec;
+    char name[8];
+    char buffer[11];            // Up to 10 chars plus zero for unsigned long values
+    unsigned char field[8 + DAV_DATA_LEN];
+    unsigned char i;
+    unsigned char j;
+    unsigned char n;
+    int status;
+
+    n = 0;
+
+    for (i = 0; i < tasks_state.outq_sending; ++i)
+        {
+        if (outq_get(i, &rec) < 0)
+            {
+            report(PROBLEM, "Queued record %u is damaged - skipped", i);
+            continue;
+            }
+
+        ++n;
+
+        if (BINARY_UPLOAD)
+            {
+            for (j = 0; j < 4; ++j)             // Numbers are sent LSB-first
+                {
+                field[j] = (unsigned char) ((rec.seq & SEQ_NUM_MSK) >> (j * 8));
+                field[4 + j] = (unsigned char) (rec.time >> (j * 8));
+                }
+
+            memcpy(&field[8], rec.data, DAV_DATA_LEN);
+
+            status = post_add_field(POST_TAG_RECORD, field, sizeof(field));
+            if (status < 0)
+                return status;
+
+            continue;
+            }
+
+        sprintf(name, "data%u", n);
+
+        status = post_add_variable(name, (char *) rec.data, DAV_DATA_LEN);
+        if (status < 0)
+            return status;
+
+        sprintf(name, "dseq%u", n);
+        sprintf(buffer, "%lu", (rec.seq & SEQ_NUM_MSK));
+
+        status = post_add_variable(name, buffer, 0);
+        if (status < 0)
+            return status;
+
+        if (rec.time != 0UL)
+            {
+            sprintf(name, "dtime%u", n);
+            sprintf(buffer, "%lu", rec.time);
+
+            status = post_add_variable(name, buffer, 0);
+            if (status < 0)
+                return status;
+            }
+        }
+
+    return 0;
+    }
+
+
+// Selects number of queued records to send in next POST
+
+static void select_queued_data(void)
+    {
+    unsigned int count;
+
+    count = outq_count();
+
+    if (count < OUTQ_RECS_PER_POST)
+        tasks_state.outq_sending = count;
+    else
+        tasks_state.outq_sending = OUTQ_RECS_PER_POST;
     }
 
 
@@ -143,11 +528,26 @@ static int add_post_error(void)
     }
 
 
-// Add sequence number to POST body text in decimal format
-// Value is constrained to 0 to 2^31 - 1 (2,147,483,647)
+// Add backoff state of retry scheduler (see "retry.h") to POST body text as
+// consecutive failures and backoff window in seconds
 // Returns 0 if okay, < 0 if ran out of space
 
-#define SEQ_NUM_MSK     0x7FFFFFFFUL
+static int add_retry_state(void)
+    {
+    RetryState_t state;
+    char buffer[10];                // Up to 3 + 1 + 5 chars plus zero
+
+    retry_get_state(&state);
+
+    sprintf(buffer, "%u,%u", state.failures, state.window_secs);
+
+    return post_add_variable("retry", buffer, 0);
+    }
+
+
+// Add sequence number to POST body text in decimal format (or binary field)
+// Value is constrained to 0 to 2^31 - 1 (2,147,483,647)
+// Returns 0 if okay, < 0 if ran out of space
 
 static int add_seq_num(void)
     {
@@ -157,11 +557,14 @@ static int add_seq_num(void)
 
     report(DETAIL, "Sequence number: %s", buffer);
 
+    if (BINARY_UPLOAD)
+        return post_add_number(POST_TAG_SEQ, (bb_seq_num & SEQ_NUM_MSK), 4);
+
     return post_add_variable("seq", buffer, 0);
     }
 
 
-// Add local IP address to POST body text as 8 hex digits (4 bytes)
+// Add local IP address to POST body text as 8 hex digits (or binary field)
 // Returns 0 if okay, < 0 if ran out of space
 
 static int add_my_ip(void)
@@ -170,11 +573,15 @@ static int add_my_ip(void)
 
     my_ip = lan_get_network_ip();           // Big-endian format
 
+    if (BINARY_UPLOAD)
+        return post_add_field(POST_TAG_LOCAL_IP, &my_ip, sizeof(my_ip));
+
     return post_add_variable("localip", (char *) &my_ip, sizeof(my_ip));
     }
 
 
 // Add firmware version number to POST body text as merged string (no dot)
+// (or binary field of major and minor numbers)
 // Returns 0 if okay, < 0 if ran out of space
 
 #define STR(X)          #X
@@ -183,10 +590,45 @@ static int add_my_ip(void)
 
 static int add_firmware_version(void)
     {
+    static const unsigned char version[2] = { VER_MAJOR, VER_MINOR };
+
+    if (BINARY_UPLOAD)
+        return post_add_field(POST_TAG_VERSION, version, sizeof(version));
+
     return post_add_variable("ver", STR_VERSION, 0);
     }
 
 
+// Add weather station timing statistics to POST body text as hex string
+// (see dav_pack_stats for layout)
+// Returns 0 if okay, < 0 if ran out of space
+
+static int add_dav_stats(void)
+    {
+    static unsigned char buffer[DAV_STATS_LEN];
+    unsigned int len;
+
+    len = dav_pack_stats(buffer);
+
+    return post_add_variable("davstat", (char *) buffer, len);
+    }
+
+
+// Add timing statistics for phases of previous POSTs to POST body text in
+// hex format (see post_pack_stats for layout)
+// Returns 0 if okay, < 0 if ran out of space
+
+static int add_post_stats(void)
+    {
+    static unsigned char buffer[POST_STATS_LEN];
+    unsigned int len;
+
+    len = post_pack_stats(buffer);
+
+    return post_add_variable("poststat", (char *) buffer, len);
+    }
+
+
 // Sets up the body text to post to the server
 // Returns 0 if okay, < 0 if ran out of space
 
@@ -196,6 +638,8 @@ static int set_post_body(void)
 
     ++bb_seq_num;                       // Bump up sequence number for attempt
 
+    tasks_state.sending_key = 0;
+
     post_clear_body();
 
     status = add_station_id();
@@ -206,12 +650,44 @@ static int set_post_body(void)
         return -1;
         }
 
-    status = add_collected_data();
+    if (tasks_state.arch_sending != 0)
+        {
+        status = add_archive_data();
 
-    if (status < 0)
+        if (status < 0)
+            {
+            report(PROBLEM, "add_archive_data() failed with %d", status);
+            return -2;
+            }
+        }
+    else if (!tasks_state.backlog_only)
         {
-        report(PROBLEM, "add_collected_data() failed with %d", status);
-        return -2;
+        status = add_collected_data();
+
+        if (status < 0)
+            {
+            report(PROBLEM, "add_collected_data() failed with %d", status);
+            return -2;
+            }
+
+        status = add_aggregate_data();
+
+        if (status < 0)
+            {
+            report(PROBLEM, "add_aggregate_data() failed with %d", status);
+            return -2;
+            }
+        }
+
+    if (tasks_state.outq_sending != 0)
+        {
+        status = add_queued_data();
+
+        if (status < 0)
+            {
+            report(PROBLEM, "add_queued_data() failed with %d", status);
+            return -8;
+            }
         }
 
     if (bb_post_error_flag)
@@ -223,6 +699,14 @@ static int set_post_body(void)
             report(PROBLEM, "add_post_error() failed with %d", status);
             return -3;
             }
+
+        status = add_retry_state();
+
+        if (status < 0)
+            {
+            report(PROBLEM, "add_retry_state() failed with %d", status);
+            return -9;
+            }
         }
 
     status = add_seq_num();
@@ -249,6 +733,28 @@ static int set_post_body(void)
         return -6;
         }
 
+    if (DAV_STATS_POSTS != 0 && (bb_seq_num % DAV_STATS_POSTS) == 0)
+        {
+        status = add_dav_stats();
+
+        if (status < 0)
+            {
+            report(PROBLEM, "add_dav_stats() failed with %d", status);
+            return -7;
+            }
+        }
+
+    if (POST_STATS_POSTS != 0 && (bb_seq_num % POST_STATS_POSTS) == 0)
+        {
+        status = add_post_stats();
+
+        if (status < 0)
+            {
+            report(PROBLEM, "add_post_stats() failed with %d", status);
+            return -10;
+            }
+        }
+
     return 0;
     }
 
@@ -275,6 +781,101 @@ static void set_next_collection_time(void)
     }
 
 
+// Starts collection of data from weather station
+// If a clock check is due, it is batched with the collection to run under
+// the same wakeup
+
+static void start_collection(void)
+    {
+    set_next_collection_time();
+
+    dav_begin_batch();
+    dav_start_collect();
+
+    tasks_state.time_chk_batched = 0;
+
+    if (CHK_TIMEOUT_UL_SECS(tasks_state.time_chk_tmr) && rtc_validated)
+        {
+        tasks_state.time_chk_tmr = SET_TIMEOUT_UL_SECS(BACKOFF_TIME_CHK_SECS);
+        dav_start_check_time();
+        report(DETAIL, "Checking weather station clock after collection");
+        tasks_state.time_chk_batched = 1;
+        }
+
+    dav_run_batch();
+    }
+
+
+// Handles result of weather station clock check
+// Returns !0 if clock needs to be reset, or 0 if not
+
+static int check_time_result(int status)
+    {
+    switch (status)
+        {
+        case DAV_SUCCESS:
+            report(DETAIL, "Weather station clock is set okay\x07");
+            tasks_state.time_chk_tmr = SET_TIMEOUT_UL_SECS(NEXT_TIME_CHK_SECS);
+            return 0;
+
+        case DAV_WRONG_TIME:
+            if (rtc_validated)
+                return 1;
+
+            report(DETAIL, "Cannot reset weather station clock"
+                           " -- Interface clock not yet validated");
+            return 0;
+
+        default:
+            report(PROBLEM, "Error checking weather station clock\x07");
+            return 0;
+        }
+    }
+
+
+// Moves collected data not yet delivered to queue for re-send, as it may be
+// overwritten before the next POST
+// Data never sent is given a sequence number of its own, as no POST has
+// used one for it (aggregated values are not queued, so are lost)
+
+static void queue_new_data(int sent)
+    {
+    if (!tasks_state.new_data)
+        return;
+
+    if (!sent)
+        ++bb_seq_num;
+
+    if (outq_push(bb_seq_num, tasks_state.data_time, dav_data) != 0)
+        report(PROBLEM, "Queue full - oldest record discarded");
+
+    report(DETAIL, "Data queued for re-send (%u records queued)", outq_count());
+
+    tasks_state.new_data = 0;
+    }
+
+
+// Starts download of archive records missed since last successful POST
+// if backfill is needed and the time of that POST is known
+// Returns 1 if download has been started, or 0 if not
+
+static int start_backfill(void)
+    {
+    if (!bb_backfill_flag || bb_last_post_time == 0UL || !rtc_validated)
+        return 0;
+
+    if (tasks_state.arch_count != 0)
+        return 0;                   // Wait for earlier records to be sent
+
+    bb_backfill_flag = 0;
+
+    report(DETAIL, "Downloading archive records since %lu", bb_last_post_time);
+
+    dav_start_dump_after(bb_last_post_time);
+    return 1;
+    }
+
+
 // *** EXTERNAL FUNCTIONS ***
 
 // Initialise tasks state machine
@@ -288,10 +889,20 @@ int tasks_init(void)
     memset(&tasks_state, 0, sizeof(tasks_state));       // Zero all state variables
 
     tasks_state.collect_tmr = SET_TIMEOUT_UI_SECS(INIT_COLLECT_SECS);
+    tasks_state.sample_tmr = SET_TIMEOUT_UI_SECS(SAMPLE_SECS);
     tasks_state.time_chk_tmr = SET_TIMEOUT_UL_SECS(INIT_TIME_CHK_SECS);
     tasks_state.state = TASKS_IDLE;
 
-    status = post_init(2048);
+    retry_init(get_station_id());                       // Seed differs between units
+
+    agg_reset();
+
+    status = outq_init();
+
+    if (status != 0)
+        report(DETAIL, "%u undelivered records held in queue", status);
+
+    status = post_init(POST_BODY_SIZE);
 
     if (status < 0)
         {
@@ -300,6 +911,16 @@ int tasks_init(void)
         return TASKS_POST_INIT_ERR;
         }
 
+    post_set_body_type(BINARY_UPLOAD ? POST_BODY_BINARY : POST_BODY_FORM);
+
+    tasks_state.arch_buf = (char far *) xalloc(ARCH_QUEUE_RECS * DAV_ARCH_REC_LEN);
+
+    if (!tasks_state.arch_buf)
+        {
+        report(PROBLEM, "Failed to allocate arch_buf storage");
+        return TASKS_ARCH_INIT_ERR;
+        }
+
     status = dav_init_all();
 
     if (status < 0)
@@ -318,12 +939,12 @@ int tasks_init(void)
 
     if (ee_post_info.use_proxy == 0)
         {
-        status = post_set_server(ee_post_host.str, ee_post_info.host_port,
+        status = post_set_server(POST_PRIMARY, ee_post_host.str, ee_post_info.host_port,
                  ee_post_path.str, NULL, 0);            // No proxy
         }
     else
         {
-        status = post_set_server(ee_post_host.str, ee_post_info.host_port,
+        status = post_set_server(POST_PRIMARY, ee_post_host.str, ee_post_info.host_port,
                  ee_post_path.str, ee_post_proxy.str, ee_post_info.proxy_port);
         }
 
@@ -334,6 +955,25 @@ int tasks_init(void)
         return TASKS_SERVER_INIT_ERR;
         }
 
+    if (STANDBY_HOST[0] != '\0')
+        {
+        if (ee_post_info.use_proxy == 0)
+            {
+            status = post_set_server(POST_STANDBY, STANDBY_HOST, ee_post_info.host_port,
+                     ee_post_path.str, NULL, 0);        // No proxy
+            }
+        else
+            {
+            status = post_set_server(POST_STANDBY, STANDBY_HOST, ee_post_info.host_port,
+                     ee_post_path.str, ee_post_proxy.str, ee_post_info.proxy_port);
+            }
+
+        if (status < 0)
+            report(PROBLEM, "post_set_server() failed with %d for standby server", status);
+        else
+            report(DETAIL, "Also delivering to standby server %s", STANDBY_HOST);
+        }
+
     return TASKS_INIT_OK;
     }
 
@@ -345,6 +985,8 @@ int tasks_init(void)
 int tasks_run(void)
     {
     int status;
+    unsigned int secs;
+    const unsigned char * rec;
 
     net_tick();
 
@@ -358,10 +1000,16 @@ int tasks_run(void)
             if (CHK_TIMEOUT_UI_SECS(tasks_state.collect_tmr))
                 {
                 report(DETAIL, "Starting automatic data collection");
-                set_next_collection_time();
-                dav_start_collect();
+                start_collection();
                 tasks_state.state = TASKS_COLLECTING;
                 }
+            else if (tasks_state.set_time_due)
+                {
+                tasks_state.set_time_due = 0;
+                dav_start_set_time();
+                report(DETAIL, "Resetting weather station clock");
+                tasks_state.state = TASKS_TIME_SETTING;
+                }
             else if (CHK_TIMEOUT_UL_SECS(tasks_state.time_chk_tmr))
                 {
                 tasks_state.time_chk_tmr = SET_TIMEOUT_UL_SECS(BACKOFF_TIME_CHK_SECS);
@@ -375,8 +1023,35 @@ int tasks_run(void)
                     report(DETAIL, "Cannot check weather station clock"
                                    " -- Interface clock not yet validated");
                 }
+            else if (tasks_state.arch_count != 0 && !retry_waiting())
+                {
+                if (tasks_state.arch_count < ARCH_RECS_PER_POST)
+                    tasks_state.arch_sending = tasks_state.arch_count;
+                else
+                    tasks_state.arch_sending = ARCH_RECS_PER_POST;
+
+                report(DETAIL, "Delivering %u of %u archive records",
+                                tasks_state.arch_sending, tasks_state.arch_count);
+                tasks_state.state = TASKS_PROCESSING;
+                }
+            else if (outq_count() != 0 && !retry_waiting())
+                {
+                select_queued_data();
+                tasks_state.backlog_only = 1;
+
+                report(DETAIL, "Delivering %u of %u queued records",
+                                tasks_state.outq_sending, outq_count());
+                tasks_state.state = TASKS_PROCESSING;
+                }
+            else if (CHK_TIMEOUT_UI_SECS(tasks_state.sample_tmr))
+                {
+                tasks_state.sample_tmr = SET_TIMEOUT_UI_SECS(SAMPLE_SECS);
+                dav_start_collect();
+                tasks_state.state = TASKS_SAMPLING;
+                }
             else                        // Not time for collection yet
                 {
+                dns_cache_tick();       // Refresh cached server addresses
                 wx_get_switches();      // Refresh input switch states
                 switch(inchar())        // Check for user input
                     {
@@ -384,12 +1059,13 @@ int tasks_run(void)
                         break;          // Nothing received
 
                     case MENU_ESC:
+                        post_close_idle();          // Free socket for download
                         return TASKS_MENU;          // -- EXIT --
 
                     default:
                         report(DETAIL, "Manually starting data collection");
-                        set_next_collection_time();
-                        dav_start_collect();
+                        retry_now();                // Deliver without waiting
+                        start_collection();
                         tasks_state.state = TASKS_COLLECTING;
                         break;
                     }
@@ -411,16 +1087,25 @@ int tasks_run(void)
         case TASKS_COLLECTING:
             if (dav_tick() != DAV_PENDING)
                 {
-                if (dav_get_status() == DAV_SUCCESS)
+                if (tasks_state.time_chk_batched)
+                    {
+                    tasks_state.time_chk_batched = 0;
+                    status = dav_get_cmd_status(1);
+                    if (status != DAV_NOT_STARTED && check_time_result(status))
+                        tasks_state.set_time_due = 1;
+                    }
+
+                if (dav_get_cmd_status(0) == DAV_SUCCESS)
                     {
                     report(DETAIL, "Data collected okay\x07");
 
                     tasks_state.new_data = 1;       // Mark data as collected
+                    tasks_state.data_time = rtc_validated ? time(NULL) : 0UL;
                     tasks_state.collect_err_ctr = 0;
 
                     dav_dump_data();
 
-                    tasks_state.state = TASKS_PROCESSING;
+                    add_sample();
                     }
                 else
                     {
@@ -434,9 +1119,43 @@ int tasks_run(void)
                         report(PROBLEM, "Too many consecutive collection errors");
                         return TASKS_COLLECT_FAIL;      // -- EXIT --
                         }
+                    }
+
+                agg_close(&tasks_state.agg_result);
 
-                    tasks_state.state = TASKS_PROCESSING;
+                report(DETAIL, "%u samples aggregated since previous collection",
+                                tasks_state.agg_result.samples);
+
+                if (retry_waiting())                // Backing off after failure?
+                    {
+                    report(DETAIL, "Deferring delivery for %u seconds after POST failure",
+                                    retry_secs_left());
+                    queue_new_data(0);
+                    tasks_state.state = TASKS_IDLE;
+                    break;
                     }
+
+                select_queued_data();               // Send some of any backlog too
+
+                tasks_state.state = TASKS_PROCESSING;
+                }
+            break;
+
+        // Taking sample from weather station for aggregation between collections
+        case TASKS_SAMPLING:
+            if (dav_tick() != DAV_PENDING)
+                {
+                if (dav_get_status() == DAV_SUCCESS)
+                    add_sample();
+                else
+                    {
+                    report(DETAIL, "Error taking sample for aggregation");
+
+                    if (!dav_data_valid)
+                        tasks_state.new_data = 0;   // Invalidate data if overwritten
+                    }
+
+                tasks_state.state = TASKS_IDLE;
                 }
             break;
 
@@ -465,15 +1184,46 @@ int tasks_run(void)
 
             if (post_tick() != POST_PENDING)
                 {
+                status = post_get_dest_status(POST_STANDBY);
+
+                if (status == POST_SUCCESS)
+                    report(DETAIL, "Data delivered okay to standby server");
+                else if (status != POST_NOT_STARTED)
+                    report(PROBLEM, "Problem delivering data to standby server (%d)", status);
+
                 if (post_get_status() == POST_SUCCESS)
                     {
                     report(DETAIL, "Data delivered okay to remote server\x07");
 
-                    tasks_state.new_data = 0;       // Mark data as delivered
+                    if (tasks_state.arch_sending != 0)
+                        arch_queue_drop(tasks_state.arch_sending);
+                    else if (!tasks_state.backlog_only)
+                        tasks_state.new_data = 0;   // Mark data as delivered
+
+                    if (tasks_state.outq_sending != 0)
+                        outq_drop(tasks_state.outq_sending);
+
+                    // Full packet is new keyframe only if standby (when used)
+                    // also has it, otherwise next packet is sent in full
+
+                    if (tasks_state.sending_key)
+                        {
+                        if (status == POST_SUCCESS || status == POST_NOT_STARTED)
+                            {
+                            memcpy(tasks_state.key_data, dav_data, DAV_DATA_LEN);
+                            tasks_state.key_seq = bb_seq_num;
+                            tasks_state.key_valid = 1;
+                            tasks_state.key_age = 0;
+                            }
+                        else
+                            tasks_state.key_valid = 0;
+                        }
 
                     bb_post_error_flag = 0;
 
                     tasks_state.post_err_ctr = 0;
+
+                    retry_succeeded();
                     }
                 else
                     {
@@ -481,13 +1231,19 @@ int tasks_run(void)
 
                     bb_post_error_flag = 1;
 
-                    if (++tasks_state.post_err_ctr >= MAX_POST_ERRS)
-                        {
-                        report(PROBLEM, "Too many consecutive POST errors");
-                        return TASKS_POST_FAIL;     // -- EXIT --
-                        }
+                    if (bb_last_post_time != 0UL)
+                        bb_backfill_flag = 1;       // Fetch missed records later
+
+                    if (tasks_state.post_err_ctr < 255)
+                        ++tasks_state.post_err_ctr;
 
-                    // Don't invalidate data -- allow re-send
+                    secs = retry_failed();          // Back off before next attempt
+
+                    report(INFO, "Retrying in %u seconds (%u consecutive failures)",
+                                  secs, tasks_state.post_err_ctr);
+
+                    if (tasks_state.arch_sending == 0 && !tasks_state.backlog_only)
+                        queue_new_data(1);
                     }
 
                 report(RAW_INFO, "\r\n");
@@ -497,6 +1253,44 @@ int tasks_run(void)
                 report(RAW_INFO, "Press [ESC] to re-configure unit "
                                  "or other key for immediate collection\r\n");
 
+                tasks_state.arch_sending = 0;
+                tasks_state.outq_sending = 0;
+                tasks_state.backlog_only = 0;
+                tasks_state.state = TASKS_IDLE;
+
+                if (post_get_status() == POST_SUCCESS)
+                    {
+                    if (start_backfill())
+                        tasks_state.state = TASKS_ARCHIVING;
+
+                    if (rtc_validated)
+                        bb_last_post_time = time(NULL);
+                    }
+                }
+            break;
+
+        // Downloading archive records missed during outage into xmem queue
+        case TASKS_ARCHIVING:
+            status = dav_tick();
+
+            while ((rec = dav_next_archive_rec()) != NULL)
+                {
+                if (arch_queue_add(rec) < 0)
+                    {
+                    report(PROBLEM, "Archive queue full - stopping download");
+                    dav_abort();
+                    break;
+                    }
+                }
+
+            if (status != DAV_PENDING)
+                {
+                if (status == DAV_SUCCESS)
+                    report(DETAIL, "Archive download complete (%u records queued)",
+                                    tasks_state.arch_count);
+                else
+                    report(PROBLEM, "Error downloading archive records\x07");
+
                 tasks_state.state = TASKS_IDLE;
                 }
             break;
@@ -505,34 +1299,14 @@ int tasks_run(void)
         case TASKS_TIME_CHECKING:
             if (dav_tick() != DAV_PENDING)
                 {
-                switch (dav_get_status())
+                if (check_time_result(dav_get_status()))
                     {
-                    case DAV_SUCCESS:
-                        report(DETAIL, "Weather station clock is set okay\x07");
-                        tasks_state.time_chk_tmr = SET_TIMEOUT_UL_SECS(NEXT_TIME_CHK_SECS);
-                        tasks_state.state = TASKS_IDLE;
-                        break;
-
-                    case DAV_WRONG_TIME:
-                        if (rtc_validated)
-                            {
-                            dav_start_set_time();
-                            report(DETAIL, "Resetting weather station clock");
-                            tasks_state.state = TASKS_TIME_SETTING;
-                            }
-                        else
-                            {
-                            report(DETAIL, "Cannot reset weather station clock"
-                                           " -- Interface clock not yet validated");
-                            tasks_state.state = TASKS_IDLE;
-                            }
-                        break;
-
-                    default:
-                        report(PROBLEM, "Error checking weather station clock\x07");
-                        tasks_state.state = TASKS_IDLE;
-                        break;
+                    dav_start_set_time();
+                    report(DETAIL, "Resetting weather station clock");
+                    tasks_state.state = TASKS_TIME_SETTING;
                     }
+                else
+                    tasks_state.state = TASKS_IDLE;
                 }
             break;
 
@@ -17,6 +17,7 @@
 #define TASKS_DAV_INIT_ERR      (-2)
 #define TASKS_EE_INIT_ERR       (-3)
 #define TASKS_SERVER_INIT_ERR   (-4)
+#define TASKS_ARCH_INIT_ERR     (-5)
 
 // Task status (values returned by tasks_run)
 
@@ -26,7 +27,6 @@
 #define TASKS_ETH_DOWN          (-2)
 #define TASKS_LAN_DOWN          (-3)
 #define TASKS_COLLECT_FAIL      (-4)
-#define TASKS_POST_FAIL         (-5)
 #define TASKS_BAD_STATE         (-6)
 
 // Maximum number of seconds between updates
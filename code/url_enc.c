@@ -0,0 +1,109 @@
+// Routines to URL-encode strings and convert bytes to hex
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+// Characters are classified by table lookup rather than by isalnum() and
+// written directly rather than by sprintf(), so that the length of an
+// encoded string can be found before any of it is written.  Letters and
+// digits are sent unchanged, spaces as '+' and all other characters as
+// "%XX" (upper case hex).
+
+
+#include "url_enc.h"
+
+
+// Length of each character when URL-encoded
+
+static const unsigned char url_len[256] =
+    {
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,       // 00-0F
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,       // 10-1F
+    1, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,       // 20-2F
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 3, 3, 3, 3, 3, 3,       // 30-3F
+    3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,       // 40-4F
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 3, 3, 3, 3, 3,       // 50-5F
+    3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,       // 60-6F
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 3, 3, 3, 3, 3,       // 70-7F
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,       // 80-8F
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,       // 90-9F
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,       // A0-AF
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,       // B0-BF
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,       // C0-CF
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,       // D0-DF
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,       // E0-EF
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,       // F0-FF
+    };
+
+
+// Hex digits for each value of a nibble
+
+static const char hex_digits[16] =
+    {
+    '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', 'A', 'B', 'C', 'D', 'E', 'F',
+    };
+
+
+// *** EXTERNAL FUNCTIONS ***
+
+// Returns length of zero-terminated string when URL-encoded
+
+unsigned int url_enc_len(const char * str)
+    {
+    unsigned int len;
+
+    len = 0;
+
+    while (*str != '\0')
+        len += url_len[(unsigned char) *str++];
+
+    return len;
+    }
+
+
+// Writes URL-encoded copy of zero-terminated string (without terminator)
+// Caller must ensure there is room for url_enc_len(str) characters
+// Returns pointer to character after last one written
+
+char far * url_enc_string(char far * dst, const char * str)
+    {
+    unsigned char ch;
+
+    while ((ch = (unsigned char) *str++) != '\0')
+        {
+        if (url_len[ch] == 1)
+            *dst++ = (ch == ' ') ? '+' : ch;
+        else
+            {
+            *dst++ = '%';
+            *dst++ = hex_digits[ch >> 4];
+            *dst++ = hex_digits[ch & 0x0F];
+            }
+        }
+
+    return dst;
+    }
+
+
+// Writes fixed-length block of bytes as pairs of hex digits (without terminator)
+// Caller must ensure there is room for len * 2 characters
+// Returns pointer to character after last one written
+
+char far * url_enc_hex(char far * dst, const char * bytes, unsigned int len)
+    {
+    unsigned char ch;
+
+    while (len--)
+        {
+        ch = (unsigned char) *bytes++;
+        *dst++ = hex_digits[ch >> 4];
+        *dst++ = hex_digits[ch & 0x0F];
+        }
+
+    return dst;
+    }
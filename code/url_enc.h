@@ -0,0 +1,19 @@
+// Header file for routines to URL-encode strings and convert bytes to hex
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+#ifndef URL_ENC_H
+#define URL_ENC_H
+
+// Function prototypes
+
+unsigned int url_enc_len(const char * str);
+char far * url_enc_string(char far * dst, const char * str);
+char far * url_enc_hex(char far * dst, const char * bytes, unsigned int len);
+
+#endif
@@ -41,7 +41,8 @@
 
 // Set up socket buffers
 
-const char MAX_TCP_SOCKET_BUFFERS = 2;          // HTTP POST and Download connections
+const char MAX_TCP_SOCKET_BUFFERS = 2;          // HTTP POST (main and standby servers)
+                                                // or Download connections
 const char MAX_UDP_SOCKET_BUFFERS = 1;          // UDP Debug
 
 
@@ -312,7 +313,6 @@ void main(void)
 
             case TASKS_ETH_DOWN:
             case TASKS_COLLECT_FAIL:
-            case TASKS_POST_FAIL:
                 goto Reset;
 
             case TASKS_LAN_DOWN:
@@ -0,0 +1,372 @@
+// Host benchmark for building URL-encoded POST bodies
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+// Builds and runs on a host PC (not on the Rabbit module), for example:
+//
+//   cc -O2 -Dfar= -I../code -o body_bench body_bench.c ../code/url_enc.c
+//   ./body_bench
+//
+// A typical POST body (a collection with aggregated values and six queued
+// records, as sent by tasks.c) is built over and over, first with a copy of
+// the original post_client.c routines (sprintf() for every character and a
+// branch for every hex digit) and then with the table-driven routines in
+// url_enc.c.  The two bodies are checked to be identical, then the rate at
+// which body bytes are produced is reported for each.  Cycle counts come
+// from the time stamp counter on x86 hosts; elsewhere they are estimated
+// from elapsed time.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "url_enc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC    1
+#else
+#define HAVE_TSC    0
+#endif
+
+
+#define DATA_LEN            99              // LOOP packet length (as davis.h)
+#define QUEUED_RECS         6               // As OUTQ_RECS_PER_POST in tasks.c
+
+#define BODY_BUF_SIZE       3072            // As POST_BODY_SIZE in tasks.c
+
+#define TARGET_BODIES       200000UL        // Bodies per timing run
+
+
+// Body buffer and position (as post_client.c)
+
+static char body_buf[BODY_BUF_SIZE];
+static unsigned int body_pos;
+
+static char ref_buf[BODY_BUF_SIZE];
+static unsigned int ref_len;
+
+
+// Values sent in body (names and values for queued records are formatted
+// in advance so that only encoding is timed)
+
+static unsigned char packets[QUEUED_RECS + 1][DATA_LEN];
+
+static char rec_names[QUEUED_RECS][3][8];
+static char rec_values[QUEUED_RECS][2][11];
+
+
+// *** Original routines (from post_client.c, with farsprintf as sprintf) ***
+
+static int old_add_body_char(char ch, int url_encode)
+    {
+    char * fmt;
+    unsigned int inc;
+
+    fmt = "%c";                     // Default is just add character
+    inc = 1;
+
+    if (url_encode)
+        {
+        if (!isalnum((unsigned char) ch))
+            {
+            if (ch == ' ')
+                ch = '+';
+            else
+                {
+                fmt = "%%%02X";
+                inc = 3;
+                }
+            }
+        }
+
+    if (body_pos + inc >= BODY_BUF_SIZE)
+        return -1;
+
+    sprintf((body_buf + body_pos), fmt, (unsigned char) ch);
+    body_pos += inc;
+
+    return 0;
+    }
+
+
+static int old_add_body_string(const char * str)
+    {
+    while (*str != 0)
+        {
+        if (old_add_body_char(*str, 1) < 0)
+            return -1;
+
+        ++str;
+        }
+
+    return 0;
+    }
+
+
+static char old_nibb_to_hex(char nibble)
+    {
+    nibble &= 0x0F;                             // Discard upper bits
+
+    if (nibble <= 9)
+        return (char) (nibble + '0');           // Decimal digit
+    else
+        return (char) (nibble + 'A' - 10);      // Hex A-F digit
+    }
+
+
+static int old_add_body_hexstring(const char * bytes, unsigned int len)
+    {
+    char * body_ptr;
+
+    if (body_pos + (len * 2) >= BODY_BUF_SIZE)
+        return -1;              // Not enough room in body buffer
+
+    body_ptr = body_buf + body_pos;
+
+    body_pos += (len * 2);
+
+    while (len--)
+        {
+        *body_ptr++ = old_nibb_to_hex(*bytes >> 4);
+        *body_ptr++ = old_nibb_to_hex(*bytes++);
+        }
+
+    *body_ptr = '\0';
+
+    return 0;
+    }
+
+
+static int old_add_variable(const char * name, const char * value, unsigned int hexlen)
+    {
+    if (body_pos != 0 && old_add_body_char('&', 0) < 0)
+        return -1;
+
+    if (old_add_body_string(name) < 0 || old_add_body_char('=', 0) < 0)
+        return -1;
+
+    if (hexlen == 0)
+        return old_add_body_string(value);
+    else
+        return old_add_body_hexstring(value, hexlen);
+    }
+
+
+// *** Table-driven routines (as post_add_variable in post_client.c) ***
+
+static int new_add_variable(const char * name, const char * value, unsigned int hexlen)
+    {
+    unsigned long total_len;
+    char * body_ptr;
+
+    total_len = (unsigned long) url_enc_len(name) + 1 +
+                ((hexlen != 0) ? (hexlen * 2) : url_enc_len(value));
+
+    if (body_pos != 0)
+        ++total_len;
+
+    if (body_pos + total_len >= BODY_BUF_SIZE)
+        return -1;
+
+    body_ptr = body_buf + body_pos;
+
+    if (body_pos != 0)
+        *body_ptr++ = '&';
+
+    body_ptr = url_enc_string(body_ptr, name);
+    *body_ptr++ = '=';
+
+    if (hexlen == 0)
+        body_ptr = url_enc_string(body_ptr, value);
+    else
+        body_ptr = url_enc_hex(body_ptr, value, hexlen);
+
+    *body_ptr = '\0';
+
+    body_pos += (unsigned int) total_len;
+
+    return 0;
+    }
+
+
+// *** Benchmark ***
+
+typedef int (* AddVar_t)(const char * name, const char * value, unsigned int hexlen);
+
+
+// Builds typical body with given routine
+// Returns 0 if okay, or -1 if body did not fit
+
+static int build_body(AddVar_t add_var)
+    {
+    static const unsigned char ip[4] = { 192, 168, 1, 20 };
+    unsigned int i;
+    int status;
+
+    body_pos = 0;
+    body_buf[0] = '\0';
+
+    status  = add_var("station", "1234", 0);
+    status |= add_var("data", (char *) packets[0], DATA_LEN);
+    status |= add_var("aggn", "30", 0);
+    status |= add_var("aggot", "612,648,630", 0);
+    status |= add_var("aggit", "701,705,703", 0);
+    status |= add_var("aggbar", "29912,29934,29921", 0);
+    status |= add_var("aggwind", "52,14,270,265", 0);
+
+    for (i = 0; i < QUEUED_RECS; ++i)
+        {
+        status |= add_var(rec_names[i][0], (char *) packets[i + 1], DATA_LEN);
+        status |= add_var(rec_names[i][1], rec_values[i][0], 0);
+        status |= add_var(rec_names[i][2], rec_values[i][1], 0);
+        }
+
+    status |= add_var("posterr", "Timed out (state 7)", 0);
+    status |= add_var("seq", "104007", 0);
+    status |= add_var("localip", (const char *) ip, sizeof(ip));
+    status |= add_var("ver", "125", 0);
+
+    return status;
+    }
+
+
+// Returns elapsed time in nanoseconds from monotonic clock
+
+static double now_ns(void)
+    {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+    }
+
+
+// Returns current cycle count (or 0 if not available)
+
+static unsigned long long now_cycles(void)
+    {
+#if HAVE_TSC
+    return __rdtsc();
+#else
+    return 0ULL;
+#endif
+    }
+
+
+// Times building of body with given routine
+// Returns nanoseconds per body
+
+static double time_method(const char * label, AddVar_t add_var)
+    {
+    unsigned long i;
+    unsigned long long c0, c1;
+    double t0, t1;
+    double bytes;
+    double cyc_per_byte;
+
+    t0 = now_ns();
+    c0 = now_cycles();
+
+    for (i = 0; i < TARGET_BODIES; ++i)
+        {
+        packets[0][10] = (unsigned char) i;         // Defeat loop hoisting
+        (void) build_body(add_var);
+        }
+
+    c1 = now_cycles();
+    t1 = now_ns();
+
+    bytes = (double) TARGET_BODIES * body_pos;
+
+    if (HAVE_TSC)
+        cyc_per_byte = (double) (c1 - c0) / bytes;
+    else
+        cyc_per_byte = (t1 - t0) / bytes;           // Assume 1 GHz
+
+    printf("  %-12s %8.0f ns/body, %6.2f cycles/byte, %7.1f Mbytes/s\n",
+            label, (t1 - t0) / TARGET_BODIES, cyc_per_byte, bytes * 1e3 / (t1 - t0));
+
+    return (t1 - t0) / TARGET_BODIES;
+    }
+
+
+int main(void)
+    {
+    unsigned int i;
+    unsigned int j;
+    double old_ns;
+    double new_ns;
+
+    srand(12345);
+
+    for (i = 0; i <= QUEUED_RECS; ++i)
+        for (j = 0; j < DATA_LEN; ++j)
+            packets[i][j] = (unsigned char) rand();
+
+    for (i = 0; i < QUEUED_RECS; ++i)
+        {
+        sprintf(rec_names[i][0], "data%u", i + 1);
+        sprintf(rec_names[i][1], "dseq%u", i + 1);
+        sprintf(rec_names[i][2], "dtime%u", i + 1);
+        sprintf(rec_values[i][0], "%lu", 104001UL + i);
+        sprintf(rec_values[i][1], "%lu", 1160000060UL + i * 60);
+        }
+
+    // Check that both methods give the same body (including for characters
+    // of every value in a string)
+
+    for (i = 1; i < 256; ++i)
+        {
+        char str[2];
+
+        str[0] = (char) i;
+        str[1] = '\0';
+
+        body_pos = 0;
+        (void) old_add_variable("x", str, 0);
+        strcpy(ref_buf, body_buf);
+
+        body_pos = 0;
+        (void) new_add_variable("x", str, 0);
+
+        if (strcmp(ref_buf, body_buf) != 0)
+            {
+            printf("Mismatch for character %02X: %s / %s\n", i, ref_buf, body_buf);
+            return 1;
+            }
+        }
+
+    if (build_body(old_add_variable) != 0)
+        {
+        printf("Body does not fit in buffer\n");
+        return 1;
+        }
+
+    strcpy(ref_buf, body_buf);
+    ref_len = body_pos;
+
+    (void) build_body(new_add_variable);
+
+    if (body_pos != ref_len || strcmp(ref_buf, body_buf) != 0)
+        {
+        printf("Bodies differ\n");
+        return 1;
+        }
+
+    printf("Body of %u bytes, identical with both methods\n", ref_len);
+
+    old_ns = time_method("Original", old_add_variable);
+    new_ns = time_method("Table", new_add_variable);
+
+    printf("  Speed-up x%.1f\n", old_ns / new_ns);
+
+    return 0;
+    }
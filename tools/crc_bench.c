@@ -0,0 +1,207 @@
+// Host benchmark for CRC calculation methods in crc.c
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+// Builds and runs on a host PC (not on the Rabbit module), for example:
+//
+//   for m in 1 2 3 4; do
+//       cc -O2 -DCRC_METHOD=$m -I../code -o crc_bench crc_bench.c ../code/crc.c
+//       ./crc_bench
+//   done
+//
+// Each build checks the selected method against a bit-by-bit reference
+// calculation, then reports cycles per byte for a LOOP-sized block and
+// for a large block.  Cycle counts come from the time stamp counter on
+// x86 hosts; elsewhere they are estimated from elapsed time.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC    1
+#else
+#define HAVE_TSC    0
+#endif
+
+
+// Block sizes used for timing
+
+#define LOOP_BLK_LEN        97              // LOOP packet excluding CRC bytes
+#define LARGE_BLK_LEN       4096
+
+#define TARGET_BYTES        200000000UL     // Approximate bytes per timing run
+
+
+// Names of methods (indexed by CRC_METHOD value)
+
+static const char * method_names[] =
+    {
+    "?",
+    "NIBBLE",
+    "BYTE",
+    "SLICE4",
+    "SLICE8",
+    };
+
+
+static unsigned char test_buf[LARGE_BLK_LEN];
+
+
+// Bit-by-bit reference calculation of 16-bit CCITT CRC (initial value 0)
+
+static unsigned int crc_reference(const unsigned char * ptr, size_t len)
+    {
+    unsigned int crc;
+    int bit;
+
+    crc = 0;
+
+    while (len--)
+        {
+        crc ^= (unsigned int) *ptr++ << 8;
+
+        for (bit = 0; bit < 8; ++bit)
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+
+        crc &= 0xFFFF;
+        }
+
+    return crc;
+    }
+
+
+// Returns elapsed time in nanoseconds from monotonic clock
+
+static double now_ns(void)
+    {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+    }
+
+
+// Returns current cycle count (or 0 if not available)
+
+static unsigned long long now_cycles(void)
+    {
+#if HAVE_TSC
+    return __rdtsc();
+#else
+    return 0ULL;
+#endif
+    }
+
+
+// Checks crc_calculate() against reference for all lengths and offsets
+// up to a limit, plus the standard "123456789" check value (0x31C3)
+// Returns number of mismatches found
+
+static int check_method(void)
+    {
+    size_t len;
+    size_t offset;
+    int errors;
+
+    errors = 0;
+
+    if (crc_calculate("123456789", 9) != 0x31C3)
+        {
+        printf("Check value mismatch\n");
+        ++errors;
+        }
+
+    for (offset = 0; offset < 8; ++offset)
+        {
+        for (len = 0; len <= 300; ++len)
+            {
+            if (crc_calculate(test_buf + offset, len) !=
+                crc_reference(test_buf + offset, len))
+                {
+                printf("Mismatch at offset %u, length %u\n",
+                        (unsigned) offset, (unsigned) len);
+                ++errors;
+                }
+            }
+        }
+
+    return errors;
+    }
+
+
+// Times crc_calculate() over repeated blocks of given length
+
+static void time_method(size_t blk_len)
+    {
+    unsigned long iters;
+    unsigned long i;
+    unsigned int sink;
+    unsigned long long c0, c1;
+    double t0, t1;
+    double ns_per_byte;
+    double cyc_per_byte;
+
+    iters = TARGET_BYTES / blk_len;
+    sink = 0;
+
+    t0 = now_ns();
+    c0 = now_cycles();
+
+    for (i = 0; i < iters; ++i)
+        {
+        test_buf[0] = (unsigned char) i;            // Defeat loop hoisting
+        sink ^= crc_calculate(test_buf, blk_len);
+        }
+
+    c1 = now_cycles();
+    t1 = now_ns();
+
+    ns_per_byte = (t1 - t0) / ((double) iters * blk_len);
+
+    if (HAVE_TSC)
+        cyc_per_byte = (double) (c1 - c0) / ((double) iters * blk_len);
+    else
+        cyc_per_byte = ns_per_byte;                 // Assume 1 GHz
+
+    printf("  %4u-byte blocks: %6.2f cycles/byte, %6.3f ns/byte (%04X)\n",
+            (unsigned) blk_len, cyc_per_byte, ns_per_byte, sink);
+    }
+
+
+int main(void)
+    {
+    size_t i;
+    int errors;
+
+    srand(12345);
+
+    for (i = 0; i < sizeof(test_buf); ++i)
+        test_buf[i] = (unsigned char) rand();
+
+    printf("CRC_METHOD_%s:\n", method_names[CRC_METHOD]);
+
+    errors = check_method();
+
+    if (errors != 0)
+        {
+        printf("  FAILED (%d mismatches against reference)\n", errors);
+        return 1;
+        }
+
+    printf("  Results match bit-by-bit reference calculation\n");
+
+    time_method(LOOP_BLK_LEN);
+    time_method(LARGE_BLK_LEN);
+
+    return 0;
+    }
@@ -0,0 +1,988 @@
+// Host simulator of Davis Vantage console for benchmarking davis.c
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+// Builds and runs on a host PC (not on the Rabbit module), for example:
+//
+//   cc -O2 -pthread -Ihost -I../code -o dav_sim dav_sim.c ../code/davis.c ../code/crc.c
+//   ./dav_sim [-n runs] [-p profile] [-o collect|loop2|batch|stream]
+//             [-i loop_ms] [-w awake_ms] [-g gap_ms] [-t tick_us] [-s seed]
+//             [-H] [-v]
+//
+// A pseudo-terminal is opened and a thread on its master side behaves like
+// a Vantage console at 19200 baud: wakeup, ACK/NAK, LOOP/LPS packets with
+// valid CRCs, GETTIME/SETTIME, BAR and text commands.  The unmodified
+// davis.c state machine runs against the slave side through the serial
+// port E stand-ins below (see host/Rabbit.h).
+//
+// Each fault profile adds response latency, dropped bytes, corrupted CRCs
+// and/or ignored wakeups.  For each profile the chosen operation is run
+// repeatedly and the success rate, latency of successful runs (from start
+// to completion) and failure codes are reported.  The "stream" operation
+// counts as successful when STREAM_SAMPLES samples have been read in
+// streaming mode (use -i to shorten the 2 second interval between packets).
+// With -H, the per-phase timing histograms kept by davis.c are shown after
+// the results for each profile.
+//
+// With -w, the console goes to sleep after awake_ms without serial activity,
+// and the first character it then receives only wakes it up (a wakeup LF
+// being answered as usual), so a command sent to a sleeping console is
+// garbled.  Use -g to set the gap between runs (default 20 ms) either side
+// of awake_ms to exercise commands sent with and without a wakeup.
+
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "Rabbit.h"
+#include "crc.h"
+#include "report.h"
+#include "rtc_utils.h"
+#include "wx_board.h"
+#include "davis.h"
+
+
+// Fault profiles
+
+typedef struct
+    {
+    const char * name;
+    unsigned int latency_ms;            // Delay before each response
+    double drop_rate;                   // Fraction of response bytes dropped
+    double crc_rate;                    // Fraction of packets with corrupted CRC
+    double wake_fail_rate;              // Fraction of wakeups ignored
+    } Profile_t;
+
+static const Profile_t profiles[] =
+    {
+    { "clean",      0,      0.0,    0.0,    0.0 },
+    { "slow",       250,    0.0,    0.0,    0.0 },
+    { "lossy",      0,      0.002,  0.0,    0.0 },
+    { "crc",        0,      0.0,    0.2,    0.0 },
+    { "sleepy",     0,      0.0,    0.0,    0.5 },
+    { "hostile",    150,    0.001,  0.1,    0.3 },
+    };
+
+#define NUM_PROFILES    (sizeof(profiles) / sizeof(profiles[0]))
+
+
+// Operations that can be benchmarked
+
+enum op_value
+    {
+    OP_COLLECT = 0,                     // Single LOOP packet
+    OP_LOOP2,                           // Single LOOP2 packet ("LPS 2 1")
+    OP_BATCH,                           // LOOP + GETTIME + BAR under one wakeup
+    OP_STREAM,                          // STREAM_SAMPLES samples in streaming mode
+    };
+
+
+// Timing of serial line and console
+
+#define BYTE_US         521             // One 10-bit character at 19200 baud
+#define CHUNK_BYTES     16              // Bytes written between pacing delays
+#define LOOP_MS         2000            // Default interval between packets from "LOOP n"
+#define SETTIME_MS      2000            // Wait for time bytes after SETTIME
+
+#define MAX_RUNS        1000
+#define STREAM_SAMPLES  20
+
+#define CON_ACK         0x06            // Console responses
+#define CON_NAK         0x21
+
+
+// Simulated console state (owned by console thread)
+
+static struct
+    {
+    int fd;                             // Master side of pseudo-terminal
+    const Profile_t * profile;          // Current fault profile
+    unsigned int seed;                  // Random number state
+
+    char line[64];                      // Command line being received
+    unsigned int line_len;
+
+    unsigned int stream_left;           // Packets still to send for LOOP/LPS
+    unsigned int stream_mask;           // 1 = LOOP, 2 = LOOP2, 3 = alternate
+    unsigned int stream_seq;            // Packets sent so far in stream
+    unsigned long stream_next;          // Time to send next packet
+    unsigned long loop_ms;              // Interval between packets
+
+    unsigned char settime[8];           // Time bytes after SETTIME
+    unsigned int settime_len;
+    unsigned long settime_tout;         // Zero if not waiting for time bytes
+
+    long clock_offset;                  // Console clock minus host clock (secs)
+    unsigned long awake_ms;             // Time awake after activity (0 = always)
+    unsigned long last_active;          // Time of last serial activity
+    unsigned int sample;                // Counter used to vary readings
+
+    volatile int stop;
+    pthread_mutex_t lock;
+    } sim;
+
+
+// Host side of serial port E
+
+static int slave_fd = -1;
+static int verbose;
+static int show_hist;                   // Show timing histograms for each profile
+static int showing;                     // Set while histograms are being shown
+
+FILE * SerialE;
+
+
+// Stand-ins for other node controller modules used by davis.c
+
+char rtc_validated = 1;
+
+
+// *** INTERNAL FUNCTIONS ***
+
+// Returns milliseconds from monotonic clock
+
+static unsigned long now_ms(void)
+    {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long) ts.tv_sec * 1000UL + (unsigned long) ts.tv_nsec / 1000000UL;
+    }
+
+
+// Sleeps for given number of microseconds
+
+static void sleep_us(unsigned long us)
+    {
+    struct timespec ts;
+
+    ts.tv_sec = us / 1000000UL;
+    ts.tv_nsec = (us % 1000000UL) * 1000UL;
+    nanosleep(&ts, NULL);
+    }
+
+
+// Returns !0 with given probability
+
+static int chance(double rate)
+    {
+    if (rate <= 0.0)
+        return 0;
+
+    return ((double) rand_r(&sim.seed) / ((double) RAND_MAX + 1.0)) < rate;
+    }
+
+
+// Writes response bytes to serial line at line rate, dropping bytes as
+// required by fault profile
+
+static void sim_write(const unsigned char * buf, size_t len)
+    {
+    unsigned char chunk[CHUNK_BYTES];
+    size_t count;
+    size_t i;
+
+    while (len != 0)
+        {
+        count = 0;
+
+        for (i = 0; i < CHUNK_BYTES && len != 0; ++i, --len, ++buf)
+            {
+            if (!chance(sim.profile->drop_rate))
+                chunk[count++] = *buf;
+            }
+
+        if (count != 0 && write(sim.fd, chunk, count) < 0)
+            return;
+
+        sleep_us((unsigned long) i * BYTE_US);
+        }
+
+    sim.last_active = now_ms();
+    }
+
+
+// Waits for response latency of fault profile
+
+static void sim_delay(void)
+    {
+    if (sim.profile->latency_ms != 0)
+        sleep_us(sim.profile->latency_ms * 1000UL);
+    }
+
+
+// Sends a single character response
+
+static void sim_send_char(unsigned char ch)
+    {
+    sim_delay();
+    sim_write(&ch, 1);
+    }
+
+
+// Sends a text response
+
+static void sim_send_text(const char * str)
+    {
+    sim_delay();
+    sim_write((const unsigned char *) str, strlen(str));
+    }
+
+
+// Stores word LSB first
+
+static void put_word(unsigned char * ptr, unsigned int value)
+    {
+    ptr[0] = value & 0xFF;
+    ptr[1] = (value >> 8) & 0xFF;
+    }
+
+
+// Appends CRC (MSB first) to block, corrupting it as required by fault profile
+
+static void add_crc(unsigned char * buf, size_t len)
+    {
+    unsigned int crc;
+
+    crc = crc_calculate(buf, len);
+
+    if (chance(sim.profile->crc_rate))
+        crc ^= 0x0100;
+
+    buf[len] = (crc >> 8) & 0xFF;
+    buf[len + 1] = crc & 0xFF;
+    }
+
+
+// Sends a LOOP (type 0) or LOOP2 (type 1) packet with slowly varying readings
+
+static void sim_send_packet(int type)
+    {
+    unsigned char buf[DAV_DATA_LEN];
+    unsigned int var;
+
+    var = sim.sample++ % 20;
+
+    memset(buf, 0, sizeof(buf));
+
+    buf[0] = 'L';
+    buf[1] = 'O';
+    buf[2] = 'O';
+    buf[4] = type;
+
+    put_word(&buf[7], 29921 + var);             // Barometer
+    put_word(&buf[9], 705);                     // Inside temperature
+    buf[11] = 45;                               // Inside humidity
+    put_word(&buf[12], 623 + var);              // Outside temperature
+    buf[14] = 5 + (var % 4);                    // Wind speed
+    put_word(&buf[16], 250 + var);              // Wind direction
+    buf[33] = 78;                               // Outside humidity
+    put_word(&buf[41], 0);                      // Rain rate
+    buf[43] = 0xFF;                             // No UV sensor
+    put_word(&buf[44], 0x7FFF);                 // No solar sensor
+    put_word(&buf[46], 0);                      // Storm rain
+    put_word(&buf[50], 12);                     // Day rain
+
+    if (type == 0)
+        buf[15] = 4;                            // 10 minute average wind speed
+    else
+        {
+        put_word(&buf[18], 42);                 // 10 minute average (mph x 10)
+        put_word(&buf[20], 47);                 // 2 minute average (mph x 10)
+        put_word(&buf[22], 12);                 // 10 minute gust
+        put_word(&buf[24], 260);                // Gust direction
+        put_word(&buf[30], 56);                 // Dew point
+        put_word(&buf[35], 62);                 // Heat index
+        put_word(&buf[37], 61);                 // Wind chill
+        put_word(&buf[67], 29850 + var);        // Absolute barometer
+        }
+
+    buf[95] = '\n';
+    buf[96] = '\r';
+
+    add_crc(buf, DAV_DATA_LEN - 2);
+
+    sim_delay();
+    sim_write(buf, sizeof(buf));
+    }
+
+
+// Sends next packet of LOOP or LPS stream
+
+static void sim_stream_packet(void)
+    {
+    int type;
+
+    if (sim.stream_mask == 3)
+        type = sim.stream_seq & 1;
+    else
+        type = (sim.stream_mask == 2);
+
+    sim_send_packet(type);
+
+    ++sim.stream_seq;
+    --sim.stream_left;
+    sim.stream_next = now_ms() + sim.loop_ms;
+    }
+
+
+// Sends console time (GETTIME response)
+
+static void sim_send_time(void)
+    {
+    unsigned char buf[8];
+    time_t now_val;
+    struct tm * now_ptr;
+
+    now_val = time(NULL) + sim.clock_offset;
+    now_ptr = gmtime(&now_val);
+
+    buf[0] = now_ptr->tm_sec;
+    buf[1] = now_ptr->tm_min;
+    buf[2] = now_ptr->tm_hour;
+    buf[3] = now_ptr->tm_mday;
+    buf[4] = now_ptr->tm_mon + 1;
+    buf[5] = now_ptr->tm_year;
+
+    add_crc(buf, 6);
+
+    sim_write(buf, sizeof(buf));
+    }
+
+
+// Checks time bytes received after SETTIME and sets console clock
+
+static void sim_set_time(void)
+    {
+    struct tm set_time;
+
+    sim.settime_tout = 0;
+
+    if (crc_calculate(sim.settime, 6) != (((unsigned int) sim.settime[6] << 8) | sim.settime[7]))
+        {
+        sim_send_char(CON_NAK);
+        return;
+        }
+
+    memset(&set_time, 0, sizeof(set_time));
+    set_time.tm_sec = sim.settime[0];
+    set_time.tm_min = sim.settime[1];
+    set_time.tm_hour = sim.settime[2];
+    set_time.tm_mday = sim.settime[3];
+    set_time.tm_mon = sim.settime[4] - 1;
+    set_time.tm_year = sim.settime[5];
+
+    sim.clock_offset = (long) (mktime(&set_time) - time(NULL));
+
+    sim_send_char(CON_ACK);
+    }
+
+
+// Processes a complete command line
+
+static void sim_command(char * cmd)
+    {
+    int count;
+    int mask;
+
+    if (strncmp(cmd, "LOOP ", 5) == 0 && sscanf(cmd + 5, "%d", &count) == 1 && count > 0)
+        {
+        sim_send_char(CON_ACK);
+        sim.stream_mask = 1;
+        sim.stream_left = count;
+        sim.stream_seq = 0;
+        sim.stream_next = now_ms();
+        }
+    else if (sscanf(cmd, "LPS %d %d", &mask, &count) == 2 && (mask & 3) != 0 && count > 0)
+        {
+        sim_send_char(CON_ACK);
+        sim.stream_mask = mask & 3;
+        sim.stream_left = count;
+        sim.stream_seq = 0;
+        sim.stream_next = now_ms();
+        }
+    else if (strcmp(cmd, "GETTIME") == 0)
+        {
+        sim_send_char(CON_ACK);
+        sim_send_time();
+        }
+    else if (strcmp(cmd, "SETTIME") == 0)
+        {
+        sim_send_char(CON_ACK);
+        sim.settime_len = 0;
+        sim.settime_tout = now_ms() + SETTIME_MS;
+        }
+    else if (strncmp(cmd, "BAR=", 4) == 0)
+        sim_send_text("\n\rOK\n\r");
+    else if (strcmp(cmd, "BARDATA") == 0)
+        sim_send_text("\n\rOK\n\rBAR 29921\n\rELEVATION 0\n\rDEW POINT 56\n\r"
+                      "VIRTUAL TEMP 62\n\rC 29\n\rR 1001\n\rBARCAL 0\n\r"
+                      "GAIN 1100\n\rOFFSET 0\n\r");
+    else if (strcmp(cmd, "VER") == 0)
+        sim_send_text("\n\rOK\n\rApr 24 2002\n\r");
+    else if (strcmp(cmd, "NVER") == 0)
+        sim_send_text("\n\rOK\n\r1.90\n\r");
+    else if (strcmp(cmd, "TEST") == 0)
+        sim_send_text("\n\rTEST\n\r");
+    else
+        sim_send_char(CON_NAK);
+    }
+
+
+// Processes a character received by the console
+
+static void sim_receive(unsigned char ch)
+    {
+    if (sim.awake_ms != 0 && now_ms() - sim.last_active > sim.awake_ms)
+        {
+        sim.last_active = now_ms();             // Character wakes console...
+        sim.line_len = 0;
+
+        if (ch == '\n' && !chance(sim.profile->wake_fail_rate))
+            sim_send_text("\n\r");              // ...but only LF is answered
+        return;
+        }
+
+    sim.last_active = now_ms();
+
+    if (sim.stream_left != 0)
+        {
+        sim.stream_left = 0;                    // Any character cancels stream
+        return;
+        }
+
+    if (sim.settime_tout != 0)
+        {
+        sim.settime[sim.settime_len++] = ch;
+        if (sim.settime_len >= sizeof(sim.settime))
+            sim_set_time();
+        return;
+        }
+
+    if (ch == '\r')
+        return;
+
+    if (ch == '\n')
+        {
+        if (sim.line_len == 0)
+            {
+            if (!chance(sim.profile->wake_fail_rate))
+                sim_send_text("\n\r");          // Wakeup response
+            }
+        else
+            {
+            sim.line[sim.line_len] = '\0';
+            sim.line_len = 0;
+            sim_command(sim.line);
+            }
+        return;
+        }
+
+    if (sim.line_len < sizeof(sim.line) - 1)
+        sim.line[sim.line_len++] = ch;
+    }
+
+
+// Console thread
+
+static void * sim_thread(void * arg)
+    {
+    struct pollfd pfd;
+    unsigned char buf[64];
+    ssize_t count;
+    ssize_t i;
+
+    (void) arg;
+
+    pfd.fd = sim.fd;
+    pfd.events = POLLIN;
+
+    while (!sim.stop)
+        {
+        if (poll(&pfd, 1, 2) > 0 && (pfd.revents & POLLIN))
+            {
+            count = read(sim.fd, buf, sizeof(buf));
+
+            pthread_mutex_lock(&sim.lock);
+            for (i = 0; i < count; ++i)
+                sim_receive(buf[i]);
+            pthread_mutex_unlock(&sim.lock);
+            }
+
+        pthread_mutex_lock(&sim.lock);
+
+        if (sim.stream_left != 0 && (long) (now_ms() - sim.stream_next) >= 0)
+            sim_stream_packet();
+
+        if (sim.settime_tout != 0 && (long) (now_ms() - sim.settime_tout) >= 0)
+            sim.settime_tout = 0;               // Give up waiting for time bytes
+
+        pthread_mutex_unlock(&sim.lock);
+        }
+
+    return NULL;
+    }
+
+
+// Opens pseudo-terminal in raw mode
+// Returns 0 if okay, or -1 on failure
+
+static int open_pty(void)
+    {
+    struct termios tio;
+    char * name;
+
+    sim.fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (sim.fd < 0 || grantpt(sim.fd) != 0 || unlockpt(sim.fd) != 0)
+        return -1;
+
+    name = ptsname(sim.fd);
+
+    if (name == NULL)
+        return -1;
+
+    slave_fd = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if (slave_fd < 0 || tcgetattr(slave_fd, &tio) != 0)
+        return -1;
+
+    cfmakeraw(&tio);
+
+    return tcsetattr(slave_fd, TCSANOW, &tio);
+    }
+
+
+// Starts the selected operation
+
+static void start_op(enum op_value op)
+    {
+    switch (op)
+        {
+        case OP_LOOP2:
+            dav_start_collect_loop2();
+            break;
+
+        case OP_STREAM:
+            dav_start_stream();
+            break;
+
+        case OP_BATCH:
+            dav_begin_batch();
+            dav_start_collect();
+            dav_start_check_time();
+            dav_start_set_bar(29921, 0);
+            dav_run_batch();
+            break;
+
+        default:
+            dav_start_collect();
+            break;
+        }
+    }
+
+
+// Runs operation until it completes
+// Streaming is stopped once enough samples have been read
+// Returns number of samples read (streaming only)
+
+static unsigned int run_op(enum op_value op, unsigned long tick_us)
+    {
+    DavSample_t sample;
+    unsigned int samples;
+
+    samples = 0;
+
+    while (dav_tick() == DAV_PENDING)
+        {
+        while (op == OP_STREAM && dav_read_sample(&sample))
+            ++samples;
+
+        if (samples >= STREAM_SAMPLES)
+            {
+            dav_abort();
+            break;
+            }
+
+        sleep_us(tick_us);
+        }
+
+    return samples;
+    }
+
+
+// Checks whether the operation just completed was successful
+
+static int op_succeeded(enum op_value op, unsigned int samples)
+    {
+    unsigned char index;
+
+    if (op == OP_STREAM)
+        return (samples >= STREAM_SAMPLES);
+
+    if (op != OP_BATCH)
+        return (dav_get_status() > 0);
+
+    for (index = 0; index < dav_get_batch_count(); ++index)
+        {
+        if (dav_get_cmd_status(index) <= 0)
+            return 0;
+        }
+
+    return 1;
+    }
+
+
+// Compares latencies for qsort()
+
+static int cmp_latency(const void * a, const void * b)
+    {
+    unsigned long la = *(const unsigned long *) a;
+    unsigned long lb = *(const unsigned long *) b;
+
+    return (la > lb) - (la < lb);
+    }
+
+
+// Runs operation repeatedly under fault profile and prints one line of results
+
+static void run_profile(const Profile_t * profile, unsigned int runs,
+                        enum op_value op, unsigned long tick_us, unsigned long gap_us)
+    {
+    static unsigned long latency[MAX_RUNS];
+    int fail_code[16];
+    unsigned int fail_count[16];
+    unsigned int num_codes;
+    unsigned int ok;
+    unsigned int run;
+    unsigned int i;
+    unsigned long start;
+    unsigned long total;
+    unsigned int samples;
+    int status;
+
+    pthread_mutex_lock(&sim.lock);
+    sim.profile = profile;
+    pthread_mutex_unlock(&sim.lock);
+
+    dav_clear_stats();
+
+    ok = 0;
+    total = 0;
+    num_codes = 0;
+
+    for (run = 0; run < runs; ++run)
+        {
+        start = getMilliSeconds();
+        start_op(op);
+
+        samples = run_op(op, tick_us);
+
+        if (op_succeeded(op, samples))
+            {
+            latency[ok] = getMilliSeconds() - start;
+            total += latency[ok];
+            ++ok;
+            }
+        else
+            {
+            status = dav_get_status();
+
+            for (i = 0; i < num_codes && fail_code[i] != status; ++i)
+                ;
+
+            if (i == num_codes && num_codes < 16)
+                {
+                fail_code[num_codes] = status;
+                fail_count[num_codes++] = 0;
+                }
+
+            if (i < num_codes)
+                ++fail_count[i];
+
+            sleep_us(1000000);                  // Let any stale output drain
+            }
+
+        sleep_us(gap_us);                       // Let console settle
+        }
+
+    printf("%-9s %5u %5u %6.1f%%", profile->name, runs, ok, 100.0 * ok / runs);
+
+    if (ok != 0)
+        {
+        qsort(latency, ok, sizeof(latency[0]), cmp_latency);
+        printf(" %7lu %7lu %7lu %7lu %7lu ", latency[0], total / ok,
+                latency[ok / 2], latency[(ok * 95) / 100 < ok ? (ok * 95) / 100 : ok - 1],
+                latency[ok - 1]);
+        }
+    else
+        printf(" %7s %7s %7s %7s %7s ", "-", "-", "-", "-", "-");
+
+    for (i = 0; i < num_codes; ++i)
+        printf(" %d x%u", fail_code[i], fail_count[i]);
+
+    printf("\n");
+
+    if (show_hist)
+        {
+        showing = 1;
+        dav_show_stats();
+        showing = 0;
+        }
+
+    fflush(stdout);
+    }
+
+
+// *** EXTERNAL FUNCTIONS (stand-ins for Rabbit library and other modules) ***
+
+unsigned long getMilliSeconds(void)
+    {
+    return now_ms();
+    }
+
+unsigned long getSeconds(void)
+    {
+    return now_ms() / 1000UL;
+    }
+
+char SerialInitE(long baud, int mode, int priority,
+                 char * in_buf, int in_size, char * out_buf, int out_size)
+    {
+    (void) baud; (void) mode; (void) priority;
+    (void) in_buf; (void) in_size; (void) out_buf; (void) out_size;
+
+    if (SerialE == NULL)
+        {
+        SerialE = fdopen(dup(slave_fd), "r+");
+        if (SerialE == NULL)
+            return 0;
+        setvbuf(SerialE, NULL, _IONBF, 0);
+        }
+
+    return 1;
+    }
+
+int SerialGetcE(void)
+    {
+    unsigned char ch;
+
+    return (read(slave_fd, &ch, 1) == 1) ? ch : EOF;
+    }
+
+int SerialPutcE(int ch)
+    {
+    unsigned char byte = ch;
+
+    return (write(slave_fd, &byte, 1) == 1) ? ch : EOF;
+    }
+
+unsigned int SerialRecvCountE(void)
+    {
+    int count;
+
+    if (ioctl(slave_fd, FIONREAD, &count) != 0)
+        return 0;
+
+    return (unsigned int) count;
+    }
+
+int SerialErrorE(void)
+    {
+    return 0;
+    }
+
+void SerialSendFlushE(void)
+    {
+    tcflush(slave_fd, TCOFLUSH);
+    }
+
+void SerialRecvFlushE(void)
+    {
+    tcflush(slave_fd, TCIFLUSH);
+    }
+
+void report(unsigned char type_flags, const char * fmt, ...)
+    {
+    va_list args;
+
+    if (!verbose && !showing)
+        return;
+
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+
+    if (!(type_flags & REPORT_RAW))
+        printf("\n");
+    }
+
+unsigned long rtc_diff(time_t comp_val)
+    {
+    time_t rtc_val;
+
+    rtc_val = time(NULL);
+
+    return (rtc_val >= comp_val) ? rtc_val - comp_val : comp_val - rtc_val;
+    }
+
+void wx_set_leds(unsigned char mask, unsigned char new_state)
+    {
+    (void) mask; (void) new_state;
+    }
+
+void wx_set_dtr_true(void)
+    {
+    }
+
+void wx_set_rts_true(void)
+    {
+    }
+
+
+int main(int argc, char ** argv)
+    {
+    pthread_t thread;
+    const char * only;
+    const char * op_name;
+    enum op_value op;
+    unsigned int runs;
+    unsigned long tick_us;
+    unsigned long gap_us;
+    unsigned int i;
+    int opt;
+
+    runs = 20;
+    tick_us = 1000;
+    gap_us = 20000;
+    only = NULL;
+    op = OP_COLLECT;
+    op_name = "collect";
+    sim.seed = 12345;
+    sim.loop_ms = LOOP_MS;
+
+    while ((opt = getopt(argc, argv, "n:p:o:i:w:g:t:s:Hv")) != -1)
+        {
+        switch (opt)
+            {
+            case 'n':
+                runs = atoi(optarg);
+                break;
+
+            case 'p':
+                only = optarg;
+                break;
+
+            case 'o':
+                op_name = optarg;
+                if (strcmp(optarg, "loop2") == 0)
+                    op = OP_LOOP2;
+                else if (strcmp(optarg, "batch") == 0)
+                    op = OP_BATCH;
+                else if (strcmp(optarg, "stream") == 0)
+                    op = OP_STREAM;
+                else if (strcmp(optarg, "collect") != 0)
+                    {
+                    fprintf(stderr, "Unknown operation '%s'\n", optarg);
+                    return 2;
+                    }
+                break;
+
+            case 'i':
+                sim.loop_ms = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'w':
+                sim.awake_ms = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'g':
+                gap_us = strtoul(optarg, NULL, 10) * 1000UL;
+                break;
+
+            case 't':
+                tick_us = strtoul(optarg, NULL, 10);
+                break;
+
+            case 's':
+                sim.seed = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'H':
+                show_hist = 1;
+                break;
+
+            case 'v':
+                verbose = 1;
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-n runs] [-p profile] [-o collect|loop2|batch|stream]"
+                                " [-i loop_ms] [-w awake_ms] [-g gap_ms] [-t tick_us] [-s seed] [-H] [-v]\n", argv[0]);
+                return 2;
+            }
+        }
+
+    if (runs == 0 || runs > MAX_RUNS)
+        {
+        fprintf(stderr, "Number of runs must be 1 to %u\n", MAX_RUNS);
+        return 2;
+        }
+
+    setenv("TZ", "UTC", 1);                     // Console clock is kept in UTC
+    tzset();
+
+    if (open_pty() != 0)
+        {
+        perror("Cannot open pseudo-terminal");
+        return 1;
+        }
+
+    pthread_mutex_init(&sim.lock, NULL);
+    sim.profile = &profiles[0];
+
+    if (pthread_create(&thread, NULL, sim_thread, NULL) != 0)
+        {
+        perror("Cannot start console thread");
+        return 1;
+        }
+
+    if (dav_init_all() != 0)
+        {
+        fprintf(stderr, "dav_init_all() failed\n");
+        return 1;
+        }
+
+    printf("Operation '%s', %u runs per profile, %lu us between dav_tick() calls\n",
+            op_name, runs, tick_us);
+    printf("Latency of successful runs in ms; failures listed as status code x count\n\n");
+    printf("%-9s %5s %5s %7s %7s %7s %7s %7s %7s  %s\n", "Profile", "Runs", "OK",
+            "Success", "Min", "Avg", "P50", "P95", "Max", "Failures");
+
+    for (i = 0; i < NUM_PROFILES; ++i)
+        {
+        if (only == NULL || strcmp(only, profiles[i].name) == 0)
+            run_profile(&profiles[i], runs, op, tick_us, gap_us);
+        }
+
+    sim.stop = 1;
+    pthread_join(thread, NULL);
+
+    return 0;
+    }
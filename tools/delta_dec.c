@@ -0,0 +1,562 @@
+// Host reference decoder for delta-encoded LOOP packets in POST bodies
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+// Builds and runs on a host PC (not on the Rabbit module), for example:
+//
+//   cc -O2 -I../code -o delta_dec delta_dec.c ../code/delta.c ../code/crc.c
+//   ./delta_dec < bodies.txt        (decode POST bodies, one per line)
+//   ./delta_dec -t                  (self-test with simulated readings)
+//
+// POST bodies from a node built with DELTA_UPLOAD = 1 carry either a full
+// LOOP packet as "data" (a keyframe, identified by the "seq" value of its
+// POST) or a "delta" against the keyframe whose sequence number is given
+// by "kseq".  Each packet is rebuilt, checked against its CRC and printed
+// in hex.  A few keyframes are kept for each station, because a node only
+// refers to a keyframe after its POST has been acknowledged, so the latest
+// one received may not yet be in use.
+//
+// The self-test builds a series of LOOP packets from slowly changing
+// readings, encodes them with the same keyframe rules as tasks.c (some
+// POSTs being lost), decodes the resulting bodies and reports the size of
+// the data part of each body with and without delta encoding.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "crc.h"
+#include "delta.h"
+
+
+#define DATA_LEN            99              // LOOP packet length (as davis.h)
+
+#define MAX_STATIONS        64
+#define KEYS_PER_STATION    4
+
+#define MAX_BODY_LEN        2048
+
+#define TEST_POSTS          2000
+#define TEST_LOSS_PCT       5               // Percentage of POSTs lost
+
+
+// Keyframes held for each station
+
+typedef struct
+    {
+    unsigned int station;
+    unsigned int used;                      // Number of keyframes held
+    unsigned int next;                      // Slot for next keyframe
+    unsigned long seq[KEYS_PER_STATION];
+    unsigned char data[KEYS_PER_STATION][DATA_LEN];
+    } Station_t;
+
+static Station_t stations[MAX_STATIONS];
+static unsigned int num_stations;
+
+
+// Variables of interest from one POST body
+
+typedef struct
+    {
+    unsigned int station;
+    unsigned long seq;
+    unsigned long kseq;
+    int have_seq;
+    int have_kseq;
+    unsigned char blk[DELTA_MAX_LEN(DATA_LEN)];
+    unsigned int blk_len;
+    int kind;                               // 0 = none, 1 = data, 2 = delta
+    } Body_t;
+
+
+// Decoding results
+
+static unsigned long n_key, n_delta, n_no_key, n_bad;
+
+
+// Returns value of hex digit, or -1 if not a hex digit
+
+static int hex_val(int ch)
+    {
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    if (ch >= 'A' && ch <= 'F')
+        return ch - 'A' + 10;
+    if (ch >= 'a' && ch <= 'f')
+        return ch - 'a' + 10;
+    return -1;
+    }
+
+
+// Decodes URL-encoded string in place
+
+static void url_decode(char * str)
+    {
+    char * out;
+
+    for (out = str; *str != '\0'; ++str)
+        {
+        if (*str == '+')
+            *out++ = ' ';
+        else if (*str == '%' && hex_val(str[1]) >= 0 && hex_val(str[2]) >= 0)
+            {
+            *out++ = (char) (hex_val(str[1]) * 16 + hex_val(str[2]));
+            str += 2;
+            }
+        else
+            *out++ = *str;
+        }
+
+    *out = '\0';
+    }
+
+
+// Converts hex string to bytes
+// Returns number of bytes, or -1 if string is not valid or too long
+
+static int hex_to_bytes(const char * str, unsigned char * out, unsigned int max)
+    {
+    unsigned int len;
+
+    for (len = 0; str[0] != '\0'; str += 2, ++len)
+        {
+        if (len >= max || hex_val(str[0]) < 0 || hex_val(str[1]) < 0)
+            return -1;
+
+        out[len] = (unsigned char) (hex_val(str[0]) * 16 + hex_val(str[1]));
+        }
+
+    return (int) len;
+    }
+
+
+// Splits POST body into variables of interest
+// Returns 0 if okay, or -1 if body is not valid
+
+static int parse_body(char * text, Body_t * body)
+    {
+    char * pair;
+    char * value;
+    int len;
+
+    memset(body, 0, sizeof(*body));
+
+    for (pair = strtok(text, "&\r\n"); pair != NULL; pair = strtok(NULL, "&\r\n"))
+        {
+        value = strchr(pair, '=');
+        if (value == NULL)
+            continue;
+
+        *value++ = '\0';
+        url_decode(value);
+
+        if (strcmp(pair, "station") == 0)
+            body->station = (unsigned int) strtoul(value, NULL, 10);
+        else if (strcmp(pair, "seq") == 0)
+            {
+            body->seq = strtoul(value, NULL, 10);
+            body->have_seq = 1;
+            }
+        else if (strcmp(pair, "kseq") == 0)
+            {
+            body->kseq = strtoul(value, NULL, 10);
+            body->have_kseq = 1;
+            }
+        else if (strcmp(pair, "data") == 0 || strcmp(pair, "delta") == 0)
+            {
+            len = hex_to_bytes(value, body->blk, sizeof(body->blk));
+            if (len < 0)
+                return -1;
+
+            body->blk_len = (unsigned int) len;
+            body->kind = (pair[1] == 'a') ? 1 : 2;
+            }
+        }
+
+    return 0;
+    }
+
+
+// Decodes encoded block against keyframe into block of given length
+// (see delta.h for format)
+// Returns 0 if okay, or -1 if encoded length does not match its mask
+
+static int delta_decode(const unsigned char * key, const unsigned char * enc,
+                        unsigned int enc_len, unsigned int len, unsigned char * blk)
+    {
+    const unsigned char * vals;
+    const unsigned char * end;
+    unsigned int i;
+
+    if (enc_len < DELTA_MASK_LEN(len))
+        return -1;
+
+    vals = enc + DELTA_MASK_LEN(len);
+    end = enc + enc_len;
+
+    for (i = 0; i < len; ++i)
+        {
+        if (enc[i >> 3] & (1 << (i & 7)))
+            {
+            if (vals >= end)
+                return -1;
+
+            blk[i] = *vals++;
+            }
+        else
+            blk[i] = key[i];
+        }
+
+    return (vals == end) ? 0 : -1;
+    }
+
+
+// Finds (or adds) keyframe store for station
+// Returns pointer to store, or NULL if too many stations
+
+static Station_t * find_station(unsigned int station)
+    {
+    unsigned int i;
+
+    for (i = 0; i < num_stations; ++i)
+        {
+        if (stations[i].station == station)
+            return &stations[i];
+        }
+
+    if (num_stations >= MAX_STATIONS)
+        return NULL;
+
+    memset(&stations[num_stations], 0, sizeof(stations[0]));
+    stations[num_stations].station = station;
+
+    return &stations[num_stations++];
+    }
+
+
+// Prints packet in hex
+
+static void print_packet(const unsigned char * pkt)
+    {
+    unsigned int i;
+
+    for (i = 0; i < DATA_LEN; ++i)
+        printf("%02X", pkt[i]);
+    }
+
+
+// Rebuilds packet from POST body, checks it and (if verbose) prints it
+// Returns 0 if okay, or -1 if packet could not be rebuilt or is corrupt
+
+static int decode_body(char * text, unsigned char * pkt, int verbose)
+    {
+    Body_t body;
+    Station_t * stn;
+    unsigned int i;
+    unsigned int slot;
+    int found;
+
+    if (parse_body(text, &body) < 0 || body.kind == 0 || !body.have_seq)
+        {
+        ++n_bad;
+        if (verbose)
+            printf("?       bad body\n");
+        return -1;
+        }
+
+    stn = find_station(body.station);
+    if (stn == NULL)
+        {
+        ++n_bad;
+        if (verbose)
+            printf("?       too many stations\n");
+        return -1;
+        }
+
+    if (body.kind == 1)
+        {
+        if (body.blk_len != DATA_LEN)
+            {
+            ++n_bad;
+            if (verbose)
+                printf("%-5u %10lu bad data length\n", body.station, body.seq);
+            return -1;
+            }
+
+        memcpy(pkt, body.blk, DATA_LEN);
+        }
+    else
+        {
+        found = 0;
+
+        for (i = 0; i < stn->used && !found; ++i)
+            {
+            if (stn->seq[i] == body.kseq && body.have_kseq)
+                {
+                found = 1;
+                if (delta_decode(stn->data[i], body.blk, body.blk_len,
+                                 DATA_LEN, pkt) < 0)
+                    {
+                    ++n_bad;
+                    if (verbose)
+                        printf("%-5u %10lu bad delta\n", body.station, body.seq);
+                    return -1;
+                    }
+                }
+            }
+
+        if (!found)
+            {
+            ++n_no_key;
+            if (verbose)
+                printf("%-5u %10lu keyframe %lu not held\n",
+                        body.station, body.seq, body.kseq);
+            return -1;
+            }
+        }
+
+    if (crc_calculate(pkt, DATA_LEN) != 0)
+        {
+        ++n_bad;
+        if (verbose)
+            printf("%-5u %10lu CRC check failed\n", body.station, body.seq);
+        return -1;
+        }
+
+    if (body.kind == 1)
+        {
+        slot = stn->next;
+        stn->seq[slot] = body.seq;
+        memcpy(stn->data[slot], pkt, DATA_LEN);
+
+        stn->next = (slot + 1) % KEYS_PER_STATION;
+        if (stn->used < KEYS_PER_STATION)
+            ++stn->used;
+
+        ++n_key;
+        }
+    else
+        ++n_delta;
+
+    if (verbose)
+        {
+        printf("%-5u %10lu %-5s ", body.station, body.seq,
+                (body.kind == 1) ? "key" : "delta");
+        print_packet(pkt);
+        printf("\n");
+        }
+
+    return 0;
+    }
+
+
+// Appends name and hex value to POST body text
+
+static void add_hex(char * text, const char * name, const unsigned char * blk,
+                    unsigned int len)
+    {
+    char * out;
+    unsigned int i;
+
+    out = text + strlen(text);
+    out += sprintf(out, "%s%s=", (text[0] != '\0') ? "&" : "", name);
+
+    for (i = 0; i < len; ++i)
+        out += sprintf(out, "%02X", blk[i]);
+    }
+
+
+// Builds LOOP packet from simulated readings at given step
+
+static void make_packet(unsigned long step, unsigned char * pkt)
+    {
+    static int out_temp = 523;
+    static int wind = 8;
+    static int dir = 225;
+    static unsigned int bar = 29912;
+    unsigned int crc;
+    unsigned int solar;
+
+    if (rand() % 6 == 0)
+        out_temp += (rand() % 3) - 1;
+    if (rand() % 40 == 0)
+        bar += (rand() % 3) - 1;
+
+    wind += (rand() % 5) - 2;
+    if (wind < 0)
+        wind = 0;
+    if (wind > 40)
+        wind = 40;
+
+    dir += (rand() % 21) - 10;
+    if (dir < 1)
+        dir += 360;
+    if (dir > 360)
+        dir -= 360;
+
+    solar = 400 + (unsigned int) ((step / 4) % 50);
+
+    memset(pkt, 0, DATA_LEN);
+    memcpy(pkt, "LOO", 3);
+    pkt[3] = 0xFF;                          // Bar trend not available
+    pkt[5] = (unsigned char) (step / 30);   // Next archive record
+    pkt[7] = (unsigned char) bar;
+    pkt[8] = (unsigned char) (bar >> 8);
+    pkt[9] = 0xAE;                          // Inside temperature 70.2 F
+    pkt[10] = 0x02;
+    pkt[11] = 45;
+    pkt[12] = (unsigned char) out_temp;
+    pkt[13] = (unsigned char) (out_temp >> 8);
+    pkt[14] = (unsigned char) wind;
+    pkt[15] = 7;
+    pkt[16] = (unsigned char) dir;
+    pkt[17] = (unsigned char) (dir >> 8);
+    pkt[33] = 71;
+    pkt[43] = 31;
+    pkt[44] = (unsigned char) solar;
+    pkt[45] = (unsigned char) (solar >> 8);
+    pkt[95] = '\n';
+    pkt[96] = '\r';
+
+    crc = crc_calculate(pkt, DATA_LEN - 2);
+    pkt[97] = (unsigned char) (crc >> 8);
+    pkt[98] = (unsigned char) crc;
+    }
+
+
+// Encodes simulated packets as a node would, decodes the POST bodies
+// and reports sizes
+// Returns 0 if all packets were rebuilt correctly, or 1 if not
+
+static int self_test(void)
+    {
+    static char text[MAX_BODY_LEN];
+    unsigned char pkt[DATA_LEN];
+    unsigned char out[DATA_LEN];
+    unsigned char key[DATA_LEN];
+    unsigned char enc[DELTA_MAX_LEN(DATA_LEN)];
+    unsigned long seq;
+    unsigned long key_seq;
+    unsigned long full_chars;
+    unsigned long sent_chars;
+    unsigned long delivered;
+    unsigned long mismatches;
+    unsigned int enc_len;
+    unsigned int key_age;
+    int key_valid;
+    int sending_key;
+
+    srand(12345);
+
+    seq = 1000;
+    key_seq = 0;
+    key_age = 0;
+    key_valid = 0;
+    full_chars = sent_chars = delivered = mismatches = 0;
+
+    while (delivered < TEST_POSTS)
+        {
+        make_packet(delivered, pkt);
+
+        // Re-send until delivered (as tasks.c keeps data after a failed POST)
+
+        for (;;)
+            {
+            ++seq;
+            text[0] = '\0';
+            sprintf(text, "station=7");
+
+            sending_key = 1;
+
+            if (key_valid && key_age < DELTA_KEYFRAME_POSTS)
+                {
+                enc_len = delta_encode(key, pkt, DATA_LEN, enc);
+                if (enc_len < DATA_LEN)
+                    {
+                    sprintf(text + strlen(text), "&kseq=%lu", key_seq);
+                    add_hex(text, "delta", enc, enc_len);
+                    ++key_age;
+                    sending_key = 0;
+                    }
+                }
+
+            if (sending_key)
+                add_hex(text, "data", pkt, DATA_LEN);
+
+            sent_chars += strlen(text) - strlen("station=7");
+            full_chars += 1 + strlen("data=") + 2 * DATA_LEN;
+
+            sprintf(text + strlen(text), "&seq=%lu&ver=11", seq);
+
+            if (rand() % 100 < TEST_LOSS_PCT)
+                {
+                // POST lost -- server may or may not have received it
+
+                if (rand() % 2 == 0)
+                    (void) decode_body(text, out, 0);
+                continue;
+                }
+
+            if (decode_body(text, out, 0) < 0 || memcmp(out, pkt, DATA_LEN) != 0)
+                ++mismatches;
+
+            if (sending_key)
+                {
+                memcpy(key, pkt, DATA_LEN);
+                key_seq = seq;
+                key_valid = 1;
+                key_age = 0;
+                }
+            break;
+            }
+
+        ++delivered;
+        }
+
+    printf("Delivered %lu packets in %lu POSTs (%d%% lost)\n",
+            delivered, seq - 1000, TEST_LOSS_PCT);
+    printf("Keyframes %lu, deltas %lu, keyframe not held %lu, bad %lu\n",
+            n_key, n_delta, n_no_key, n_bad);
+    printf("Data part of body: %.1f chars full, %.1f chars delta-encoded (%.1fx smaller)\n",
+            (double) full_chars / (seq - 1000), (double) sent_chars / (seq - 1000),
+            (double) full_chars / sent_chars);
+
+    if (mismatches != 0)
+        {
+        printf("FAILED (%lu packets not rebuilt correctly)\n", mismatches);
+        return 1;
+        }
+
+    printf("All delivered packets rebuilt correctly\n");
+    return 0;
+    }
+
+
+int main(int argc, char * argv[])
+    {
+    static char text[MAX_BODY_LEN];
+    unsigned char pkt[DATA_LEN];
+
+    if (argc > 1 && strcmp(argv[1], "-t") == 0)
+        return self_test();
+
+    if (argc > 1)
+        {
+        fprintf(stderr, "Usage: %s [-t] < bodies\n", argv[0]);
+        return 2;
+        }
+
+    while (fgets(text, sizeof(text), stdin) != NULL)
+        (void) decode_body(text, pkt, 1);
+
+    fprintf(stderr, "Keyframes %lu, deltas %lu, keyframe not held %lu, bad %lu\n",
+            n_key, n_delta, n_no_key, n_bad);
+
+    return (n_no_key != 0 || n_bad != 0) ? 1 : 0;
+    }
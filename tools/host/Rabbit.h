@@ -0,0 +1,49 @@
+// Host stand-in for the Softools <Rabbit.h> header and serial port E routines
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+// Only used when building modules from the code directory into host tools
+// (see dav_sim.c), which supply the implementations of these routines
+
+
+#ifndef RABBIT_H
+#define RABBIT_H
+
+#include <stdio.h>
+
+// Rabbit-specific keywords that have no meaning on a host PC
+
+#define far
+#define _nearcall
+
+// Free-running timers
+
+unsigned long getMilliSeconds(void);
+unsigned long getSeconds(void);
+
+// Serial port E set-up values
+
+#define BR_19200                19200L
+#define SER_8BITS               0
+#define SER_IP2                 2
+
+// Serial port E stream and routines
+
+extern FILE * SerialE;
+
+char SerialInitE(long baud, int mode, int priority,
+                 char * in_buf, int in_size, char * out_buf, int out_size);
+
+int SerialGetcE(void);
+int SerialPutcE(int ch);
+unsigned int SerialRecvCountE(void);
+int SerialErrorE(void);
+void SerialSendFlushE(void);
+void SerialRecvFlushE(void);
+
+#endif
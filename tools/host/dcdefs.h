@@ -0,0 +1,40 @@
+// Host stand-in for the Softools <dcdefs.h> header and related extensions
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+// Only used when building modules from the code directory into host tools
+// (see post_sim.c), which supply the implementation of xalloc()
+
+
+#ifndef DCDEFS_H
+#define DCDEFS_H
+
+#include <stdio.h>
+#include <strings.h>
+#include <time.h>
+#include "Rabbit.h"
+
+// Marks a host build for checks that only the Softools compiler can make
+
+#define HOST_BUILD              1
+
+// Network types
+
+typedef unsigned long longword;
+typedef unsigned short word;
+
+// Extended memory allocation (plain memory on a host PC)
+
+void * xalloc(long size);
+
+// Softools library routines with host equivalents
+
+#define farsprintf              sprintf
+#define strnicmp                strncasecmp
+
+#endif
@@ -0,0 +1,58 @@
+// Host stand-in for the Softools <stcpip.h> TCP/IP header
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+// Only used when building modules from the code directory into host tools
+// (see post_sim.c), which supply the implementations of these routines on
+// top of host sockets.  Only the routines used by post_client.c and
+// dns_cache.c are covered.  IP addresses are in host byte order, as on the
+// Rabbit module.
+
+
+#ifndef STCPIP_H
+#define STCPIP_H
+
+#include "dcdefs.h"
+
+// TCP socket (host socket and state kept by stand-in routines)
+
+typedef struct
+    {
+    int fd;                             // Host socket (-1 if none)
+    int established;                    // Flag indicates connection complete
+    int closed;                         // Flag indicates connection closed or failed
+    } tcp_Socket;
+
+// Socket modes
+
+#define TCP_MODE_ASCII          1
+#define TCP_MODE_BINARY         0
+
+// Results of resolve_name_check()
+
+#define RESOLVE_SUCCESS         1
+#define RESOLVE_AGAIN           0
+#define RESOLVE_FAILED          (-1)
+
+// Function prototypes
+
+int tcp_open(tcp_Socket * s, word lport, longword ina, word port, void * handler);
+int tcp_tick(tcp_Socket * s);
+int sock_established(tcp_Socket * s);
+int sock_bytesready(tcp_Socket * s);
+void sock_mode(tcp_Socket * s, int mode);
+int sock_fastread(tcp_Socket * s, char * dp, int len);
+int sock_xfastwrite(tcp_Socket * s, long dp, int len);
+void sock_abort(tcp_Socket * s);
+
+longword inet_addr(char * dotted_ip);
+int resolve_name_start(char * name);
+int resolve_name_check(int handle, longword * ip);
+int resolve_cancel(int handle);
+
+#endif
@@ -0,0 +1,553 @@
+// Host reference decoder for binary POST bodies
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+// Builds and runs on a host PC (not on the Rabbit module), for example:
+//
+//   cc -O2 -I../code -o post_dec post_dec.c ../code/crc.c
+//   ./post_dec body.bin             (decode a binary POST body)
+//   ./post_dec < body.bin           (same, from standard input)
+//   ./post_dec -t                   (self-test and size comparison)
+//
+// A node built with BINARY_UPLOAD = 1 sends its POST body as a series of
+// fields (tag, length, value) in place of URL-encoded form variables (see
+// "post_client.h" for the format and tags).  Each field is printed on a
+// line of its own in the same name=value form as the variables it replaces,
+// with LOOP packets in hex followed by the result of checking their CRC.
+//
+// The self-test builds a typical body (a collection with aggregated values
+// and a full batch of queued records) in both formats, checks that the
+// binary body decodes back to the same values, and reports the number of
+// bytes taken by each part of the body in each format.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "crc.h"
+
+typedef unsigned short word;                // As used in "post_client.h"
+
+#include "post_client.h"
+
+
+#define DATA_LEN            99              // LOOP packet length (as davis.h)
+#define REC_HDR_LEN         8               // Sequence number and time in record
+
+#define MAX_BODY_LEN        8192
+
+#define TEST_RECS           6               // As OUTQ_RECS_PER_POST in tasks.c
+
+
+// *** Decoding ***
+
+// Reads number of len bytes (LSB-first)
+
+static unsigned long get_number(const unsigned char * ptr, unsigned int len)
+    {
+    unsigned long value;
+
+    value = 0UL;
+
+    while (len--)
+        value = (value << 8) | ptr[len];
+
+    return value;
+    }
+
+
+// Prints bytes in hex
+
+static void print_hex(const unsigned char * ptr, unsigned int len)
+    {
+    while (len--)
+        printf("%02X", *ptr++);
+    }
+
+
+// Prints LOOP packet in hex followed by result of CRC check
+
+static void print_packet(const unsigned char * pkt, unsigned int len)
+    {
+    print_hex(pkt, len);
+
+    if (len != DATA_LEN)
+        printf(" (length %u)\n", len);
+    else if (crc_calculate(pkt, len) != 0)
+        printf(" (CRC BAD)\n");
+    else
+        printf(" (CRC ok)\n");
+    }
+
+
+// Prints value of named field as text if printable, otherwise in hex
+
+static void print_named(const unsigned char * ptr, unsigned int len)
+    {
+    unsigned int name_len;
+    unsigned int i;
+
+    for (name_len = 0; name_len < len && ptr[name_len] != 0; ++name_len)
+        ;
+
+    if (name_len == len)
+        {
+        printf("(named field without terminator)\n");
+        return;
+        }
+
+    printf("%.*s=", (int) name_len, (const char *) ptr);
+
+    ptr += name_len + 1;
+    len -= name_len + 1;
+
+    for (i = 0; i < len && isprint(ptr[i]); ++i)
+        ;
+
+    if (len != 0 && i == len)
+        printf("%.*s\n", (int) len, (const char *) ptr);
+    else
+        {
+        print_hex(ptr, len);
+        printf("\n");
+        }
+    }
+
+
+// Prints one field
+// Returns 0 if okay, or -1 if field has wrong length for its tag
+
+static int print_field(unsigned char tag, const unsigned char * ptr, unsigned int len)
+    {
+    switch (tag)
+        {
+        case POST_TAG_NAMED:
+            print_named(ptr, len);
+            return 0;
+
+        case POST_TAG_STATION:
+            if (len != 2)
+                break;
+            printf("station=%lu\n", get_number(ptr, 2));
+            return 0;
+
+        case POST_TAG_SEQ:
+            if (len != 4)
+                break;
+            printf("seq=%lu\n", get_number(ptr, 4));
+            return 0;
+
+        case POST_TAG_LOCAL_IP:
+            if (len != 4)
+                break;
+            printf("localip=%u.%u.%u.%u\n", ptr[0], ptr[1], ptr[2], ptr[3]);
+            return 0;
+
+        case POST_TAG_VERSION:
+            if (len != 2)
+                break;
+            printf("ver=%u.%02u\n", ptr[0], ptr[1]);
+            return 0;
+
+        case POST_TAG_DATA:
+            printf("data=");
+            print_packet(ptr, len);
+            return 0;
+
+        case POST_TAG_RECORD:
+            if (len < REC_HDR_LEN)
+                break;
+            printf("record seq=%lu time=%lu data=", get_number(ptr, 4),
+                                                   get_number(ptr + 4, 4));
+            print_packet(ptr + REC_HDR_LEN, len - REC_HDR_LEN);
+            return 0;
+
+        default:
+            printf("tag%u=", tag);
+            print_hex(ptr, len);
+            printf("\n");
+            return 0;
+        }
+
+    printf("(tag %u with bad length %u)\n", tag, len);
+    return -1;
+    }
+
+
+// Reads field header at given position in body
+// Returns length of header (2 or 3), or 0 if body is truncated
+
+static unsigned int get_field(const unsigned char * body, unsigned int body_len,
+                              unsigned int pos, unsigned char * tag, unsigned int * len)
+    {
+    unsigned int hdr_len;
+
+    if (pos + 2 > body_len)
+        return 0;
+
+    *tag = body[pos];
+
+    if (body[pos + 1] & 0x80)
+        {
+        if (pos + 3 > body_len)
+            return 0;
+
+        *len = ((body[pos + 1] & 0x7F) << 8) | body[pos + 2];
+        hdr_len = 3;
+        }
+    else
+        {
+        *len = body[pos + 1];
+        hdr_len = 2;
+        }
+
+    if (pos + hdr_len + *len > body_len)
+        return 0;
+
+    return hdr_len;
+    }
+
+
+// Prints all fields in body
+// Returns 0 if okay, or -1 if body is malformed
+
+static int decode_body(const unsigned char * body, unsigned int body_len)
+    {
+    unsigned int pos;
+    unsigned int hdr_len;
+    unsigned int len;
+    unsigned char tag;
+    int result;
+
+    result = 0;
+
+    for (pos = 0; pos < body_len; pos += hdr_len + len)
+        {
+        hdr_len = get_field(body, body_len, pos, &tag, &len);
+
+        if (hdr_len == 0)
+            {
+            printf("(body truncated at byte %u)\n", pos);
+            return -1;
+            }
+
+        if (print_field(tag, body + pos + hdr_len, len) < 0)
+            result = -1;
+        }
+
+    return result;
+    }
+
+
+// *** Self-test ***
+
+// Body being built in both formats
+
+static char form_body[MAX_BODY_LEN];
+static unsigned int form_len;
+
+static unsigned char bin_body[MAX_BODY_LEN];
+static unsigned int bin_len;
+
+
+// Adds form variable as post_add_variable does (value URL-encoded, or in
+// hex if hexlen > 0)
+
+static void form_add(const char * name, const void * value, unsigned int hexlen)
+    {
+    const unsigned char * ptr;
+    const char * str;
+
+    if (form_len != 0)
+        form_body[form_len++] = '&';
+
+    for (str = name; *str; ++str)
+        form_body[form_len++] = *str;
+
+    form_body[form_len++] = '=';
+
+    if (hexlen != 0)
+        {
+        for (ptr = value; hexlen--; ++ptr)
+            form_len += sprintf(&form_body[form_len], "%02X", *ptr);
+        return;
+        }
+
+    for (str = value; *str; ++str)
+        {
+        if (isalnum((unsigned char) *str))
+            form_body[form_len++] = *str;
+        else if (*str == ' ')
+            form_body[form_len++] = '+';
+        else
+            form_len += sprintf(&form_body[form_len], "%%%02X", (unsigned char) *str);
+        }
+    }
+
+
+// Adds binary field as post_add_field does
+
+static void bin_add(unsigned char tag, const void * value, unsigned int len)
+    {
+    bin_body[bin_len++] = tag;
+
+    if (len < 0x80)
+        bin_body[bin_len++] = (unsigned char) len;
+    else
+        {
+        bin_body[bin_len++] = (unsigned char) (0x80 | (len >> 8));
+        bin_body[bin_len++] = (unsigned char) len;
+        }
+
+    memcpy(&bin_body[bin_len], value, len);
+    bin_len += len;
+    }
+
+
+// Writes number as len bytes (LSB-first)
+
+static void put_number(unsigned char * ptr, unsigned long value, unsigned int len)
+    {
+    while (len--)
+        {
+        *ptr++ = (unsigned char) value;
+        value >>= 8;
+        }
+    }
+
+
+// Adds number as binary field as post_add_number does
+
+static void bin_add_number(unsigned char tag, unsigned long value, unsigned int len)
+    {
+    unsigned char bytes[4];
+
+    put_number(bytes, value, len);
+    bin_add(tag, bytes, len);
+    }
+
+
+// Adds form variable as named binary field as post_add_variable does
+
+static void both_add_named(const char * name, const char * value)
+    {
+    unsigned char field[64];
+    unsigned int name_len;
+
+    form_add(name, value, 0);
+
+    name_len = strlen(name) + 1;
+    memcpy(field, name, name_len);
+    memcpy(field + name_len, value, strlen(value));
+
+    bin_add(POST_TAG_NAMED, field, name_len + strlen(value));
+    }
+
+
+// Makes LOOP packet with valid CRC from pseudo-random readings
+
+static void make_packet(unsigned int n, unsigned char * pkt)
+    {
+    unsigned int crc;
+    unsigned int i;
+
+    memset(pkt, 0, DATA_LEN);
+    memcpy(pkt, "LOO", 3);
+
+    for (i = 3; i < DATA_LEN - 2; ++i)
+        pkt[i] = (unsigned char) (rand() >> 4);
+
+    pkt[4] = (unsigned char) n;
+
+    crc = crc_calculate(pkt, DATA_LEN - 2);
+    pkt[DATA_LEN - 2] = (unsigned char) (crc >> 8);
+    pkt[DATA_LEN - 1] = (unsigned char) crc;
+    }
+
+
+// Sizes of each part of body in both formats
+
+typedef struct
+    {
+    const char * label;
+    unsigned int form;
+    unsigned int bin;
+    } Part_t;
+
+
+// Notes sizes of part of body added since last call
+
+static void end_part(Part_t * part, const char * label)
+    {
+    static unsigned int last_form, last_bin;
+
+    part->label = label;
+    part->form = form_len - last_form;
+    part->bin = bin_len - last_bin;
+
+    last_form = form_len;
+    last_bin = bin_len;
+    }
+
+
+// Builds typical body in both formats and checks binary body decodes correctly
+// Returns 0 if okay, or 1 on failure
+
+static int self_test(void)
+    {
+    static const unsigned char ip[4] = { 192, 168, 1, 20 };
+    static const unsigned char ver[2] = { 1, 25 };
+    unsigned char rec[REC_HDR_LEN + DATA_LEN];
+    unsigned char pkts[TEST_RECS + 1][DATA_LEN];
+    Part_t parts[8];
+    char name[8];
+    char value[11];
+    unsigned int np;
+    unsigned int i;
+    unsigned int pos;
+    unsigned int hdr_len;
+    unsigned int len;
+    unsigned int n_data;
+    unsigned char tag;
+    int fail;
+
+    srand(1);
+    np = 0;
+
+    // Fixed fields (as a collection POST from tasks.c)
+
+    form_add("station", "1234", 0);
+    bin_add_number(POST_TAG_STATION, 1234, 2);
+
+    end_part(&parts[np++], "Station ID");
+
+    make_packet(0, pkts[0]);
+    form_add("data", pkts[0], DATA_LEN);
+    bin_add(POST_TAG_DATA, pkts[0], DATA_LEN);
+
+    end_part(&parts[np++], "LOOP packet");
+
+    both_add_named("aggn", "30");
+    both_add_named("aggot", "612,648,630");
+    both_add_named("aggit", "701,705,703");
+    both_add_named("aggbar", "29912,29934,29921");
+    both_add_named("aggwind", "52,14,270,265");
+
+    end_part(&parts[np++], "Aggregated values");
+
+    for (i = 1; i <= TEST_RECS; ++i)
+        {
+        make_packet(i, pkts[i]);
+
+        sprintf(name, "data%u", i);
+        form_add(name, pkts[i], DATA_LEN);
+        sprintf(name, "dseq%u", i);
+        sprintf(value, "%lu", 104000UL + i);
+        form_add(name, value, 0);
+        sprintf(name, "dtime%u", i);
+        sprintf(value, "%lu", 1160000000UL + i * 60);
+        form_add(name, value, 0);
+
+        put_number(&rec[0], 104000UL + i, 4);
+        put_number(&rec[4], 1160000000UL + i * 60, 4);
+        memcpy(&rec[REC_HDR_LEN], pkts[i], DATA_LEN);
+        bin_add(POST_TAG_RECORD, rec, sizeof(rec));
+        }
+
+    end_part(&parts[np++], "Queued records (6)");
+
+    form_add("seq", "104007", 0);
+    bin_add_number(POST_TAG_SEQ, 104007UL, 4);
+
+    form_add("localip", ip, sizeof(ip));
+    bin_add(POST_TAG_LOCAL_IP, ip, sizeof(ip));
+
+    form_add("ver", "125", 0);
+    bin_add(POST_TAG_VERSION, ver, sizeof(ver));
+
+    end_part(&parts[np++], "Seq, local IP, version");
+
+    // Check that binary body decodes back to the packets put in
+
+    fail = 0;
+    n_data = 0;
+
+    for (pos = 0; pos < bin_len; pos += hdr_len + len)
+        {
+        hdr_len = get_field(bin_body, bin_len, pos, &tag, &len);
+
+        if (hdr_len == 0)
+            {
+            printf("Body truncated at byte %u\n", pos);
+            return 1;
+            }
+
+        if (tag == POST_TAG_DATA)
+            fail |= (len != DATA_LEN ||
+                     memcmp(bin_body + pos + hdr_len, pkts[0], DATA_LEN) != 0);
+        else if (tag == POST_TAG_RECORD)
+            {
+            ++n_data;
+            fail |= (len != REC_HDR_LEN + DATA_LEN ||
+                     get_number(bin_body + pos + hdr_len, 4) != 104000UL + n_data ||
+                     memcmp(bin_body + pos + hdr_len + REC_HDR_LEN, pkts[n_data],
+                            DATA_LEN) != 0);
+            }
+        }
+
+    fail |= (n_data != TEST_RECS);
+
+    printf("Part of body                Form  Binary   Ratio\n");
+
+    for (i = 0; i < np; ++i)
+        printf("%-24s  %6u  %6u  %5.1f%%\n", parts[i].label, parts[i].form, parts[i].bin,
+                                             100.0 * parts[i].bin / parts[i].form);
+
+    printf("%-24s  %6u  %6u  %5.1f%%\n", "Whole body", form_len, bin_len,
+                                         100.0 * bin_len / form_len);
+
+    printf("\nDecoded binary body:\n");
+    (void) decode_body(bin_body, bin_len);
+
+    printf("\nRound trip %s\n", fail ? "FAILED" : "passed");
+
+    return fail;
+    }
+
+
+int main(int argc, char * argv[])
+    {
+    static unsigned char body[MAX_BODY_LEN];
+    FILE * fp;
+    size_t len;
+
+    if (argc == 2 && strcmp(argv[1], "-t") == 0)
+        return self_test();
+
+    if (argc > 2 || (argc == 2 && argv[1][0] == '-'))
+        {
+        fprintf(stderr, "Usage: %s [body_file] | -t\n", argv[0]);
+        return 2;
+        }
+
+    fp = (argc == 2) ? fopen(argv[1], "rb") : stdin;
+
+    if (fp == NULL)
+        {
+        perror(argv[1]);
+        return 2;
+        }
+
+    len = fread(body, 1, sizeof(body), fp);
+
+    if (fp != stdin)
+        fclose(fp);
+
+    return (decode_body(body, (unsigned int) len) < 0) ? 1 : 0;
+    }
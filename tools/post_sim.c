@@ -0,0 +1,1091 @@
+// Host mock of central server and load harness for post_client.c
+
+// Copyright (c) 2006, Ian Chapman (Chapmip Consultancy)
+
+// All rights reserved, except for those rights implicitly granted to
+// GitHub Inc by publishing on GitHub and those rights granted by
+// commercial agreement with the author.
+
+
+// Builds and runs on a host PC (not on the Rabbit module), for example:
+//
+//   cc -O2 -pthread -Dfar= -Ihost -I../code -o post_sim post_sim.c
+//      ../code/post_client.c ../code/dns_cache.c ../code/url_enc.c
+//   ./post_sim [-n runs] [-m mode] [-d delay_ms] [-b bad_id_pct] [-r reject_pct]
+//              [-D dns_ms] [-g gap_ms] [-t tick_us] [-s seed] [-H] [-v]
+//   ./post_sim -l port [-m mode] [-d delay_ms] [-b bad_id_pct] [-r reject_pct]
+//
+// A thread listens on the loopback interface and behaves like the central
+// server, speaking the subset of HTTP/1.1 used by post_client.c: it reads
+// each POST (header and body of the given Content-Length) and replies with
+// a "Server time =" line and then "Success!", "Bad ID!" (at the rate set by
+// -b) or "Reject!" (at the rate set by -r).  The unmodified post_client.c
+// state machine (with dns_cache.c and url_enc.c) runs against it through
+// the TCP/IP stand-ins below (see host/stcpip.h), which use host sockets.
+// The name "localhost" is resolved after the delay set by -D.
+//
+// Each reply mode sends the response in a different way:
+//
+//   length      Content-Length, then "Connection: close" and close
+//   keepalive   Content-Length, and connection kept open for the next POST
+//   chunked     Transfer-Encoding: chunked (in two chunks), kept open
+//   close       HTTP/1.0 with no length, body ended by closing connection
+//   slow        As keepalive, but after delay_ms and a few bytes at a time
+//   truncated   As keepalive, but cut short at a random point and closed
+//
+// For each mode in turn (or just the one given by -m), a typical body is
+// posted repeatedly and the rate of transactions, percentiles of latency
+// (from post_start() to completion) of successful POSTs and the number of
+// failures with each status code are reported, along with the number of
+// connections and requests seen by the server.  With -H, the phase timing
+// statistics kept by post_client.c (see post_pack_stats) are shown after
+// the results for each mode.
+//
+// With -l, only the server runs (on the given port, in the mode given by
+// -m, default keepalive), as a local stand-in for the central server for a
+// node on the LAN.
+
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netdb.h>
+#define inet_addr   sys_inet_addr       // Library version is replaced by stand-in
+#include <arpa/inet.h>
+#undef inet_addr
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include "Rabbit.h"
+#include "stcpip.h"
+#include "report.h"
+#include "rtc_utils.h"
+#include "wx_board.h"
+#include "wx_main.h"
+#include "bb_vars.h"
+#include "dns_cache.h"
+#include "post_client.h"
+
+
+// Reply modes of server
+
+enum mode_value
+    {
+    MODE_LENGTH = 0,
+    MODE_KEEPALIVE,
+    MODE_CHUNKED,
+    MODE_CLOSE,
+    MODE_SLOW,
+    MODE_TRUNCATED,
+    NUM_MODES
+    };
+
+static const char * const mode_names[NUM_MODES] =
+    {
+    "length", "keepalive", "chunked", "close", "slow", "truncated",
+    };
+
+
+// Names of POST status codes (POST_NOT_STARTED to POST_BAD_STATE)
+
+#define NUM_FAIL_CODES  13
+
+static const char * const fail_names[NUM_FAIL_CODES] =
+    {
+    "not started", "cannot start", "timeout", "aborted", "DNS error", "socket error",
+    "connection lost", "send error", "response error", "server error", "bad ID",
+    "rejected", "bad state",
+    };
+
+
+#define BODY_SIZE       3072            // As POST_BODY_SIZE in tasks.c
+#define DATA_LEN        99              // LOOP packet length (as davis.h)
+#define QUEUED_RECS     2               // Queued records in each body
+
+#define MAX_RUNS        100000
+#define REQ_BUF_SIZE    8192            // Largest request accepted by server
+#define SLOW_PIECE      8               // Bytes sent at a time in slow mode
+
+#define POST_PATH       "/wx/post.php"
+
+
+// Options
+
+static unsigned int runs = 200;
+static int only_mode = -1;
+static unsigned int delay_ms = 50;
+static unsigned int bad_id_pct;
+static unsigned int reject_pct;
+static unsigned int dns_ms = 5;
+static unsigned int gap_ms;
+static unsigned long tick_us = 100;
+static int show_stats;
+static int verbose;
+
+
+// Server state (shared with connection threads)
+
+static pthread_mutex_t srv_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct
+    {
+    int fd;                             // Listening socket
+    unsigned short port;                // Port number listened on
+    enum mode_value mode;               // Current reply mode
+    unsigned long conns;                // Connections accepted
+    unsigned long requests;             // Requests read in full
+    unsigned int seed;                  // Random number state
+    } srv;
+
+
+// Resolver stand-in state
+
+static struct
+    {
+    int busy;                           // Flag indicates resolve in progress
+    unsigned long done_ms;              // Time at which result is ready
+    longword ip;                        // Result (0 if name not found)
+    } resolver;
+
+
+// *** INTERNAL FUNCTIONS ***
+
+// Returns milliseconds since first call (from monotonic clock)
+
+static unsigned long now_ms(void)
+    {
+    static struct timespec start;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    if (start.tv_sec == 0 && start.tv_nsec == 0)
+        start = ts;
+
+    return (unsigned long) ((ts.tv_sec - start.tv_sec) * 1000L +
+                            (ts.tv_nsec - start.tv_nsec) / 1000000L);
+    }
+
+
+// Returns microseconds from monotonic clock (for latency measurement)
+
+static double now_us(void)
+    {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec * 1e6 + (double) ts.tv_nsec / 1e3;
+    }
+
+
+static void sleep_ms(unsigned int ms)
+    {
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long) (ms % 1000) * 1000000L;
+
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+    }
+
+
+// Returns !0 with given percentage chance (server thread random numbers)
+
+static int srv_chance(unsigned int pct)
+    {
+    int hit;
+
+    pthread_mutex_lock(&srv_lock);
+    hit = (unsigned int) (rand_r(&srv.seed) % 100) < pct;
+    pthread_mutex_unlock(&srv_lock);
+
+    return hit;
+    }
+
+
+// Writes whole buffer to connection
+// Returns 0 if okay, or -1 if connection failed
+
+static int srv_write(int fd, const char * buf, size_t len)
+    {
+    ssize_t rc;
+
+    while (len != 0)
+        {
+        rc = send(fd, buf, len, MSG_NOSIGNAL);
+
+        if (rc < 0)
+            {
+            if (errno == EINTR)
+                continue;
+            return -1;
+            }
+
+        buf += rc;
+        len -= (size_t) rc;
+        }
+
+    return 0;
+    }
+
+
+// Reads one request (header and body) from connection
+// Returns length of body, or -1 if connection closed or request not valid
+
+static long srv_read_request(int fd, char * buf, size_t * held)
+    {
+    char * end;
+    char * ptr;
+    long body_len;
+    size_t head_len;
+    ssize_t rc;
+
+    for (;;)
+        {
+        buf[*held] = '\0';
+
+        if ((end = strstr(buf, "\r\n\r\n")) != NULL)
+            break;
+
+        if (*held >= REQ_BUF_SIZE - 1)
+            return -1;                          // Header too long
+
+        rc = recv(fd, buf + *held, REQ_BUF_SIZE - 1 - *held, 0);
+
+        if (rc <= 0)
+            return -1;                          // Closed (or aborted) by client
+
+        *held += (size_t) rc;
+        }
+
+    if (strncmp(buf, "POST ", 5) != 0)
+        return -1;
+
+    body_len = -1;
+
+    for (ptr = buf; ptr < end; ++ptr)
+        {
+        if (strncasecmp(ptr, "\r\nContent-Length:", 17) == 0)
+            body_len = strtol(ptr + 17, NULL, 10);
+        }
+
+    head_len = (size_t) (end - buf) + 4;
+
+    if (body_len < 0 || head_len + (size_t) body_len > REQ_BUF_SIZE - 1)
+        return -1;
+
+    while (*held < head_len + (size_t) body_len)
+        {
+        rc = recv(fd, buf + *held, REQ_BUF_SIZE - 1 - *held, 0);
+
+        if (rc <= 0)
+            return -1;
+
+        *held += (size_t) rc;
+        }
+
+    // Keep any bytes of a following (pipelined) request
+
+    *held -= head_len + (size_t) body_len;
+    memmove(buf, buf + head_len + body_len, *held);
+
+    return body_len;
+    }
+
+
+// Sends reply to request in given mode
+// Returns !0 if connection is to be kept open, or 0 if it is to be closed
+
+static int srv_reply(int fd, enum mode_value mode)
+    {
+    char body[80];
+    char resp[512];
+    const char * result;
+    size_t body_len;
+    size_t len;
+    size_t pos;
+    size_t piece;
+    size_t half;
+
+    if (srv_chance(bad_id_pct))
+        result = "Bad ID!";
+    else if (srv_chance(reject_pct))
+        result = "Reject!";
+    else
+        result = "Success!";
+
+    body_len = (size_t) sprintf(body, "Server time = %lu\r\n%s\r\n",
+                                (unsigned long) time(NULL), result);
+
+    switch (mode)
+        {
+        case MODE_LENGTH:
+            len = (size_t) sprintf(resp, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+                                         "Content-Length: %u\r\nConnection: close\r\n\r\n%s",
+                                   (unsigned int) body_len, body);
+            (void) srv_write(fd, resp, len);
+            return 0;
+
+        case MODE_CLOSE:
+            len = (size_t) sprintf(resp, "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n"
+                                         "\r\n%s", body);
+            (void) srv_write(fd, resp, len);
+            return 0;
+
+        case MODE_CHUNKED:
+            half = body_len / 2;
+            len = (size_t) sprintf(resp, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+                                         "Transfer-Encoding: chunked\r\n"
+                                         "Keep-Alive: timeout=15, max=100\r\n\r\n"
+                                         "%x;part=1\r\n%.*s\r\n%x\r\n%s\r\n0\r\n\r\n",
+                                   (unsigned int) half, (int) half, body,
+                                   (unsigned int) (body_len - half), body + half);
+            return (srv_write(fd, resp, len) == 0);
+
+        default:
+            break;
+        }
+
+    len = (size_t) sprintf(resp, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+                                 "Content-Length: %u\r\n"
+                                 "Keep-Alive: timeout=15, max=100\r\n\r\n%s",
+                           (unsigned int) body_len, body);
+
+    if (mode == MODE_TRUNCATED)
+        {
+        pthread_mutex_lock(&srv_lock);
+        len = (size_t) rand_r(&srv.seed) % len;
+        pthread_mutex_unlock(&srv_lock);
+
+        (void) srv_write(fd, resp, len);
+        return 0;
+        }
+
+    if (mode == MODE_SLOW)
+        {
+        sleep_ms(delay_ms);
+
+        for (pos = 0; pos < len; pos += piece)
+            {
+            piece = (len - pos < SLOW_PIECE) ? len - pos : SLOW_PIECE;
+
+            if (srv_write(fd, resp + pos, piece) != 0)
+                return 0;
+
+            sleep_ms(1);
+            }
+
+        return 1;
+        }
+
+    return (srv_write(fd, resp, len) == 0);             // MODE_KEEPALIVE
+    }
+
+
+// Thread handles one connection to server until it is closed
+
+static void * srv_conn_thread(void * arg)
+    {
+    char * buf;
+    size_t held;
+    int fd;
+    int one;
+    enum mode_value mode;
+
+    fd = (int) (long) arg;
+    one = 1;
+    held = 0;
+
+    (void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    buf = malloc(REQ_BUF_SIZE);
+
+    while (buf != NULL && srv_read_request(fd, buf, &held) >= 0)
+        {
+        pthread_mutex_lock(&srv_lock);
+        ++srv.requests;
+        mode = srv.mode;
+        pthread_mutex_unlock(&srv_lock);
+
+        if (!srv_reply(fd, mode))
+            break;
+        }
+
+    free(buf);
+    close(fd);
+
+    return NULL;
+    }
+
+
+// Thread accepts connections to server and starts a thread for each one
+
+static void * srv_thread(void * arg)
+    {
+    pthread_t thread;
+    int fd;
+
+    (void) arg;
+
+    for (;;)
+        {
+        fd = accept(srv.fd, NULL, NULL);
+
+        if (fd < 0)
+            {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("accept");
+            return NULL;
+            }
+
+        pthread_mutex_lock(&srv_lock);
+        ++srv.conns;
+        pthread_mutex_unlock(&srv_lock);
+
+        if (pthread_create(&thread, NULL, srv_conn_thread, (void *) (long) fd) != 0)
+            close(fd);
+        else
+            pthread_detach(thread);
+        }
+    }
+
+
+// Opens listening socket on loopback interface (or any interface if port is
+// given) and starts server thread
+// Returns 0 if okay, or -1 on failure
+
+static int start_server(unsigned short port)
+    {
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+    pthread_t thread;
+    int one;
+
+    srv.fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (srv.fd < 0)
+        {
+        perror("socket");
+        return -1;
+        }
+
+    one = 1;
+    (void) setsockopt(srv.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl((port != 0) ? INADDR_ANY : INADDR_LOOPBACK);
+
+    if (bind(srv.fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(srv.fd, 64) != 0)
+        {
+        perror("bind/listen");
+        return -1;
+        }
+
+    addr_len = sizeof(addr);
+    (void) getsockname(srv.fd, (struct sockaddr *) &addr, &addr_len);
+    srv.port = ntohs(addr.sin_port);
+
+    if (pthread_create(&thread, NULL, srv_thread, NULL) != 0)
+        return -1;
+
+    pthread_detach(thread);
+    return 0;
+    }
+
+
+// Builds typical body (a collection and some queued records)
+
+static void build_body(unsigned long seq)
+    {
+    unsigned char data[DATA_LEN];
+    char name[8];
+    char value[21];
+    unsigned int i;
+    unsigned int j;
+
+    post_clear_body();
+
+    (void) post_add_variable("station", "1234", 0);
+
+    for (i = 0; i <= QUEUED_RECS; ++i)
+        {
+        for (j = 0; j < DATA_LEN; ++j)
+            data[j] = (unsigned char) rand();
+
+        if (i == 0)
+            (void) post_add_variable("data", (char *) data, DATA_LEN);
+        else
+            {
+            sprintf(name, "data%u", i);
+            (void) post_add_variable(name, (char *) data, DATA_LEN);
+            sprintf(name, "dseq%u", i);
+            sprintf(value, "%lu", seq - i);
+            (void) post_add_variable(name, value, 0);
+            }
+        }
+
+    sprintf(value, "%lu", seq);
+    (void) post_add_variable("seq", value, 0);
+    (void) post_add_variable("ver", "1.25", 0);
+    }
+
+
+static int cmp_latency(const void * a, const void * b)
+    {
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+
+    return (da > db) - (da < db);
+    }
+
+
+// Returns latency at given percentile from sorted list
+
+static double percentile(const double * lat, unsigned int count, unsigned int pct)
+    {
+    unsigned int index;
+
+    index = (count * pct + 99) / 100;
+
+    return lat[(index != 0) ? index - 1 : 0];
+    }
+
+
+// Shows phase timing statistics kept by post_client.c
+
+static void show_phase_stats(void)
+    {
+    static const char * const names[POST_NUM_PHASES] =
+        {
+        "DNS", "Connect", "Header", "Body", "First byte", "Close",
+        };
+    unsigned char buf[POST_STATS_LEN];
+    unsigned int phase;
+    unsigned int i;
+    unsigned int val[4];
+
+    (void) post_pack_stats(buf);
+
+    printf("  Phase times over last %u POSTs (ms): last/min/avg/max\n", buf[0]);
+
+    for (phase = 0; phase < POST_NUM_PHASES; ++phase)
+        {
+        for (i = 0; i < 4; ++i)
+            val[i] = buf[1 + phase * 8 + i * 2] | (buf[2 + phase * 8 + i * 2] << 8);
+
+        printf("    %-12s", names[phase]);
+
+        for (i = 0; i < 4; ++i)
+            {
+            if (val[i] == 0xFFFF)
+                printf("     -");
+            else
+                printf(" %5u", val[i]);
+            }
+
+        printf("\n");
+        }
+    }
+
+
+// Runs POSTs against server in given mode and reports results
+
+static void run_mode(enum mode_value mode, double * lat)
+    {
+    unsigned int fails[NUM_FAIL_CODES];
+    unsigned int ok;
+    unsigned int run;
+    unsigned long conns;
+    unsigned long requests;
+    double t0;
+    double start;
+    double elapsed;
+    int status;
+    unsigned int i;
+
+    memset(fails, 0, sizeof(fails));
+    ok = 0;
+
+    post_close_idle();                  // Start afresh with each mode
+
+    pthread_mutex_lock(&srv_lock);
+    srv.mode = mode;
+    conns = srv.conns;
+    requests = srv.requests;
+    pthread_mutex_unlock(&srv_lock);
+
+    t0 = now_us();
+
+    for (run = 0; run < runs; ++run)
+        {
+        build_body(100000UL + run);
+
+        start = now_us();
+
+        if (post_start() < 0)
+            {
+            ++fails[-POST_CANNOT_START - 1];
+            continue;
+            }
+
+        while ((status = post_tick()) == POST_PENDING)
+            {
+            dns_cache_tick();
+
+            if (tick_us != 0)
+                usleep(tick_us);
+            }
+
+        if (status == POST_SUCCESS)
+            lat[ok++] = (now_us() - start) / 1000.0;
+        else if (status < 0 && -status <= NUM_FAIL_CODES)
+            ++fails[-status - 1];
+
+        if (gap_ms != 0)
+            sleep_ms(gap_ms);
+        }
+
+    elapsed = (now_us() - t0) / 1e6;
+
+    pthread_mutex_lock(&srv_lock);
+    conns = srv.conns - conns;
+    requests = srv.requests - requests;
+    pthread_mutex_unlock(&srv_lock);
+
+    printf("%-10s %5u/%-5u ok  %8.1f tx/s", mode_names[mode], ok, runs, runs / elapsed);
+
+    if (ok != 0)
+        {
+        qsort(lat, ok, sizeof(lat[0]), cmp_latency);
+
+        printf("  latency ms p50 %.2f  p90 %.2f  p99 %.2f  max %.2f",
+                percentile(lat, ok, 50), percentile(lat, ok, 90),
+                percentile(lat, ok, 99), lat[ok - 1]);
+        }
+
+    printf("\n           server: %lu connections, %lu requests", conns, requests);
+
+    for (i = 0; i < NUM_FAIL_CODES; ++i)
+        {
+        if (fails[i] != 0)
+            printf(", %s x%u", fail_names[i], fails[i]);
+        }
+
+    printf("\n");
+
+    if (show_stats)
+        show_phase_stats();
+    }
+
+
+static void usage(void)
+    {
+    printf("Usage: post_sim [-n runs] [-m mode] [-d delay_ms] [-b bad_id_pct] [-r reject_pct]\n"
+           "                [-D dns_ms] [-g gap_ms] [-t tick_us] [-s seed] [-H] [-v]\n"
+           "       post_sim -l port [-m mode] [-d delay_ms] [-b bad_id_pct] [-r reject_pct]\n"
+           "Modes: length, keepalive, chunked, close, slow, truncated\n");
+    exit(1);
+    }
+
+
+// *** EXTERNAL FUNCTIONS (stand-ins for Rabbit library and other modules) ***
+
+unsigned long getMilliSeconds(void)
+    {
+    return now_ms();
+    }
+
+unsigned long getSeconds(void)
+    {
+    return now_ms() / 1000;
+    }
+
+void * xalloc(long size)
+    {
+    return malloc((size_t) size);
+    }
+
+int tcp_open(tcp_Socket * s, word lport, longword ina, word port, void * handler)
+    {
+    struct sockaddr_in addr;
+    int one;
+
+    (void) lport; (void) handler;
+
+    s->established = 0;
+    s->closed = 0;
+    s->fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (s->fd < 0)
+        return 0;
+
+    one = 1;
+    (void) setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    (void) fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) | O_NONBLOCK);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(ina);
+
+    if (connect(s->fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 && errno != EINPROGRESS)
+        {
+        close(s->fd);
+        s->fd = -1;
+        return 0;
+        }
+
+    return 1;
+    }
+
+int sock_established(tcp_Socket * s)
+    {
+    struct pollfd pfd;
+    socklen_t len;
+    int err;
+
+    if (s->established || s->closed || s->fd < 0)
+        return s->established;
+
+    pfd.fd = s->fd;
+    pfd.events = POLLOUT;
+
+    if (poll(&pfd, 1, 0) <= 0)
+        return 0;
+
+    err = 0;
+    len = sizeof(err);
+    (void) getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+
+    if (err != 0)
+        s->closed = 1;
+    else
+        s->established = 1;
+
+    return s->established;
+    }
+
+int tcp_tick(tcp_Socket * s)
+    {
+    char ch;
+    ssize_t rc;
+
+    if (s == NULL)
+        return 1;
+
+    if (s->fd < 0 || s->closed)
+        return 0;
+
+    if (!s->established)
+        {
+        (void) sock_established(s);
+        return !s->closed;
+        }
+
+    rc = recv(s->fd, &ch, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    if (rc == 0 || (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        s->closed = 1;                  // Closed by server (and all data read)
+
+    return !s->closed;
+    }
+
+int sock_bytesready(tcp_Socket * s)
+    {
+    int count;
+
+    if (s->fd < 0 || ioctl(s->fd, FIONREAD, &count) != 0 || count == 0)
+        return -1;
+
+    return count;
+    }
+
+void sock_mode(tcp_Socket * s, int mode)
+    {
+    (void) s; (void) mode;
+    }
+
+int sock_fastread(tcp_Socket * s, char * dp, int len)
+    {
+    ssize_t rc;
+
+    if (s->fd < 0 || !s->established)
+        return 0;
+
+    rc = recv(s->fd, dp, (size_t) len, MSG_DONTWAIT);
+
+    if (rc > 0)
+        return (int) rc;
+
+    if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        s->closed = 1;
+
+    return (rc == 0) ? 0 : ((s->closed) ? -1 : 0);
+    }
+
+int sock_xfastwrite(tcp_Socket * s, long dp, int len)
+    {
+    ssize_t rc;
+
+    if (s->fd < 0 || s->closed)
+        return -1;
+
+    rc = send(s->fd, (const void *) dp, (size_t) len, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    if (rc >= 0)
+        return (int) rc;
+
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return 0;
+
+    s->closed = 1;
+    return -1;
+    }
+
+void sock_abort(tcp_Socket * s)
+    {
+    struct linger lin;
+
+    if (s->fd < 0)
+        return;
+
+    lin.l_onoff = 1;                    // Reset connection, as on Rabbit module
+    lin.l_linger = 0;
+    (void) setsockopt(s->fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+
+    close(s->fd);
+    s->fd = -1;
+    s->closed = 1;
+    }
+
+longword inet_addr(char * dotted_ip)
+    {
+    struct in_addr addr;
+
+    if (inet_pton(AF_INET, dotted_ip, &addr) != 1)
+        return 0;
+
+    return ntohl(addr.s_addr);
+    }
+
+int resolve_name_start(char * name)
+    {
+    struct addrinfo hints;
+    struct addrinfo * res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+
+    resolver.ip = 0;
+
+    if (getaddrinfo(name, NULL, &hints, &res) == 0)
+        {
+        resolver.ip = ntohl(((struct sockaddr_in *) res->ai_addr)->sin_addr.s_addr);
+        freeaddrinfo(res);
+        }
+
+    resolver.busy = 1;
+    resolver.done_ms = now_ms() + dns_ms;
+    return 1;
+    }
+
+int resolve_name_check(int handle, longword * ip)
+    {
+    (void) handle;
+
+    if (!resolver.busy)
+        return RESOLVE_FAILED;
+
+    if ((long) (now_ms() - resolver.done_ms) < 0)
+        return RESOLVE_AGAIN;
+
+    resolver.busy = 0;
+
+    if (resolver.ip == 0)
+        return RESOLVE_FAILED;
+
+    *ip = resolver.ip;
+    return RESOLVE_SUCCESS;
+    }
+
+int resolve_cancel(int handle)
+    {
+    (void) handle;
+
+    resolver.busy = 0;
+    return 0;
+    }
+
+void report(unsigned char type_flags, const char * fmt, ...)
+    {
+    char host_fmt[256];
+    char * ptr;
+    va_list args;
+
+    if (!verbose)
+        return;
+
+    // Far string format "%ls" is plain "%s" on a host PC
+
+    snprintf(host_fmt, sizeof(host_fmt), "%s", fmt);
+
+    while ((ptr = strstr(host_fmt, "%ls")) != NULL)
+        memmove(ptr + 1, ptr + 2, strlen(ptr + 2) + 1);
+
+    va_start(args, fmt);
+    vprintf(host_fmt, args);
+    va_end(args);
+
+    if (!(type_flags & REPORT_RAW))
+        printf("\n");
+    }
+
+char rtc_validated;
+
+unsigned long rtc_diff(time_t comp_val)
+    {
+    time_t rtc_val;
+
+    rtc_val = time(NULL);
+
+    return (rtc_val >= comp_val) ? rtc_val - comp_val : comp_val - rtc_val;
+    }
+
+void rtc_update(time_t new_val)
+    {
+    (void) new_val;
+    }
+
+char * rtc_str(void)
+    {
+    return "(host clock)";
+    }
+
+const char * bb_post_error_str;
+int bb_post_error_state_num;
+
+void wx_set_leds(unsigned char mask, unsigned char new_state)
+    {
+    (void) mask; (void) new_state;
+    }
+
+char * get_ip_string(longword ip_addr)
+    {
+    static char ip_buf[16];
+
+    sprintf(ip_buf, "%u.%u.%u.%u", (unsigned int) (ip_addr >> 24) & 0xFF,
+            (unsigned int) (ip_addr >> 16) & 0xFF, (unsigned int) (ip_addr >> 8) & 0xFF,
+            (unsigned int) ip_addr & 0xFF);
+
+    return ip_buf;
+    }
+
+
+int main(int argc, char ** argv)
+    {
+    double * lat;
+    unsigned int listen_port;
+    unsigned int seed;
+    int opt;
+    int i;
+
+    listen_port = 0;
+    seed = 1;
+
+    while ((opt = getopt(argc, argv, "n:m:d:b:r:D:g:t:s:l:Hv")) != -1)
+        {
+        switch (opt)
+            {
+            case 'n':
+                runs = (unsigned int) atoi(optarg);
+                if (runs == 0 || runs > MAX_RUNS)
+                    usage();
+                break;
+
+            case 'm':
+                for (i = 0; i < NUM_MODES; ++i)
+                    {
+                    if (strcmp(optarg, mode_names[i]) == 0)
+                        only_mode = i;
+                    }
+                if (only_mode < 0)
+                    usage();
+                break;
+
+            case 'd': delay_ms = (unsigned int) atoi(optarg); break;
+            case 'b': bad_id_pct = (unsigned int) atoi(optarg); break;
+            case 'r': reject_pct = (unsigned int) atoi(optarg); break;
+            case 'D': dns_ms = (unsigned int) atoi(optarg); break;
+            case 'g': gap_ms = (unsigned int) atoi(optarg); break;
+            case 't': tick_us = strtoul(optarg, NULL, 10); break;
+            case 's': seed = (unsigned int) atoi(optarg); break;
+            case 'l': listen_port = (unsigned int) atoi(optarg); break;
+            case 'H': show_stats = 1; break;
+            case 'v': verbose = 1; break;
+            default:  usage();
+            }
+        }
+
+    srand(seed);
+    srv.seed = seed;
+    srv.mode = (only_mode >= 0) ? (enum mode_value) only_mode : MODE_KEEPALIVE;
+
+    if (listen_port != 0)
+        {
+        if (listen_port > 65535 || start_server((unsigned short) listen_port) != 0)
+            return 1;
+
+        printf("Serving on port %u in %s mode (path not checked) -- Ctrl-C to stop\n",
+                srv.port, mode_names[srv.mode]);
+
+        for (;;)
+            {
+            sleep(10);
+
+            pthread_mutex_lock(&srv_lock);
+            printf("%lu connections, %lu requests\n", srv.conns, srv.requests);
+            pthread_mutex_unlock(&srv_lock);
+            }
+        }
+
+    if (start_server(0) != 0)
+        return 1;
+
+    lat = malloc(runs * sizeof(lat[0]));
+
+    if (lat == NULL || post_init(BODY_SIZE) < 0 ||
+        post_set_server(POST_PRIMARY, "localhost", srv.port, POST_PATH, NULL, 0) < 0)
+        {
+        printf("Failed to set up POST client\n");
+        return 1;
+        }
+
+    printf("%u POSTs per mode to port %u (delay %u ms, DNS %u ms, bad ID %u%%, reject %u%%)\n",
+            runs, srv.port, delay_ms, dns_ms, bad_id_pct, reject_pct);
+
+    for (i = 0; i < NUM_MODES; ++i)
+        {
+        if (only_mode < 0 || only_mode == i)
+            run_mode((enum mode_value) i, lat);
+        }
+
+    free(lat);
+    return 0;
+    }